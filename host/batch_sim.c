@@ -0,0 +1,194 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <esp_timer.h>
+#include <driver/gpio.h>
+
+#include "host.h"
+#include "event.h"
+#include "ctl.h"
+#include "settings.h"
+#include "sched.h"
+
+/**
+ * Batch test
+ *
+ * Runs every sequence of up to 3 of ON, OFF, SCHED_ON (with a window
+ * that's on now, or one that's off) and SCHED_OFF, one command at a
+ * time, and then as a batch, from each starting state: The lights on or
+ * off, the daily window off, on or off now, and with or without a rule
+ * that's on now. Both have to leave the lights and the settings the
+ * same, and the schedule armed the same, going by the lights the next
+ * morning.
+ */
+
+#define HOUR   3600
+#define T0     (1717200000 + 20 * HOUR) /* 2024-06-01 20:00:00 */
+#define CMDS   5
+#define LEN    3
+
+void app_main(void);
+
+static const struct {
+	uint8_t id, shr, smn, ehr, emn;
+} cmds[CMDS] = {
+	{ ON,         0, 0,  0, 0 },
+	{ OFF,        0, 0,  0, 0 },
+	{ SCHED_ON,  18, 0,  6, 0 },
+	{ SCHED_ON,   6, 0, 18, 0 },
+	{ SCHED_OFF,  0, 0,  0, 0 }
+};
+
+static const char *const names[CMDS] = {
+	"on", "off", "sched_on(now)", "sched_on(later)", "sched_off"
+};
+
+struct result {
+	int lights;     /**< Lights, right after */
+	int morning;    /**< Lights, at 07:00    */
+	int light_sw;
+	int sched_sw;
+	unsigned int window;
+};
+
+static void window(unsigned int c)
+{
+	settings_lock();
+	settings.sched_sw = 1;
+	settings.shr      = cmds[c].shr;
+	settings.smn      = cmds[c].smn;
+	settings.ehr      = cmds[c].ehr;
+	settings.emn      = cmds[c].emn;
+	settings_unlock();
+}
+
+/**
+ * Lights on or off, the daily window off, on now or off now, and a
+ * rule that's on now, or not
+ */
+static void start(unsigned int s)
+{
+	struct sched_rule r = { .days = SCHED_ALL, .start = 19 * 60,
+	                        .end = 21 * 60 };
+	struct timeval tv = { .tv_sec = T0 };
+
+	host_settimeofday(&tv, NULL);
+	while (!sched_del(0));
+	ctl_send(SCHED_OFF, 0);
+	ctl_send(OFF, 0);
+	ctl_run();
+
+	if (s & 1) sched_add(&r);
+	ctl_send(SCHED_RULES, 0);
+	ctl_run();
+	ctl_send(s & 2 ? ON : OFF, 0);
+	ctl_run();
+	if (s >> 2) {
+		window(s >> 2 == 1 ? 2 : 3);
+		ctl_send(SCHED_ON, 0);
+		ctl_run();
+	}
+}
+
+static void finish(struct result *r)
+{
+	int64_t next;
+
+	r->lights   = gpio_get_level(CONFIG_GPIO_LIGHTS);
+	r->light_sw = settings.light_sw;
+	r->sched_sw = settings.sched_sw;
+	r->window   = settings.shr << 24 | settings.smn << 16 |
+	              settings.ehr << 8 | settings.emn;
+
+	while (time(NULL) < T0 + 11 * HOUR &&
+	       (next = esp_timer_get_next_alarm()) != INT64_MAX) {
+		if (next > host_clock())
+			host_clock_advance(next - host_clock());
+		host_timer_run();
+		ctl_run();
+	}
+
+	r->morning = gpio_get_level(CONFIG_GPIO_LIGHTS);
+}
+
+static void one_by_one(const unsigned int *seq, unsigned int n,
+                       struct result *r)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		if (cmds[seq[i]].id == SCHED_ON)
+			window(seq[i]);
+		ctl_send(cmds[seq[i]].id, 0);
+		ctl_run();
+	}
+
+	finish(r);
+}
+
+static void batched(const unsigned int *seq, unsigned int n,
+                    struct result *r)
+{
+	struct ctl_cmd c = { .id = BATCH };
+	unsigned int i;
+
+	c.batch.n = (uint8_t)n;
+	for (i = 0; i < n; i++) {
+		c.batch.cmd[i].id  = cmds[seq[i]].id;
+		c.batch.cmd[i].shr = cmds[seq[i]].shr;
+		c.batch.cmd[i].smn = cmds[seq[i]].smn;
+		c.batch.cmd[i].ehr = cmds[seq[i]].ehr;
+		c.batch.cmd[i].emn = cmds[seq[i]].emn;
+	}
+
+	ctl_post(&c, 0);
+	ctl_run();
+	finish(r);
+}
+
+int main(void)
+{
+	unsigned int seq[LEN], n, i, k, s, runs = 0, fail = 0;
+	struct result one, all;
+
+	ds1302_reset(&host_ds1302);
+	app_main();
+	ctl_run();
+	ctl_send(CONNECTED, 0);
+	ctl_run();
+
+	for (n = 1; n <= LEN; n++) {
+		for (k = 0, i = 1; i <= n; i++) k = k ? k * CMDS : CMDS;
+		while (k--) {
+			for (i = 0, s = k; i < n; i++, s /= CMDS)
+				seq[i] = s % CMDS;
+
+			for (s = 0; s < 12; s++) {
+				start(s);
+				one_by_one(seq, n, &one);
+				start(s);
+				batched(seq, n, &all);
+
+				runs++;
+				if (!memcmp(&one, &all, sizeof(one)))
+					continue;
+				if (fail++ >= 10)
+					continue;
+
+				printf("state %u:", s);
+				for (i = 0; i < n; i++)
+					printf(" %s", names[seq[i]]);
+				printf(": lights %d/%d, %d/%d the next day\n",
+				       one.lights, all.lights, one.morning,
+				       all.morning);
+			}
+		}
+	}
+
+	printf("%u runs, %u differ\n", runs, fail);
+	return fail ? 1 : 0;
+}
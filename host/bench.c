@@ -0,0 +1,763 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <esp_event.h>
+#include <esp_http_server.h>
+
+#include "host.h"
+#include "event.h"
+#include "ctl.h"
+#include "dallas.h"
+#include "settings.h"
+#include "sched.h"
+#include "switch.h"
+#include "http.h"
+#include "metrics.h"
+#include "trace.h"
+#include "log.h"
+
+void app_main(void);
+
+static const char *TAG = "bench";
+
+/**
+ * Counters sampled around each benchmark
+ */
+struct sample {
+	uint64_t ns;
+	uint64_t ticks;
+	uint64_t gpio;
+	uint64_t xfers;
+};
+
+struct bench {
+	const char *name;
+	void (*fn)(void);
+	unsigned int ops;     /**< Operations per call of fn   */
+	void (*start)(void);  /**< Set up background load      */
+	void (*stop)(void);   /**< Tear down background load   */
+	void (*after)(void);  /**< Run after each call, untimed */
+};
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void sample(struct sample *s)
+{
+	s->ns    = now();
+	s->ticks = host_ticks();
+	s->gpio  = host_gpio_writes();
+	s->xfers = ds1302_xfers(&host_ds1302);
+}
+
+static void report(const char *name, unsigned long n, double p99,
+                   const struct sample *a, const struct sample *b)
+{
+	printf("%-24s %8lu %12.1f %12.1f %10.2f %10.1f %8.2f\n", name, n,
+	       (double)(b->ns - a->ns) / n, p99,
+	       (double)(b->ticks - a->ticks) / n,
+	       (double)(b->gpio - a->gpio) / n,
+	       (double)(b->xfers - a->xfers) / n);
+}
+
+static int cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void post(uint8_t id)
+{
+	ctl_send(id, 0);
+}
+
+static void head(const char *uri)
+{
+	struct host_http_resp resp;
+
+	host_http_request(HTTP_HEAD, uri, NULL, NULL, &resp);
+}
+
+/**
+ * control: One ON and one OFF request, dispatched
+ */
+static void ev_on_off(void)
+{
+	post(ON);
+	ctl_run();
+	post(OFF);
+	ctl_run();
+}
+
+/**
+ * Dashboards subscribed to the status, which get a frame per change
+ */
+static int subs[4];
+
+static void subs_open(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(subs) / sizeof(*subs); i++)
+		subs[i] = host_ws_open("/ws");
+}
+
+static void subs_close(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(subs) / sizeof(*subs); i++)
+		host_ws_close(subs[i]);
+}
+
+/**
+ * control: A burst of UI toggles, and the write-back that follows
+ */
+static void ev_toggle_flush(void)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		ev_on_off();
+
+	host_clock_advance(CONFIG_LIGHTCTL_SETTINGS_FLUSH_MS * 1000);
+	host_timer_run();
+	ctl_run();
+}
+
+/**
+ * control: Enabling the schedule persists it and runs schedule()
+ */
+static void ev_sched_on(void)
+{
+	post(SCHED_ON);
+	ctl_run();
+}
+
+/**
+ * Flip the override switch, with the contacts bouncing a few times,
+ * and let it settle
+ */
+static void flip(int pin, int level, unsigned int bounces)
+{
+	unsigned int i;
+
+	for (i = 0; i < 2 * bounces + 1; i++) {
+		host_gpio_input(pin, i & 1 ? !level : level);
+		ctl_run();
+		host_clock_advance(1000);
+	}
+
+	host_clock_advance(CONFIG_LIGHTCTL_SWITCH_DEBOUNCE_MS * 1000);
+	host_timer_run();
+	ctl_run();
+}
+
+/**
+ * control: The override switch being flipped on and back to auto
+ */
+static void ev_switch(void)
+{
+	flip(CONFIG_GPIO_SWON, 1, 0);
+	flip(CONFIG_GPIO_SWON, 0, 0);
+}
+
+static void ev_switch_bounce(void)
+{
+	flip(CONFIG_GPIO_SWON, 1, 4);
+	flip(CONFIG_GPIO_SWON, 0, 4);
+}
+
+/**
+ * schedule() as run by the schedule timer
+ */
+static void sched(void)
+{
+	host_timer_fire("schedule_timer");
+	ctl_run();
+}
+
+static void http_status(void)
+{
+	head("/status");
+}
+
+/**
+ * /status from a client which already has the current version
+ */
+static void http_status_304(void)
+{
+	static char hdrs[64];
+	struct host_http_resp resp;
+	const char *etag;
+
+	if (!hdrs[0]) {
+		host_http_request(HTTP_HEAD, "/status", NULL, NULL, &resp);
+		if ((etag = strstr(resp.hdrs, "ETag: "))) {
+			snprintf(hdrs, sizeof(hdrs), "If-None-Match: %.*s\r\n",
+			         (int)strcspn(etag + 6, "\r"), etag + 6);
+		}
+	}
+
+	host_http_request(HTTP_HEAD, "/status", hdrs, NULL, &resp);
+}
+
+/**
+ * The link going down and coming back, and the first request after
+ */
+static void http_flap(void)
+{
+	post(LOSTCONN);
+	post(CONNECTED);
+	ctl_run();
+	head("/status");
+}
+
+static void http_metrics(void)
+{
+	struct host_http_resp resp;
+
+	host_http_request(HTTP_GET, "/metrics", NULL, NULL, &resp);
+}
+
+/**
+ * Recording a latency, as done at each of the points /metrics covers
+ */
+static void observe(void)
+{
+	metrics_since(M_LOCK, 0);
+}
+
+static void http_trace(void)
+{
+	struct host_http_resp resp;
+
+	host_http_request(HTTP_GET, "/trace", NULL, NULL, &resp);
+}
+
+/**
+ * Recording a trace event, as done at each of the points traced
+ */
+static void record(void)
+{
+	trace(TR_POST, ON);
+}
+
+/**
+ * Logging: The esp-idf macros format the message on the spot, as the
+ * log.h ones used to, where these only queue it for the log task.
+ * Messages go to /dev/null, rather than being dropped by level.
+ */
+static int saved_stderr = -1;
+
+static void sink_open(void)
+{
+	int fd = open("/dev/null", O_WRONLY);
+
+	fflush(stderr);
+	saved_stderr = dup(2);
+	dup2(fd, 2);
+	close(fd);
+	esp_log_level_set("*", ESP_LOG_INFO);
+}
+
+static void sink_close(void)
+{
+	const char *s = getenv("LIGHTCTL_LOG");
+
+	log_flush();
+	fflush(stderr);
+	dup2(saved_stderr, 2);
+	close(saved_stderr);
+	esp_log_level_set("*", s ? (esp_log_level_t)atoi(s) : ESP_LOG_NONE);
+}
+
+static void esp_logi(void)
+{
+	ESP_LOGI(TAG, "settled after %u edges, %u us", 5U, 31234U);
+}
+
+static void log_info(void)
+{
+	info("settled after %u edges, %u us", 5U, 31234U);
+}
+
+static void log_debug(void)
+{
+	debug("settled after %u edges, %u us", 5U, 31234U);
+}
+
+static void log_info_flush(void)
+{
+	log_info();
+	log_flush();
+}
+
+static void log_drain(void)
+{
+	log_flush();
+}
+
+/**
+ * The UI, as loaded by a browser
+ */
+static void http_index(void)
+{
+	struct host_http_resp resp;
+
+	host_http_request(HTTP_GET, "/", NULL, NULL, &resp);
+	host_http_request(HTTP_GET, "/index.js", NULL, NULL, &resp);
+}
+
+/**
+ * The UI, reloaded by a browser which has it cached
+ */
+static void http_index_304(void)
+{
+	static char hdrs[2][64];
+	static const char *uri[2] = { "/", "/index.js" };
+	struct host_http_resp resp;
+	const char *etag;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (!hdrs[i][0]) {
+			host_http_request(HTTP_GET, uri[i], NULL, NULL, &resp);
+			if ((etag = strstr(resp.hdrs, "ETag: "))) {
+				snprintf(hdrs[i], sizeof(hdrs[i]),
+				         "If-None-Match: %.*s\r\n",
+				         (int)strcspn(etag + 6, "\r"), etag + 6);
+			}
+		}
+
+		host_http_request(HTTP_GET, uri[i], hdrs[i], NULL, &resp);
+	}
+}
+
+/**
+ * /on and /off, which wait for the control task to switch the lights
+ */
+static void http_on_off(void)
+{
+	head("/on");
+	head("/off");
+}
+
+/**
+ * Setting a schedule and switching the lights, then undoing that, as
+ * separate requests and as two batches
+ */
+static void http_sequence(void)
+{
+	head("/schedule/on?on=18:00&off=06:00");
+	head("/on");
+	head("/schedule/off");
+	head("/off");
+}
+
+static void http_batch(void)
+{
+	struct host_http_resp resp;
+
+	host_http_request(HTTP_POST, "/batch", NULL,
+	                  "/schedule/on?on=18:00&off=06:00\n/on\n", &resp);
+	host_http_request(HTTP_POST, "/batch", NULL,
+	                  "/schedule/off\n/off\n", &resp);
+}
+
+/**
+ * Run the control task on a thread of its own, for the benchmarks
+ * which wait on it
+ */
+static pthread_t ctl_thread;
+static atomic_int ctl_running;
+
+static void *ctl_loop(void *arg)
+{
+	(void)arg;
+	while (atomic_load(&ctl_running))
+		ctl_wait(pdMS_TO_TICKS(10));
+	return NULL;
+}
+
+static void loop_start(void)
+{
+	atomic_store(&ctl_running, 1);
+	pthread_create(&ctl_thread, NULL, ctl_loop, NULL);
+}
+
+static void loop_stop(void)
+{
+	atomic_store(&ctl_running, 0);
+	pthread_join(ctl_thread, NULL);
+}
+
+/**
+ * Dispatch through an esp_event loop, as the commands used to be, and
+ * through the control queue. Either way, the command is DEBOUNCE with
+ * the debounce timer already armed, so the handler does next to nothing,
+ * and the posts carry a sequence number, as /on's did. Without a thread,
+ * that's the cost of queueing and dispatching; With one, it's the time
+ * it takes to get a command to the thread which runs it.
+ */
+ESP_EVENT_DEFINE_BASE(BENCH_EVENT);
+static esp_event_loop_handle_t ev_loop;
+static atomic_uint ev_done;
+
+static void ev_debounce(void *arg, esp_event_base_t base, int32_t id,
+                        void *data)
+{
+	(void)arg; (void)base; (void)id; (void)data;
+	switch_debounce();
+	http_notify();
+	atomic_fetch_add(&ev_done, 1);
+}
+
+static void ev_start(void)
+{
+	esp_event_loop_args_t args = { .queue_size = 32 };
+
+	if (!ev_loop) {
+		esp_event_loop_create(&args, &ev_loop);
+		esp_event_handler_register_with(ev_loop, BENCH_EVENT,
+		                                DEBOUNCE, ev_debounce, NULL);
+	}
+
+	switch_debounce();
+}
+
+static void ev_task_start(void)
+{
+	ev_start();
+	host_event_start(ev_loop);
+}
+
+static void ev_task_stop(void)
+{
+	host_event_stop(ev_loop);
+}
+
+static void ctl_task_start(void)
+{
+	switch_debounce();
+	loop_start();
+}
+
+static void ev_post(void)
+{
+	uint32_t seq = 1;
+
+	esp_event_post_to(ev_loop, BENCH_EVENT, DEBOUNCE, &seq,
+	                  sizeof(seq), 0);
+}
+
+static void ctl_post_debounce(void)
+{
+	struct ctl_cmd c = { .id = DEBOUNCE };
+
+	ctl_post(&c, 0);
+}
+
+static void dispatch_ev(void)
+{
+	ev_post();
+	host_event_drain(ev_loop);
+}
+
+static void dispatch_ctl(void)
+{
+	ctl_post_debounce();
+	ctl_run();
+}
+
+static void dispatch_ev_task(void)
+{
+	unsigned int n = atomic_load(&ev_done);
+
+	ev_post();
+	while (atomic_load(&ev_done) == n);
+}
+
+static void dispatch_ctl_task(void)
+{
+	struct ctl_stats cs;
+	uint32_t n;
+
+	ctl_stats(&cs);
+	n = cs.run[DEBOUNCE];
+	ctl_post_debounce();
+	do ctl_stats(&cs); while (cs.run[DEBOUNCE] == n);
+}
+
+/**
+ * A burst of clicks on the toggle: Eight commands, queued before the
+ * control task gets to them, which are merged into one. The first has a
+ * completion, as /on's would, which the last OFF, without one, carries
+ * (see ctl.h); ctl_sim checks /on gets it.
+ */
+static void dispatch_merge(void)
+{
+	struct ctl_cmd c = { .id = ON, .seq = UINT32_MAX };
+	unsigned int i;
+
+	ctl_post(&c, 0);
+	for (i = 1; i < 8; i++)
+		post(i & 1 ? OFF : ON);
+	ctl_run();
+}
+
+/**
+ * The schedule lookups done when planning, spread over the week
+ */
+static void sched_lookup(void)
+{
+	static time_t t;
+	int on;
+
+	t = (t + 7919) % (7 * 86400);
+	sched_state(1717243200 + t);
+	sched_next(1717243200 + t, &on);
+}
+
+/**
+ * Fill the schedule up with rules: A window for each weekday, and a
+ * few exceptions.
+ */
+static void rules_start(void)
+{
+	struct sched_rule r = { 0 };
+	unsigned int i;
+
+	for (i = 0; i < SCHED_MAX_RULES; i++) {
+		r.date  = i < SCHED_MAX_DATES ? 19876 + i * 3 : 0;
+		r.days  = 1 << (i % 7);
+		r.start = (i * 97) % 1440;
+		r.end   = (i * 97 + 45) % 1440;
+		sched_add(&r);
+	}
+
+	post(SCHED_RULES);
+	ctl_run();
+}
+
+static void rules_stop(void)
+{
+	while (!sched_del(0));
+	post(SCHED_RULES);
+	ctl_run();
+}
+
+/**
+ * Fetching the clock and settings from the DS1302 at boot
+ */
+static void dallas_boot(void)
+{
+	dallas_init();
+}
+
+static void dallas_clock(void)
+{
+	dallas_set_system_clock();
+}
+
+/**
+ * The same, bit-banged: Once the SPI bus fails, it stays that way
+ */
+static void spi_fail(void)
+{
+	host_spi_fail(1);
+}
+
+/**
+ * Keep a writer busy in the background, which blocks while holding the
+ * lock the way the dallas writes under it used to.
+ */
+static pthread_t writer;
+static atomic_int writing;
+
+static void *write_loop(void *arg)
+{
+	struct timespec hold = { 0, 200000 }, gap = { 0, 50000 };
+	(void)arg;
+
+	while (atomic_load(&writing)) {
+		settings_lock();
+		settings.shr = (settings.shr + 1) % 24;
+		nanosleep(&hold, NULL);
+		settings_unlock();
+		nanosleep(&gap, NULL);
+	}
+
+	return NULL;
+}
+
+static void writer_start(void)
+{
+	atomic_store(&writing, 1);
+	pthread_create(&writer, NULL, write_loop, NULL);
+}
+
+static void writer_stop(void)
+{
+	atomic_store(&writing, 0);
+	pthread_join(writer, NULL);
+}
+
+static const struct bench benches[] = {
+	{ "dallas_init",             dallas_boot,      1 },
+	{ "dallas_set_system_clock", dallas_clock,     1 },
+	{ "dallas_clock/bit-bang",   dallas_clock,     1, spi_fail },
+	{ "control/on-off",          ev_on_off,        2 },
+	{ "control/on-off+push",     ev_on_off,        2,
+	  subs_open, subs_close },
+	{ "control/toggle+flush",    ev_toggle_flush,  8 },
+	{ "control/sched_on",        ev_sched_on,      1 },
+	{ "control/switch",          ev_switch,        2 },
+	{ "control/switch+bounce",   ev_switch_bounce, 2 },
+	{ "dispatch/esp_event",      dispatch_ev,      1,
+	  ev_start },
+	{ "dispatch/ctl",            dispatch_ctl,     1,
+	  switch_debounce },
+	{ "dispatch/esp_event+task", dispatch_ev_task, 1,
+	  ev_task_start, ev_task_stop },
+	{ "dispatch/ctl+task",       dispatch_ctl_task, 1,
+	  ctl_task_start, loop_stop },
+	{ "dispatch/ctl 8x merged",  dispatch_merge,   8 },
+	{ "schedule",                sched,            1 },
+	{ "sched_lookup",            sched_lookup,     2 },
+	{ "sched_lookup/16 rules",   sched_lookup,     2,
+	  rules_start, rules_stop },
+	{ "http/status",             http_status,      1 },
+	{ "http/status-304",         http_status_304,  1 },
+	{ "http/status+writer",      http_status,      1,
+	  writer_start, writer_stop },
+	{ "http/on-off",             http_on_off,      2,
+	  loop_start, loop_stop },
+	{ "http/sequence",           http_sequence,    2,
+	  loop_start, loop_stop },
+	{ "http/batch",              http_batch,       2,
+	  loop_start, loop_stop },
+	{ "http/flap",               http_flap,        1 },
+	{ "http/metrics",            http_metrics,     1 },
+	{ "metrics_observe",         observe,          1 },
+	{ "http/trace",              http_trace,       1 },
+	{ "trace",                   record,           1 },
+	{ "log/ESP_LOGI",            esp_logi,         1,
+	  sink_open, sink_close },
+	{ "log/info",                log_info,         1,
+	  sink_open, sink_close, log_drain },
+	{ "log/info+flush",          log_info_flush,   1,
+	  sink_open, sink_close },
+	{ "log/debug",               log_debug,        1 },
+	{ "http/index",              http_index,       2 },
+	{ "http/index-304",          http_index_304,   2 },
+};
+
+/**
+ * Boot with a valid clock and settings in the DS1302
+ */
+static void boot(void)
+{
+	struct sample a, b;
+
+	ds1302_reset(&host_ds1302);
+	ds1302_set_time(&host_ds1302, 1717243200); /* 2024-06-01 12:00 */
+	ds1302_set_ram(&host_ds1302, (SETTINGS_SHR - 0xc0) >> 1, 18);
+	ds1302_set_ram(&host_ds1302, (SETTINGS_EHR - 0xc0) >> 1, 6);
+	ds1302_set_ram(&host_ds1302, (SETTINGS_V - 0xc0) >> 1,
+	               SETTINGS_VALID);
+
+	sample(&a);
+	app_main();
+	ctl_run();
+	sample(&b);
+	report("boot", 1, (double)(b.ns - a.ns), &a, &b);
+	log_flush();
+
+	/* Bring up the http server */
+	post(CONNECTED);
+	ctl_run();
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long i, n = 10000;
+	const char *filter = NULL;
+	struct ctl_stats cs;
+	struct sample a, b;
+	uint64_t *t, t0, skip;
+	size_t j;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n': n = strtoul(optarg, NULL, 10); break;
+		default:
+			fprintf(stderr, "usage: %s [-n iterations] [filter]\n",
+			        argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind < argc) filter = argv[optind];
+	if (!n) n = 1;
+	if (!(t = calloc(n, sizeof(*t))))
+		return 1;
+
+	printf("%-24s %8s %12s %12s %10s %10s %8s\n", "benchmark", "ops",
+	       "ns/op", "p99 ns/op", "ticks/op", "gpio/op", "xfer/op");
+	boot();
+
+	for (j = 0; j < sizeof(benches) / sizeof(*benches); j++) {
+		if (filter && !strstr(benches[j].name, filter))
+			continue;
+
+		if (benches[j].start)
+			benches[j].start();
+
+		sample(&a);
+		for (i = 0, skip = 0; i < n; i++) {
+			t0 = now();
+			benches[j].fn();
+			t[i] = now() - t0;
+
+			if (benches[j].after) {
+				t0 = now();
+				benches[j].after();
+				skip += now() - t0;
+			}
+		}
+		sample(&b);
+		b.ns -= skip;
+
+		if (benches[j].stop)
+			benches[j].stop();
+		log_flush();
+
+		qsort(t, n, sizeof(*t), cmp);
+		report(benches[j].name, n * benches[j].ops,
+		       (double)t[n * 99 / 100] / benches[j].ops, &a, &b);
+	}
+
+	ctl_stats(&cs);
+	printf("\nctl: %u posted, %u merged, %u full, high-water mark %u/%u\n",
+	       (unsigned int)cs.posted, (unsigned int)cs.merged,
+	       (unsigned int)cs.full, (unsigned int)cs.hwm, CTL_QUEUE_LEN);
+
+	free(t);
+	return 0;
+}
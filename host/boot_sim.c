@@ -0,0 +1,171 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <esp_http_server.h>
+
+#include "host.h"
+#include "event.h"
+#include "ctl.h"
+#include "trace.h"
+#include "boot.h"
+
+/**
+ * Boot pipeline test
+ *
+ * Boots, then checks the boot report: Every phase has to have run, and
+ * started no sooner than the phases it needs were done. The lights are
+ * set once the control queue has been run, and the server is ready once
+ * the station has connected; Neither is before. Then checks that GET
+ * /boot has the same report, and that the trace has the phases.
+ *
+ * Tasks don't run on the host, so app_main() runs every phase itself.
+ */
+
+void app_main(void);
+
+static const char *const names[BOOT_STEPS] = {
+	"nvs", "gpio", "wifi", "rtc", "dim", "sched", "ctl", "mdns",
+	"lights", "ip", "http"
+};
+
+static struct {
+	long long start, end;
+	int seen;
+} at[BOOT_STEPS];
+
+static unsigned int fail;
+
+/**
+ * Read the report back: seen is 3 for a phase that's done, 2 for a
+ * milestone that was reached, and 1 otherwise.
+ */
+static void parse(const char *buf)
+{
+	const char *p = strchr(buf, '\n');
+	char name[16], core[8];
+	long long start, end;
+	unsigned int i;
+	int n;
+
+	memset(at, 0, sizeof(at));
+	for (; p && *++p; p = strchr(p, '\n')) {
+		n = sscanf(p, "%15s %7s %lld %lld", name, core, &start, &end);
+		for (i = 0; n >= 2 && i < BOOT_STEPS; i++) {
+			if (!strcmp(name, names[i]))
+				break;
+		}
+
+		if (n < 2 || i == BOOT_STEPS) {
+			printf("bad line: %.*s\n", (int)strcspn(p, "\n"), p);
+			fail++;
+			continue;
+		}
+
+		at[i].seen  = n - 1;
+		at[i].start = n > 2 ? start : 0;
+		at[i].end   = n > 3 ? end : 0;
+	}
+}
+
+static void after(unsigned int p, unsigned int dep)
+{
+	if (at[p].start < at[dep].end) {
+		printf("%s started at %lld, before %s was done at %lld\n",
+		       names[p], at[p].start, names[dep], at[dep].end);
+		fail++;
+	}
+}
+
+static void reached(unsigned int step, int yes)
+{
+	if ((at[step].seen == 2) != yes) {
+		printf("%s %sreached\n", names[step], yes ? "not " : "");
+		fail++;
+	}
+}
+
+int main(void)
+{
+	static char buf[1024];
+	struct host_http_resp resp;
+	struct trace_rec recs[CONFIG_LIGHTCTL_TRACE_LEN];
+	unsigned int i, n, begun = 0, ended = 0;
+	uint32_t lost;
+
+	ds1302_reset(&host_ds1302);
+	app_main();
+
+	n = boot_format(buf, sizeof(buf));
+	printf("%s", buf);
+	if (!n) {
+		printf("report didn't fit\n");
+		fail++;
+	}
+
+	parse(buf);
+	for (i = 0; i < BOOT_PHASES; i++) {
+		if (at[i].seen != 3 || at[i].end < at[i].start) {
+			printf("%s: not run\n", names[i]);
+			fail++;
+		}
+	}
+
+	after(BOOT_WIFI, BOOT_NVS);
+	after(BOOT_WIFI, BOOT_GPIO);
+	after(BOOT_RTC, BOOT_GPIO);
+	after(BOOT_DIM, BOOT_NVS);
+	after(BOOT_DIM, BOOT_GPIO);
+	after(BOOT_SCHED, BOOT_NVS);
+	after(BOOT_CTL, BOOT_RTC);
+	after(BOOT_CTL, BOOT_DIM);
+	after(BOOT_CTL, BOOT_SCHED);
+	after(BOOT_MDNS, BOOT_WIFI);
+	reached(BOOT_LIGHTS, 0);
+	reached(BOOT_HTTP, 0);
+
+	/* The lights are set by the control task */
+	ctl_run();
+	boot_format(buf, sizeof(buf));
+	parse(buf);
+	reached(BOOT_LIGHTS, 1);
+	reached(BOOT_HTTP, 0);
+	if (at[BOOT_LIGHTS].start < at[BOOT_CTL].end) {
+		printf("lights set before the control task started\n");
+		fail++;
+	}
+
+	ctl_send(CONNECTED, 0);
+	ctl_run();
+	host_http_request(HTTP_GET, "/boot", NULL, NULL, &resp);
+	if (resp.status != 200) {
+		printf("GET /boot: %d\n", resp.status);
+		fail++;
+	}
+
+	resp.body[resp.len < sizeof(resp.body) ? resp.len :
+	          sizeof(resp.body) - 1] = '\0';
+	printf("%s", resp.body);
+	parse(resp.body);
+	reached(BOOT_LIGHTS, 1);
+	reached(BOOT_HTTP, 1);
+
+	/* Each phase is a slice in the trace */
+	n = trace_read(0, recs, &lost);
+	for (i = 0; i < n; i++) {
+		if (recs[i].type == TR_BOOT && recs[i].arg < BOOT_PHASES)
+			begun |= BOOT_DEP(recs[i].arg);
+		else if (recs[i].type == TR_BOOT_END &&
+		         begun & BOOT_DEP(recs[i].arg))
+			ended |= BOOT_DEP(recs[i].arg);
+	}
+
+	if (ended != BOOT_DEP(BOOT_PHASES) - 1) {
+		printf("trace: phases %#x begun, %#x ended\n", begun, ended);
+		fail++;
+	}
+
+	printf("%u failures\n", fail);
+	return fail ? 1 : 0;
+}
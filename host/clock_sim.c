@@ -0,0 +1,169 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <esp_timer.h>
+#include <esp_sntp.h>
+
+#include "host.h"
+#include "event.h"
+#include "ctl.h"
+#include "clock.h"
+
+/**
+ * Clock discipline test
+ *
+ * Runs for a few weeks with the ESP32 40 ppm fast, and the DS1302 10 ppm
+ * slow, both against true time, which SNTP hands out whenever it's
+ * polled. The DS1302 starts 3 s off, so the first reply has to step the
+ * clock; From then on, it has to be slewed, and kept within the error
+ * it's set to keep to, once the drift's been measured. The drift has to
+ * come out right, SNTP has to end up polled as seldom as it's let be,
+ * and the DS1302 has to be kept within a second past its bound, with no
+ * more writes than that takes.
+ */
+
+#define T0      1717243200 /* 2024-06-01 12:00:00 */
+#define SECONDS 1000000LL
+#define DAYS    21
+
+#define ESP_PPB  40000
+#define RTC_PPB -10000
+
+#define ERR  ((int64_t)CONFIG_LIGHTCTL_CLOCK_ERR_MS * 1000)
+
+void app_main(void);
+
+static int64_t h0;
+static unsigned int fail;
+
+/**
+ * True time, in us, with the host clock as the ESP32's
+ */
+static int64_t truth(void)
+{
+	int64_t h = host_clock() - h0;
+
+	return T0 * SECONDS + h - h / 1000 * ESP_PPB / 1000000;
+}
+
+static int64_t wall(void)
+{
+	struct timeval tv;
+
+	host_gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * SECONDS + tv.tv_usec;
+}
+
+static void poll(void)
+{
+	int64_t t = truth();
+	struct timeval tv = {
+		.tv_sec  = (time_t)(t / SECONDS),
+		.tv_usec = (suseconds_t)(t % SECONDS)
+	};
+
+	host_sntp_sync(&tv);
+	ctl_run();
+}
+
+int main(void)
+{
+	int64_t next, poll_at, err, worst = 0;
+	time_t rtc, rtc_worst = 0;
+	struct clock_stats cs;
+	int converged = 0;
+
+	h0 = host_clock();
+	ds1302_reset(&host_ds1302);
+	ds1302_set_time(&host_ds1302, T0 - 3);
+
+	/* As the host sees it, the DS1302's slow by both, near enough */
+	ds1302_set_drift(&host_ds1302, RTC_PPB - ESP_PPB);
+	app_main();
+	ctl_run();
+	ctl_send(CONNECTED, 0);
+	ctl_run();
+
+	poll();
+	poll_at = host_clock() + (int64_t)sntp_get_sync_interval() * 1000;
+	while (truth() < (T0 + DAYS * 86400LL) * SECONDS) {
+		next = esp_timer_get_next_alarm();
+		if (next > poll_at)
+			next = poll_at;
+		if (next > host_clock())
+			host_clock_advance(next - host_clock());
+
+		/* Worst just before a slew, or a reply */
+		err = llabs(wall() - truth());
+		if (converged && err > worst)
+			worst = err;
+
+		/* In whole seconds, as it has them */
+		rtc = ds1302_get_time(&host_ds1302) -
+		      (time_t)(truth() / SECONDS);
+		if (rtc < 0) rtc = -rtc;
+		if (rtc > rtc_worst)
+			rtc_worst = rtc;
+
+		host_timer_run();
+		ctl_run();
+		if (host_clock() >= poll_at) {
+			poll();
+			poll_at = host_clock() +
+			          (int64_t)sntp_get_sync_interval() * 1000;
+
+			clock_stats(&cs);
+			converged = cs.samples > 2;
+		}
+	}
+
+	clock_stats(&cs);
+	printf("esp32 drift:   %d ppb (really %d)\n", (int)cs.esp_ppb,
+	       ESP_PPB);
+	printf("ds1302 drift:  %d ppb (really %d)\n", (int)cs.rtc_ppb,
+	       RTC_PPB);
+	printf("worst error:   %lld us (keeping to %lld)\n",
+	       (long long)worst, (long long)ERR);
+	printf("ds1302 error:  %ld s, %u writes\n", (long)rtc_worst,
+	       (unsigned int)cs.rtc_writes);
+	printf("%u replies in %u days (hourly polling: %u), polling every "
+	       "%u s\n", (unsigned int)cs.samples, DAYS, DAYS * 24,
+	       (unsigned int)cs.poll_s);
+	printf("%u steps, %u slews\n", (unsigned int)cs.steps,
+	       (unsigned int)cs.slews);
+
+	if (abs(cs.esp_ppb - ESP_PPB) > 2000) {
+		printf("esp32 drift off\n");
+		fail++;
+	}
+
+	if (worst > ERR) {
+		printf("clock wasn't kept within %lld us\n", (long long)ERR);
+		fail++;
+	}
+
+	if (cs.steps != 1) {
+		printf("%u steps, should be 1\n", (unsigned int)cs.steps);
+		fail++;
+	}
+
+	if (cs.poll_s != CONFIG_LIGHTCTL_CLOCK_POLL_MAX * 60U ||
+	    cs.samples > DAYS * 24 / 4) {
+		printf("polling didn't back off\n");
+		fail++;
+	}
+
+	if (rtc_worst > CONFIG_LIGHTCTL_CLOCK_RTC_ERR_S + 1 ||
+	    cs.rtc_writes > DAYS * 86400LL * -RTC_PPB / 1000000000LL /
+	    CONFIG_LIGHTCTL_CLOCK_RTC_ERR_S + 2) {
+		printf("ds1302 wasn't kept in bounds\n");
+		fail++;
+	}
+
+	printf("%u failures\n", fail);
+	return fail ? 1 : 0;
+}
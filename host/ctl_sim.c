@@ -0,0 +1,80 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <driver/gpio.h>
+#include <esp_http_server.h>
+
+#include "host.h"
+#include "event.h"
+#include "ctl.h"
+
+/**
+ * Control queue merge test
+ *
+ * /on is asked for, and before the control task gets to it, an OFF
+ * without a completion (as from the schedule) is queued behind it. The
+ * two are merged into the OFF, which has to complete /on, rather than
+ * leave it to time out; And /on has to reply with the lights off.
+ */
+
+void app_main(void);
+
+static struct host_http_resp resp;
+
+static void *request(void *arg)
+{
+	host_http_request(HTTP_HEAD, (const char *)arg, NULL, NULL, &resp);
+	return NULL;
+}
+
+int main(void)
+{
+	struct timespec poll = { .tv_nsec = 100000 };
+	struct ctl_stats before, cs;
+	unsigned int fail = 0;
+	pthread_t t;
+	size_t len;
+
+	ds1302_reset(&host_ds1302);
+	app_main();
+	ctl_run();
+	ctl_send(CONNECTED, 0);
+	ctl_run();
+
+	ctl_stats(&before);
+	pthread_create(&t, NULL, request, "/on");
+	do {
+		nanosleep(&poll, NULL);
+		ctl_stats(&cs);
+	} while (cs.posted == before.posted);
+
+	ctl_send(OFF, 0);
+	ctl_run();
+	pthread_join(t, NULL);
+	ctl_stats(&cs);
+
+	printf("/on: %d %s\n", resp.status, resp.status_str);
+	if (cs.merged != before.merged + 1 ||
+	    cs.run[OFF] != before.run[OFF] + 1 || cs.run[ON] != before.run[ON]) {
+		printf("ON and OFF weren't merged into OFF\n");
+		fail++;
+	}
+
+	len = strlen(resp.status_str);
+	if (resp.status != 299 || len < 4 ||
+	    strcmp(resp.status_str + len - 4, "/off")) {
+		printf("/on wasn't completed by the OFF\n");
+		fail++;
+	}
+
+	if (gpio_get_level(CONFIG_GPIO_LIGHTS)) {
+		printf("lights on\n");
+		fail++;
+	}
+
+	printf("%u failures\n", fail);
+	return fail ? 1 : 0;
+}
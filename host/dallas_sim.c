@@ -0,0 +1,348 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "host.h"
+#include "settings.h"
+#include "dallas.h"
+
+/**
+ * DS1302 driver test
+ *
+ * Runs the same operations against the DS1302 model over SPI, and then
+ * bit-banged, once the bus has been made to fail: Reading the clock,
+ * writing back the settings, syncing the clock and single byte reads
+ * and writes. Each has to leave the model as it should, with the write
+ * protect bit set again after writing, and without the model finding
+ * anything wrong with the bus. Then the time each operation takes is
+ * compared, along with how long CE was high for; SPI has to be quicker,
+ * and not touch the pins by way of the GPIO driver.
+ *
+ * Last, the model's checks are checked, by driving it by hand with
+ * each of the mistakes it should catch.
+ */
+
+#define T0 1717243200 /* 2024-06-01 12:00:00 */
+#define T1 1735732800 /* 2025-01-01 12:00:00 */
+
+enum { CLOCK, SETTINGS, SYNC, BYTE, OPS };
+
+static const char *const ops[OPS] = {
+	"read clock", "write settings", "sync clock", "byte read/write"
+};
+
+static struct {
+	int64_t us;         /**< Time spent         */
+	uint64_t bus;       /**< CE high, in ns     */
+	uint64_t gpio;      /**< GPIO writes        */
+	uint64_t xfers;     /**< CE pulses          */
+} cost[2][OPS];
+
+static uint64_t busy;
+
+static unsigned int fail;
+
+static void check(const char *bus, const char *what, int ok)
+{
+	if (!ok) {
+		printf("%s: %s\n", bus, what);
+		fail++;
+	}
+}
+
+static void violations(const char *bus)
+{
+	unsigned int i, n;
+
+	for (i = 0; i < DS1302_CHECKS; i++) {
+		if ((n = ds1302_violations(&host_ds1302, i))) {
+			printf("%s: %u %s violations\n", bus, n,
+			       ds1302_check(i));
+			fail++;
+		}
+	}
+}
+
+/**
+ * Driving the model by hand, half a clock at a time
+ */
+#define SDA CONFIG_DALLAS_GPIO_SDA
+#define SCL CONFIG_DALLAS_GPIO_SCL
+#define CE  CONFIG_DALLAS_GPIO_CE
+
+static void pin(int p, int l)
+{
+	ds1302_pin(&host_ds1302, p, l);
+}
+
+static void begin(int64_t setup)
+{
+	host_clock_advance(5);
+	ds1302_drive(&host_ds1302, 1);
+	pin(SDA, 0);
+	pin(SCL, 0);
+	pin(CE, 1);
+	host_clock_advance_ns(setup);
+}
+
+static void tx(uint8_t b, int64_t half)
+{
+	int i;
+
+	for (i = 0; i < 8; i++, b >>= 1) {
+		pin(SCL, 0);
+		pin(SDA, b & 1);
+		host_clock_advance_ns(half);
+		pin(SCL, 1);
+		host_clock_advance_ns(half);
+	}
+}
+
+static uint8_t rx(int64_t half)
+{
+	uint8_t b = 0;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		pin(SCL, 0);
+		host_clock_advance_ns(half);
+		b |= (uint8_t)(ds1302_sda(&host_ds1302) << i);
+		pin(SCL, 1);
+		host_clock_advance_ns(half);
+	}
+
+	return b;
+}
+
+static void finish(int64_t hold)
+{
+	host_clock_advance_ns(hold);
+	pin(SCL, 0);
+	pin(CE, 0);
+	host_clock_advance(1);
+	ds1302_drive(&host_ds1302, 1);
+}
+
+static void caught(const char *what, unsigned int kind, unsigned int n)
+{
+	if (ds1302_violations(&host_ds1302, kind) <= n) {
+		printf("model missed %s (%s)\n", what, ds1302_check(kind));
+		fail++;
+	}
+}
+
+static void mistakes(void)
+{
+	struct ds1302 *d = &host_ds1302;
+	unsigned int n[DS1302_CHECKS], i;
+	uint8_t clk[3] = { 0x12, 0x34, 0x56 };
+
+	ds1302_reset(d);
+	ds1302_set_time(d, T0);
+	for (i = 0; i < DS1302_CHECKS; i++)
+		n[i] = ds1302_violations(d, i);
+
+	/* Done right, nothing's wrong */
+	begin(4000);
+	tx(0x81, 1000);
+	ds1302_drive(d, 0);
+	check("model", "seconds misread", rx(1000) == 0x80);
+	finish(0);
+	if (ds1302_violations(d, DS1302_CHECKS)) {
+		violations("model");
+		return;
+	}
+
+	begin(1000);
+	tx(0x81, 1000);
+	ds1302_drive(d, 0);
+	rx(1000);
+	finish(0);
+	caught("a short CE setup", DS1302_TCC, n[DS1302_TCC]);
+
+	begin(4000);
+	tx(0x81, 100);
+	ds1302_drive(d, 0);
+	rx(1000);
+	finish(0);
+	caught("a fast clock", DS1302_TCL, n[DS1302_TCL]);
+	caught("a fast clock", DS1302_TCH, n[DS1302_TCH]);
+	caught("a fast clock", DS1302_TDC, n[DS1302_TDC]);
+	caught("a fast clock", DS1302_TCDH, n[DS1302_TCDH]);
+
+	begin(4000);
+	tx(0x81, 1000);
+	ds1302_drive(d, 0);
+	rx(100);
+	finish(0);
+	caught("an early read", DS1302_TCDD, n[DS1302_TCDD]);
+
+	begin(4000);
+	tx(0x81, 1000);
+	rx(1000);
+	ds1302_drive(d, 0);
+	finish(0);
+	caught("driving SDA through a read", DS1302_BUS, n[DS1302_BUS]);
+
+	begin(4000);
+	tx(0x81, 1000);
+	ds1302_drive(d, 0);
+	pin(SCL, 0);
+	pin(CE, 0);
+	ds1302_drive(d, 1);
+	host_clock_advance(1);
+	caught("driving SDA as CE falls", DS1302_BUS, n[DS1302_BUS] + 1);
+
+	host_clock_advance(5);
+	pin(SCL, 1);
+	pin(CE, 1);
+	caught("SCLK high as CE rises", DS1302_SCLK, n[DS1302_SCLK]);
+	finish(0);
+
+	begin(4000);
+	tx(0x8e, 1000);
+	tx(0x00, 1000);
+	pin(SCL, 0);
+	pin(CE, 0);
+	pin(CE, 1);
+	caught("a short CE low", DS1302_TCWH, n[DS1302_TCWH]);
+	host_clock_advance(4);
+	tx(0xc0, 1000);
+	pin(SCL, 0);
+	host_clock_advance(1);
+	pin(SCL, 1);
+	pin(CE, 0);
+	caught("a short CE hold", DS1302_TCCH, n[DS1302_TCCH]);
+	caught("CE falling mid-transfer", DS1302_CE, n[DS1302_CE]);
+	host_clock_advance(5);
+
+	/* WP's now clear, and the clock's left as it was */
+	begin(4000);
+	tx(0xbe, 1000);
+	for (i = 0; i < sizeof(clk); i++)
+		tx(clk[i], 1000);
+	finish(1000);
+	caught("a short clock burst", DS1302_BURST, n[DS1302_BURST]);
+	check("model", "short burst written", ds1302_get_time(d) == T0);
+
+	begin(4000);
+	tx(0x8e, 1000);
+	tx(0x80, 1000);
+	finish(1000);
+	begin(4000);
+	tx(0xc0, 1000);
+	tx(0xa5, 1000);
+	finish(1000);
+	caught("a write while protected", DS1302_WP, n[DS1302_WP]);
+	check("model", "protected write taken", ds1302_ram(d, 0) != 0xa5);
+}
+
+static void start(int64_t *t, uint64_t *g, uint64_t *x)
+{
+	*t = host_clock();
+	*g = host_gpio_writes();
+	*x = ds1302_xfers(&host_ds1302);
+	busy = ds1302_busy(&host_ds1302);
+}
+
+static void stop(int spi, unsigned int op, int64_t t, uint64_t g,
+                 uint64_t x)
+{
+	cost[spi][op].us    = host_clock() - t;
+	cost[spi][op].bus   = ds1302_busy(&host_ds1302) - busy;
+	cost[spi][op].gpio  = host_gpio_writes() - g;
+	cost[spi][op].xfers = ds1302_xfers(&host_ds1302) - x;
+}
+
+static void run(int spi)
+{
+	const char *bus = spi ? "spi" : "bit-bang";
+	struct timeval tv = { .tv_sec = T1 };
+	uint64_t g, x;
+	int64_t t;
+	uint8_t b;
+
+	ds1302_set_time(&host_ds1302, T0);
+	host_settimeofday(&(struct timeval){ 0 }, NULL);
+
+	start(&t, &g, &x);
+	dallas_set_system_clock();
+	stop(spi, CLOCK, t, g, x);
+	check(bus, "clock wasn't read", time(NULL) == T0);
+
+	settings_lock();
+	settings.shr = spi ? 19 : 20;
+	settings.emn = spi ? 15 : 45;
+	settings_dirty(DIRTY_SHR | DIRTY_EMN);
+	settings_unlock();
+	start(&t, &g, &x);
+	settings_flush();
+	stop(spi, SETTINGS, t, g, x);
+	check(bus, "settings weren't written",
+	      ds1302_ram(&host_ds1302, (SETTINGS_SHR - SETTINGS_SW) >> 1) ==
+	      settings.shr &&
+	      ds1302_ram(&host_ds1302, (SETTINGS_EMN - SETTINGS_SW) >> 1) ==
+	      settings.emn);
+
+	host_settimeofday(&tv, NULL);
+	start(&t, &g, &x);
+	dallas_sync(NULL);
+	stop(spi, SYNC, t, g, x);
+	check(bus, "clock wasn't synced", ds1302_get_time(&host_ds1302) == T1);
+
+	start(&t, &g, &x);
+	dallas_write(0xc0 + 2 * 30, 0xa5);
+	b = dallas_read(0xc1 + 2 * 30);
+	stop(spi, BYTE, t, g, x);
+	check(bus, "byte wasn't written", b == 0xa5 &&
+	      ds1302_ram(&host_ds1302, 30) == 0xa5);
+
+	/* Write protected, as it's left */
+	check(bus, "write protect isn't set", dallas_read(0x8f) == 0x80);
+	violations(bus);
+}
+
+int main(void)
+{
+	unsigned int i;
+	uint64_t bits;
+
+	ds1302_reset(&host_ds1302);
+	ds1302_set_time(&host_ds1302, T0);
+	settings_init();
+	dallas_init();
+
+	bits = host_spi_bits();
+	run(1);
+	check("spi", "bus not used", host_spi_bits() > bits);
+
+	host_spi_fail(1);
+	bits = host_spi_bits();
+	run(0);
+	check("bit-bang", "bus still used", host_spi_bits() == bits);
+
+	printf("%-16s %8s %8s %8s %8s %8s %6s\n", "operation", "spi us",
+	       "ce ns", "bb us", "ce ns", "bb gpio", "xfers");
+	for (i = 0; i < OPS; i++) {
+		printf("%-16s %8lld %8llu %8lld %8llu %8llu %6llu\n", ops[i],
+		       (long long)cost[1][i].us,
+		       (unsigned long long)cost[1][i].bus,
+		       (long long)cost[0][i].us,
+		       (unsigned long long)cost[0][i].bus,
+		       (unsigned long long)cost[0][i].gpio,
+		       (unsigned long long)cost[1][i].xfers);
+
+		check(ops[i], "spi no quicker",
+		      cost[1][i].us < cost[0][i].us);
+		check(ops[i], "spi touched the pins", !cost[1][i].gpio);
+		check(ops[i], "transfers differ",
+		      cost[1][i].xfers == cost[0][i].xfers);
+	}
+
+	mistakes();
+	printf("%u failures\n", fail);
+	return fail ? 1 : 0;
+}
@@ -0,0 +1,257 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <esp_timer.h>
+#include <esp_http_server.h>
+#include <driver/gpio.h>
+
+#include "host.h"
+#include "event.h"
+#include "ctl.h"
+#include "settings.h"
+#include "dim.h"
+
+/**
+ * Light channel test
+ *
+ * Boots with 8 channels, then fades some of them through /dim, and
+ * checks that they start together, are half way there half way through,
+ * and get there, with the others left alone, and no timer armed for it.
+ * Then sets a preset, and checks that ON brings each channel to its
+ * preset, and OFF all of them to 0. Last, some channels are faded
+ * again, and then all switched, half way through a fade: Neither may
+ * wait on the fade running, or leave the others' PWM held up.
+ */
+
+#define MS   1000
+#define FULL 1024 /* Duty at 255, with dim.c's 10 bits */
+
+void app_main(void);
+
+static const int pins[DIM_MAX] = {
+	CONFIG_GPIO_LIGHTS, 16, 18, 19, 23, 25, 26, 27
+};
+
+static unsigned int fail;
+
+/**
+ * Run the control task while a request waits on it
+ */
+static atomic_int running;
+
+static void *ctl_loop(void *arg)
+{
+	(void)arg;
+	while (atomic_load(&running))
+		ctl_wait(pdMS_TO_TICKS(10));
+	return NULL;
+}
+
+static int head(const char *uri)
+{
+	struct host_http_resp resp;
+	pthread_t t;
+
+	atomic_store(&running, 1);
+	pthread_create(&t, NULL, ctl_loop, NULL);
+	host_http_request(HTTP_HEAD, uri, NULL, NULL, &resp);
+	atomic_store(&running, 0);
+	pthread_join(t, NULL);
+	return resp.status;
+}
+
+static void expect(const char *what, unsigned int ch, uint32_t lo,
+                   uint32_t hi)
+{
+	uint32_t d = host_ledc_duty((int)ch);
+
+	if (d < lo || d > hi) {
+		printf("%s: channel %u at %u, should be %u - %u\n", what, ch,
+		       d, lo, hi);
+		fail++;
+	}
+}
+
+static void channels(const char *what, const uint8_t *level,
+                     const uint8_t *preset)
+{
+	struct host_http_resp resp;
+	unsigned int i, c, p, l, s, n = 0;
+	char *line;
+
+	host_http_request(HTTP_GET, "/channels", NULL, NULL, &resp);
+	resp.body[resp.len < sizeof(resp.body) ? resp.len :
+	          sizeof(resp.body) - 1] = '\0';
+	for (line = resp.body; *line; line = strchr(line, '\n') + 1, n++) {
+		if (sscanf(line, "%u %u %u %u", &c, &p, &l, &s) != 4 ||
+		    c != n || n >= DIM_MAX || p != (unsigned int)pins[n] ||
+		    l != level[n] || s != preset[n]) {
+			printf("%s: GET /channels: %.*s\n", what,
+			       (int)strcspn(line, "\n"), line);
+			fail++;
+		}
+
+		if (!strchr(line, '\n'))
+			break;
+	}
+
+	if (resp.status != 200 || n != DIM_MAX) {
+		printf("%s: GET /channels: %d, %u channels\n", what,
+		       resp.status, n);
+		fail++;
+	}
+
+	for (i = 0; i < DIM_MAX; i++)
+		expect(what, i, level[i] * FULL / 255, level[i] * FULL / 255);
+}
+
+int main(void)
+{
+	uint8_t level[DIM_MAX] = { 0 }, preset[DIM_MAX];
+	static const char *const bad[] = {
+		"/dim?ch=8&level=1", "/dim?level=256", "/dim?ch=&level=1",
+		"/dim?ch=1,&level=1", "/dim?ch=1", "/dim?level=1&fade=x"
+	};
+	int64_t next, t;
+	unsigned int i;
+
+	ds1302_reset(&host_ds1302);
+	app_main();
+	ctl_run();
+	ctl_send(CONNECTED, 0);
+	ctl_run();
+
+	memset(preset, 255, sizeof(preset));
+	channels("boot", level, preset);
+
+	/* 1, 3 and 5 to half, over a second */
+	next = esp_timer_get_next_alarm();
+	t    = host_clock();
+	if (head("/dim?ch=1,3,5&level=128&fade=1000") != 200) {
+		printf("HEAD /dim failed\n");
+		fail++;
+	}
+
+	for (i = 1; i < 6; i += 2) {
+		if (host_ledc_started((int)i) != t) {
+			printf("channel %u started at %lld, not %lld\n", i,
+			       (long long)host_ledc_started((int)i),
+			       (long long)t);
+			fail++;
+		}
+	}
+
+	if (esp_timer_get_next_alarm() != next) {
+		printf("a timer was armed for the fade\n");
+		fail++;
+	}
+
+	host_clock_advance(500 * MS);
+	for (i = 0; i < DIM_MAX; i++) {
+		if (i & 1 && i < 6)
+			expect("half way", i, 128 * FULL / 255 / 2 - 2,
+			       128 * FULL / 255 / 2 + 2);
+		else expect("half way", i, 0, 0);
+	}
+
+	host_clock_advance(600 * MS);
+	level[1] = level[3] = level[5] = 128;
+	channels("faded", level, preset);
+	if (!gpio_get_level(pins[1]) || gpio_get_level(pins[0])) {
+		printf("pins don't follow the channels\n");
+		fail++;
+	}
+
+	if (!settings.lights_status) {
+		printf("lights aren't on\n");
+		fail++;
+	}
+
+	/* Presets, then ON */
+	if (head("/dim?ch=2,6&preset=64") != 200) {
+		printf("HEAD /dim?preset failed\n");
+		fail++;
+	}
+
+	preset[2] = preset[6] = 64;
+	channels("preset", level, preset);
+
+	ctl_send(ON, 0);
+	ctl_run();
+	memcpy(level, preset, sizeof(level));
+	channels("on", level, preset);
+
+	ctl_send(OFF, 0);
+	ctl_run();
+	memset(level, 0, sizeof(level));
+	channels("off", level, preset);
+	if (gpio_get_level(CONFIG_GPIO_LIGHTS) || settings.lights_status) {
+		printf("lights aren't off\n");
+		fail++;
+	}
+
+	/* Every channel at once, still without a timer */
+	t = host_clock();
+	if (head("/dim?level=255&fade=2000") != 200) {
+		printf("HEAD /dim failed\n");
+		fail++;
+	}
+
+	for (i = 0; i < DIM_MAX; i++) {
+		if (host_ledc_started((int)i) != t) {
+			printf("channel %u didn't start with the others\n", i);
+			fail++;
+		}
+	}
+
+	if (esp_timer_get_next_alarm() != next) {
+		printf("a timer was armed for the fade\n");
+		fail++;
+	}
+
+	host_clock_advance(2000 * MS);
+	memset(level, 255, sizeof(level));
+	channels("all", level, preset);
+
+	/* Re-dimmed half way through: The fade's stopped, not waited on */
+	t = host_clock();
+	head("/dim?level=0&fade=2000");
+	host_clock_advance(1000 * MS);
+	if (head("/dim?ch=0,1&level=0&fade=1000") != 200 ||
+	    host_ledc_started(0) != t + 1000 * MS ||
+	    host_ledc_started(2) != t) {
+		printf("channels 0 and 1 weren't faded again\n");
+		fail++;
+	}
+
+	host_clock_advance(500 * MS);
+	for (i = 0; i < DIM_MAX; i++) {
+		if (i < 2) expect("faded again", i, FULL / 4 - 2, FULL / 4 + 2);
+		else expect("still fading", i, FULL / 4 - 2, FULL / 4 + 2);
+	}
+
+	ctl_send(OFF, 0);
+	ctl_run();
+	memset(level, 0, sizeof(level));
+	channels("off, mid-fade", level, preset);
+	if (host_clock() != t + 1500 * MS || host_ledc_blocked()) {
+		printf("waited on a fade: %llu times, for %lld us\n",
+		       (unsigned long long)host_ledc_blocked(),
+		       (long long)(host_clock() - t - 1500 * MS));
+		fail++;
+	}
+
+	for (i = 0; i < sizeof(bad) / sizeof(*bad); i++) {
+		if (head(bad[i]) != 400) {
+			printf("HEAD %s wasn't refused\n", bad[i]);
+			fail++;
+		}
+	}
+
+	printf("%u failures\n", fail);
+	return fail ? 1 : 0;
+}
@@ -0,0 +1,392 @@
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "host.h"
+
+#define bcd2i(B) (((((B) & 0xf0) >> 4) * 10) + ((B) & 0x0f))
+#define i2bcd(I) ((((I) / 10) << 4) + ((I) % 10))
+
+#define WP  0x80 /**< Write-protect bit in the control register */
+#define CH  0x80 /**< Clock halt bit in the seconds register    */
+
+/**
+ * Timing from the datasheet, at 2 V, which is the slowest, in ns
+ */
+#define TDC  200  /**< Data to SCLK setup     */
+#define TCDH 280  /**< SCLK to data hold      */
+#define TCDD 800  /**< SCLK to data delay     */
+#define TCL  1000 /**< SCLK low time          */
+#define TCH  1000 /**< SCLK high time         */
+#define TCC  4000 /**< CE to SCLK setup       */
+#define TCCH 240  /**< SCLK to CE hold        */
+#define TCWH 4000 /**< CE inactive time       */
+#define TCDZ 280  /**< CE to I/O high-Z       */
+
+/**
+ * Behavioural model of the DS1302
+ *
+ * Command and write data bits are sampled on the rising edge of SCL, LSB
+ * first. Read data is shifted out on the falling edges following the
+ * command byte. Reads and writes of address 31 are bursts; A clock
+ * burst write only takes once all 8 bytes are in, when CE falls.
+ *
+ * Unless it's halted, the clock runs off the host clock, fast or slow
+ * by the drift it's given, counting from when it was last written. The
+ * registers catch up as CE rises.
+ *
+ * Every edge is checked as it comes in, against the host clock, for
+ * the timing above, and for the protocol: SCLK low as CE rises, whole
+ * bytes, writes only when they're allowed, and nobody driving SDA at the
+ * same time. What doesn't hold is counted, by kind.
+ */
+struct ds1302 {
+	uint8_t clock[9];   /**< sec/min/hr/date/mon/day/yr/ctl/tcs */
+	uint8_t ram[31];
+	uint8_t burst[8];   /**< Clock burst, until CE falls   */
+	int ce, scl, sda;   /**< Pin levels driven by the host */
+	int drive;          /**< Host is driving SDA           */
+	int out;            /**< Level we drive on SDA, or -1  */
+	enum { IDLE, CMD, RD, WR } state;
+	uint8_t cmd, shift;
+	unsigned int bit, idx;
+	uint64_t xfers;
+	int64_t run_at;     /**< Clock last written, host time */
+	int64_t ran;        /**< Seconds since, in the regs    */
+	int32_t ppb;        /**< Drift, fast if positive       */
+	int rose, fell;     /**< SCL edges since CE rose       */
+	int held;           /**< Last rising edge sampled SDA  */
+	int64_t t_ce;       /**< CE last changed               */
+	int64_t t_rise;     /**< SCL last rose                 */
+	int64_t t_fall;     /**< SCL last fell                 */
+	int64_t t_sda;      /**< SDA last changed              */
+	int64_t t_z;        /**< We've let go of SDA by then   */
+	uint64_t busy;      /**< Time CE has been high, in ns  */
+	unsigned int bad[DS1302_CHECKS];
+};
+
+static const char *const checks[DS1302_CHECKS] = {
+	[DS1302_TCC]  = "tCC",
+	[DS1302_TCWH] = "tCWH",
+	[DS1302_TCCH] = "tCCH",
+	[DS1302_TDC]  = "tDC",
+	[DS1302_TCDH] = "tCDH",
+	[DS1302_TCL]  = "tCL",
+	[DS1302_TCH]  = "tCH",
+	[DS1302_TCDD] = "tCDD",
+	[DS1302_SCLK] = "SCLK high at CE",
+	[DS1302_BUS]  = "SDA contention",
+	[DS1302_CE]   = "CE mid-byte",
+	[DS1302_WP]   = "write protected",
+	[DS1302_BURST] = "short clock burst"
+};
+
+struct ds1302 host_ds1302 = { .out = -1 };
+
+static void regs_set(struct ds1302 *d, time_t t)
+{
+	struct tm tm;
+
+	gmtime_r(&t, &tm);
+	d->clock[0] = (d->clock[0] & CH) | i2bcd(tm.tm_sec);
+	d->clock[1] = i2bcd(tm.tm_min);
+	d->clock[2] = i2bcd(tm.tm_hour);
+	d->clock[3] = i2bcd(tm.tm_mday);
+	d->clock[4] = i2bcd(tm.tm_mon + 1);
+	d->clock[5] = i2bcd(tm.tm_wday + 1);
+	d->clock[6] = i2bcd(tm.tm_year - 100);
+}
+
+static time_t regs_time(const struct ds1302 *d)
+{
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_sec  = bcd2i(d->clock[0] & 0x7f);
+	tm.tm_min  = bcd2i(d->clock[1] & 0x7f);
+	tm.tm_hour = bcd2i(d->clock[2] & 0x3f);
+	tm.tm_mday = bcd2i(d->clock[3] & 0x3f);
+	tm.tm_mon  = bcd2i(d->clock[4] & 0x1f) - 1;
+	tm.tm_year = bcd2i(d->clock[6]) + 100;
+	return timegm(&tm);
+}
+
+/**
+ * Seconds the clock has run for that the registers don't have yet
+ */
+static int64_t pending(const struct ds1302 *d)
+{
+	int64_t us = host_clock() - d->run_at;
+
+	if (d->clock[0] & CH)
+		return 0;
+	return (us + us / 1000 * d->ppb / 1000000) / 1000000 - d->ran;
+}
+
+static void run(struct ds1302 *d)
+{
+	d->run_at = host_clock();
+	d->ran    = 0;
+}
+
+static void tick(struct ds1302 *d)
+{
+	int64_t n = pending(d);
+
+	if (n <= 0) return;
+	regs_set(d, regs_time(d) + (time_t)n);
+	d->ran += n;
+}
+
+void ds1302_reset(struct ds1302 *d)
+{
+	memset(d, 0, sizeof(*d));
+	d->clock[0] = CH;
+	d->clock[7] = WP;
+	d->out      = -1;
+	run(d);
+}
+
+void ds1302_set_time(struct ds1302 *d, time_t t)
+{
+	regs_set(d, t);
+	run(d);
+}
+
+time_t ds1302_get_time(const struct ds1302 *d)
+{
+	return regs_time(d) + (time_t)pending(d);
+}
+
+void ds1302_set_drift(struct ds1302 *d, int32_t ppb)
+{
+	tick(d);
+	d->ppb = ppb;
+	run(d);
+}
+
+uint8_t ds1302_ram(const struct ds1302 *d, unsigned int i)
+{
+	return i < sizeof(d->ram) ? d->ram[i] : 0;
+}
+
+void ds1302_set_ram(struct ds1302 *d, unsigned int i, uint8_t b)
+{
+	if (i < sizeof(d->ram))
+		d->ram[i] = b;
+}
+
+uint64_t ds1302_xfers(const struct ds1302 *d)
+{
+	return d->xfers;
+}
+
+uint64_t ds1302_busy(const struct ds1302 *d)
+{
+	return d->busy;
+}
+
+unsigned int ds1302_violations(const struct ds1302 *d, unsigned int check)
+{
+	unsigned int i, n = 0;
+
+	if (check < DS1302_CHECKS)
+		return d->bad[check];
+
+	for (i = 0; i < DS1302_CHECKS; i++)
+		n += d->bad[i];
+	return n;
+}
+
+const char *ds1302_check(unsigned int check)
+{
+	return check < DS1302_CHECKS ? checks[check] : "any";
+}
+
+static void flag(struct ds1302 *d, int what, unsigned int check)
+{
+	if (what) d->bad[check]++;
+}
+
+int ds1302_sda(struct ds1302 *d)
+{
+	if (d->ce && d->state == RD)
+		flag(d, !d->fell || host_clock_ns() - d->t_fall < TCDD,
+		     DS1302_TCDD);
+	return d->out < 0 ? 0 : d->out;
+}
+
+static int is_burst(const struct ds1302 *d)
+{
+	return ((d->cmd >> 1) & 0x1f) == 31;
+}
+
+static uint8_t *reg(struct ds1302 *d, unsigned int i)
+{
+	unsigned int addr = (d->cmd >> 1) & 0x1f;
+
+	if (!is_burst(d)) {
+		if (i) return NULL;
+		i = addr;
+	}
+
+	if (d->cmd & 0x40)
+		return i < sizeof(d->ram) ? &d->ram[i] : NULL;
+
+	/* The trickle charger isn't part of a clock burst */
+	return i < (is_burst(d) ? 8U : sizeof(d->clock)) ? &d->clock[i] : NULL;
+}
+
+static int clock_burst(const struct ds1302 *d)
+{
+	return is_burst(d) && !(d->cmd & 0x40);
+}
+
+static void write_byte(struct ds1302 *d)
+{
+	uint8_t *r = reg(d, d->idx);
+
+	if (clock_burst(d)) {
+		if (d->idx < sizeof(d->burst))
+			d->burst[d->idx] = d->shift;
+		return;
+	}
+
+	if (!r) return;
+	if ((d->clock[7] & WP) && r != &d->clock[7]) {
+		d->bad[DS1302_WP]++;
+		return;
+	}
+
+	*r = d->shift;
+	if (r >= d->clock && r < &d->clock[7]) run(d);
+}
+
+/**
+ * CE fell: Whatever byte was under way is lost, and a clock burst
+ * write takes, if it's whole.
+ */
+static void end(struct ds1302 *d)
+{
+	flag(d, (d->state == CMD || d->state == WR) && d->bit, DS1302_CE);
+	if (d->state != WR || !clock_burst(d))
+		return;
+
+	if (d->idx < sizeof(d->burst)) d->bad[DS1302_BURST]++;
+	else if (d->clock[7] & WP) d->bad[DS1302_WP]++;
+	else {
+		memcpy(d->clock, d->burst, sizeof(d->burst));
+		run(d);
+	}
+}
+
+static void rising(struct ds1302 *d)
+{
+	if (d->state != CMD && d->state != WR)
+		return;
+
+	d->shift |= (uint8_t)(d->sda << d->bit);
+	if (++d->bit < 8)
+		return;
+
+	if (d->state == CMD) {
+		d->cmd = d->shift;
+		flag(d, !(d->cmd & 0x80), DS1302_CE);
+		if (!(d->cmd & 0x80)) d->state = IDLE;
+		else d->state = (d->cmd & 1) ? RD : WR;
+	} else {
+		write_byte(d);
+		d->idx++;
+	}
+
+	d->bit   = 0;
+	d->shift = 0;
+}
+
+static void falling(struct ds1302 *d)
+{
+	uint8_t *r;
+
+	if (d->state != RD)
+		return;
+
+	/* A single-byte read keeps repeating the same byte */
+	r = reg(d, is_burst(d) ? d->idx : 0);
+	flag(d, d->drive, DS1302_BUS);
+	d->out = r ? (*r >> d->bit) & 1 : 0;
+	if (++d->bit == 8) {
+		d->bit = 0;
+		d->idx++;
+	}
+}
+
+static void sda(struct ds1302 *d, int64_t now)
+{
+	flag(d, d->ce && d->held && now - d->t_rise < TCDH, DS1302_TCDH);
+	d->t_sda = now;
+}
+
+void ds1302_pin(struct ds1302 *d, int pin, int level)
+{
+	int64_t now = host_clock_ns();
+
+	if (pin == CONFIG_DALLAS_GPIO_CE) {
+		if (level && !d->ce) {
+			tick(d);
+			flag(d, d->scl, DS1302_SCLK);
+			flag(d, d->xfers && now - d->t_ce < TCWH, DS1302_TCWH);
+			d->state = CMD;
+			d->bit   = 0;
+			d->idx   = 0;
+			d->shift = 0;
+			d->rose  = d->fell = d->held = 0;
+			d->t_ce  = now;
+			d->xfers++;
+		} else if (!level && d->ce) {
+			flag(d, d->rose && now - d->t_rise < TCCH, DS1302_TCCH);
+			end(d);
+			d->busy += (uint64_t)(now - d->t_ce);
+			d->t_ce  = now;
+			d->t_z   = now + TCDZ;
+		}
+
+		if (!level) d->state = IDLE;
+		d->out = -1;
+		d->ce  = level;
+	} else if (pin == CONFIG_DALLAS_GPIO_SCL) {
+		if (d->ce && level && !d->scl) {
+			flag(d, !d->rose && now - d->t_ce < TCC, DS1302_TCC);
+			flag(d, d->fell && now - d->t_fall < TCL, DS1302_TCL);
+			d->held = d->state == CMD || d->state == WR;
+			flag(d, d->held && (!d->drive || now - d->t_sda < TDC),
+			     DS1302_TDC);
+			d->rose   = 1;
+			d->t_rise = now;
+			rising(d);
+		} else if (d->ce && !level && d->scl) {
+			flag(d, now - d->t_rise < TCH, DS1302_TCH);
+			d->fell   = 1;
+			d->t_fall = now;
+			falling(d);
+		}
+
+		d->scl = level;
+	} else if (pin == CONFIG_DALLAS_GPIO_SDA) {
+		if (level != d->sda) sda(d, now);
+		d->sda = level;
+	}
+}
+
+void ds1302_drive(struct ds1302 *d, int drive)
+{
+	int64_t now = host_clock_ns();
+
+	drive = !!drive;
+	if (drive == d->drive)
+		return;
+
+	flag(d, drive && (d->out >= 0 || now < d->t_z), DS1302_BUS);
+	sda(d, now);
+	d->drive = drive;
+}
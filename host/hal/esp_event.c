@@ -0,0 +1,286 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <esp_err.h>
+#include <esp_event.h>
+
+#include "host.h"
+
+#define MAX_HANDLERS 16
+
+struct event {
+	esp_event_base_t base;
+	int32_t id;
+	void *data;
+};
+
+struct handler {
+	esp_event_base_t base;
+	int32_t id;
+	esp_event_handler_t fn;
+	void *arg;
+};
+
+/**
+ * Event loops
+ *
+ * By default there's no loop task on the host: events are queued by the
+ * posting functions and dispatched whenever the loop is run, which keeps
+ * the benchmarks deterministic. host_event_start() runs a loop on a
+ * thread of its own instead, for code that waits on the loop.
+ */
+struct esp_event_loop {
+	pthread_mutex_t mtx;
+	pthread_mutex_t run;
+	pthread_cond_t cv;
+	pthread_t task;
+	int running;
+	struct event *q;
+	unsigned int size, head, n;
+	struct handler h[MAX_HANDLERS];
+	unsigned int nh;
+};
+
+static struct esp_event_loop *default_loop;
+
+static struct esp_event_loop *loop_new(unsigned int size)
+{
+	struct esp_event_loop *l;
+
+	if (!(l = calloc(1, sizeof(*l))))
+		return NULL;
+
+	if (!(l->q = calloc(size, sizeof(*l->q)))) {
+		free(l);
+		return NULL;
+	}
+
+	pthread_mutex_init(&l->mtx, NULL);
+	pthread_mutex_init(&l->run, NULL);
+	pthread_cond_init(&l->cv, NULL);
+	l->size = size;
+	return l;
+}
+
+esp_err_t esp_event_loop_create(const esp_event_loop_args_t *args,
+                                esp_event_loop_handle_t *loop)
+{
+	if (!args || !loop || args->queue_size <= 0)
+		return ESP_ERR_INVALID_ARG;
+
+	return (*loop = loop_new(args->queue_size)) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_event_loop_create_default(void)
+{
+	if (default_loop)
+		return ESP_ERR_INVALID_STATE;
+
+	default_loop = loop_new(CONFIG_ESP_SYSTEM_EVENT_QUEUE_SIZE);
+	return default_loop ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_event_handler_register_with(esp_event_loop_handle_t l,
+                                          esp_event_base_t base,
+                                          int32_t id,
+                                          esp_event_handler_t fn,
+                                          void *arg)
+{
+	esp_err_t ret = ESP_OK;
+
+	if (!l || !fn)
+		return ESP_ERR_INVALID_ARG;
+
+	pthread_mutex_lock(&l->mtx);
+	if (l->nh == MAX_HANDLERS) ret = ESP_ERR_NO_MEM;
+	else l->h[l->nh++] = (struct handler){ base, id, fn, arg };
+	pthread_mutex_unlock(&l->mtx);
+	return ret;
+}
+
+esp_err_t esp_event_handler_register(esp_event_base_t base, int32_t id,
+                                     esp_event_handler_t fn, void *arg)
+{
+	return esp_event_handler_register_with(default_loop, base, id,
+	                                       fn, arg);
+}
+
+esp_err_t esp_event_handler_instance_register(
+	esp_event_base_t base, int32_t id, esp_event_handler_t fn,
+	void *arg, esp_event_handler_instance_t *instance)
+{
+	if (instance) *instance = (void *)fn;
+	return esp_event_handler_register(base, id, fn, arg);
+}
+
+/**
+ * NOTE: wifi.c passes the handler function itself as the instance.
+ */
+esp_err_t esp_event_handler_instance_unregister(
+	esp_event_base_t base, int32_t id,
+	esp_event_handler_instance_t instance)
+{
+	struct esp_event_loop *l = default_loop;
+	unsigned int i;
+
+	if (!l) return ESP_ERR_INVALID_STATE;
+	pthread_mutex_lock(&l->mtx);
+	for (i = 0; i < l->nh; i++) {
+		if (l->h[i].base == base && l->h[i].id == id &&
+		    (void *)l->h[i].fn == instance) {
+			memmove(&l->h[i], &l->h[i + 1],
+			        (l->nh - i - 1) * sizeof(*l->h));
+			l->nh--;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&l->mtx);
+	return ESP_OK;
+}
+
+esp_err_t esp_event_post_to(esp_event_loop_handle_t l,
+                            esp_event_base_t base, int32_t id,
+                            void *data, size_t size, TickType_t ticks)
+{
+	void *copy = NULL;
+	esp_err_t ret = ESP_OK;
+	(void)ticks;
+
+	if (!l) return ESP_ERR_INVALID_ARG;
+	if (data && size) {
+		if (!(copy = malloc(size)))
+			return ESP_ERR_NO_MEM;
+		memcpy(copy, data, size);
+	}
+
+	pthread_mutex_lock(&l->mtx);
+	if (l->n == l->size) {
+		ret = ESP_ERR_TIMEOUT;
+		free(copy);
+	} else {
+		l->q[(l->head + l->n++) % l->size] =
+			(struct event){ base, id, copy };
+		pthread_cond_signal(&l->cv);
+	}
+
+	pthread_mutex_unlock(&l->mtx);
+	return ret;
+}
+
+esp_err_t esp_event_post(esp_event_base_t base, int32_t id,
+                         void *data, size_t size, TickType_t ticks)
+{
+	return esp_event_post_to(default_loop, base, id, data, size, ticks);
+}
+
+esp_err_t esp_event_isr_post_to(esp_event_loop_handle_t l,
+                                esp_event_base_t base, int32_t id,
+                                void *data, size_t size,
+                                BaseType_t *woken)
+{
+	if (woken) *woken = pdFALSE;
+	return esp_event_post_to(l, base, id, data, size, 0);
+}
+
+/**
+ * Dispatch everything that's pending, including events posted by the
+ * handlers themselves.
+ */
+unsigned int host_event_drain(struct esp_event_loop *l)
+{
+	struct handler h[MAX_HANDLERS];
+	unsigned int i, nh, n = 0;
+	struct event ev;
+
+	if (!l && !(l = default_loop))
+		return 0;
+
+	pthread_mutex_lock(&l->run);
+	for (;;) {
+		pthread_mutex_lock(&l->mtx);
+		if (!l->n) {
+			pthread_mutex_unlock(&l->mtx);
+			break;
+		}
+
+		ev      = l->q[l->head];
+		l->head = (l->head + 1) % l->size;
+		l->n--;
+		nh      = l->nh;
+		memcpy(h, l->h, nh * sizeof(*h));
+		pthread_mutex_unlock(&l->mtx);
+
+		for (i = 0; i < nh; i++) {
+			if ((h[i].base == ESP_EVENT_ANY_BASE ||
+			     h[i].base == ev.base) &&
+			    (h[i].id == ESP_EVENT_ANY_ID || h[i].id == ev.id))
+				h[i].fn(h[i].arg, ev.base, ev.id, ev.data);
+		}
+
+		free(ev.data);
+		n++;
+	}
+
+	pthread_mutex_unlock(&l->run);
+	return n;
+}
+
+static void *loop_task(void *arg)
+{
+	struct esp_event_loop *l = arg;
+
+	pthread_mutex_lock(&l->mtx);
+	while (l->running) {
+		if (!l->n) {
+			pthread_cond_wait(&l->cv, &l->mtx);
+			continue;
+		}
+
+		pthread_mutex_unlock(&l->mtx);
+		host_event_drain(l);
+		pthread_mutex_lock(&l->mtx);
+	}
+
+	pthread_mutex_unlock(&l->mtx);
+	return NULL;
+}
+
+void host_event_start(struct esp_event_loop *l)
+{
+	if (!l && !(l = default_loop))
+		return;
+
+	pthread_mutex_lock(&l->mtx);
+	if (!l->running) {
+		l->running = 1;
+		pthread_create(&l->task, NULL, loop_task, l);
+	}
+	pthread_mutex_unlock(&l->mtx);
+}
+
+void host_event_stop(struct esp_event_loop *l)
+{
+	if (!l && !(l = default_loop))
+		return;
+
+	pthread_mutex_lock(&l->mtx);
+	if (!l->running) {
+		pthread_mutex_unlock(&l->mtx);
+		return;
+	}
+
+	l->running = 0;
+	pthread_cond_signal(&l->cv);
+	pthread_mutex_unlock(&l->mtx);
+	pthread_join(l->task, NULL);
+}
+
+esp_err_t esp_event_loop_run(esp_event_loop_handle_t l, TickType_t ticks)
+{
+	(void)ticks;
+	host_event_drain(l);
+	return ESP_OK;
+}
@@ -0,0 +1,179 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <esp_err.h>
+#include <esp_timer.h>
+
+#include "host.h"
+
+/**
+ * Timers run against the simulated clock. Nothing fires on its own;
+ * host_timer_run() dispatches whatever has expired, as the esp_timer
+ * task would.
+ */
+struct esp_timer {
+	esp_timer_create_args_t args;
+	int64_t expiry;
+	uint64_t period;
+	int armed;
+	struct esp_timer *next;
+};
+
+static struct esp_timer *timers;
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+
+esp_err_t esp_timer_init(void)
+{
+	return ESP_OK;
+}
+
+int64_t esp_timer_get_time(void)
+{
+	return host_clock();
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args,
+                           esp_timer_handle_t *out)
+{
+	struct esp_timer *t;
+
+	if (!args || !args->callback || !out)
+		return ESP_ERR_INVALID_ARG;
+
+	if (!(t = calloc(1, sizeof(*t))))
+		return ESP_ERR_NO_MEM;
+
+	t->args = *args;
+	pthread_mutex_lock(&mtx);
+	t->next = timers;
+	timers  = t;
+	pthread_mutex_unlock(&mtx);
+	*out = t;
+	return ESP_OK;
+}
+
+static esp_err_t start(esp_timer_handle_t t, uint64_t us, uint64_t period)
+{
+	esp_err_t ret = ESP_OK;
+
+	if (!t) return ESP_ERR_INVALID_ARG;
+	pthread_mutex_lock(&mtx);
+	if (t->armed) ret = ESP_ERR_INVALID_STATE;
+	else {
+		t->expiry = host_clock() + (int64_t)us;
+		t->period = period;
+		t->armed  = 1;
+	}
+
+	pthread_mutex_unlock(&mtx);
+	return ret;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t t, uint64_t us)
+{
+	return start(t, us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t t, uint64_t us)
+{
+	return start(t, us, us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t t)
+{
+	esp_err_t ret = ESP_OK;
+
+	if (!t) return ESP_ERR_INVALID_ARG;
+	pthread_mutex_lock(&mtx);
+	if (!t->armed) ret = ESP_ERR_INVALID_STATE;
+	t->armed = 0;
+	pthread_mutex_unlock(&mtx);
+	return ret;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t t)
+{
+	bool armed;
+
+	pthread_mutex_lock(&mtx);
+	armed = t && t->armed;
+	pthread_mutex_unlock(&mtx);
+	return armed;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t t)
+{
+	struct esp_timer **p;
+
+	if (!t) return ESP_ERR_INVALID_ARG;
+	pthread_mutex_lock(&mtx);
+	for (p = &timers; *p; p = &(*p)->next) {
+		if (*p == t) {
+			*p = t->next;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&mtx);
+	free(t);
+	return ESP_OK;
+}
+
+int64_t esp_timer_get_next_alarm(void)
+{
+	struct esp_timer *t;
+	int64_t next = INT64_MAX;
+
+	pthread_mutex_lock(&mtx);
+	for (t = timers; t; t = t->next) {
+		if (t->armed && t->expiry < next)
+			next = t->expiry;
+	}
+
+	pthread_mutex_unlock(&mtx);
+	return next;
+}
+
+void host_timer_run(void)
+{
+	struct esp_timer *t, *due;
+
+	do {
+		due = NULL;
+		pthread_mutex_lock(&mtx);
+		for (t = timers; t; t = t->next) {
+			if (t->armed && t->expiry <= host_clock() &&
+			    (!due || t->expiry < due->expiry))
+				due = t;
+		}
+
+		if (due) {
+			if (due->period) due->expiry += (int64_t)due->period;
+			else due->armed = 0;
+		}
+
+		pthread_mutex_unlock(&mtx);
+		if (due) due->args.callback(due->args.arg);
+	} while (due);
+}
+
+int host_timer_fire(const char *name)
+{
+	struct esp_timer *t;
+
+	pthread_mutex_lock(&mtx);
+	for (t = timers; t; t = t->next) {
+		if (t->args.name && !strcmp(t->args.name, name))
+			break;
+	}
+
+	if (t) t->armed = 0;
+	pthread_mutex_unlock(&mtx);
+	if (!t) return -1;
+
+	t->args.callback(t->args.arg);
+	return 0;
+}
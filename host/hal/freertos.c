@@ -0,0 +1,216 @@
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_rom_sys.h>
+
+#include "host.h"
+
+struct host_task {
+	TaskFunction_t fn;
+	void *arg;
+	UBaseType_t prio;
+};
+
+struct host_sem {
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	unsigned int count;
+};
+
+/**
+ * The clock is kept in us, with the ns below that apart, so it doesn't
+ * overflow any sooner for having them.
+ */
+static _Atomic int64_t clock_us;
+static _Atomic int64_t clock_ns;
+static _Atomic uint64_t ticks;
+
+int64_t host_clock(void)
+{
+	return atomic_load(&clock_us);
+}
+
+int64_t host_clock_ns(void)
+{
+	return atomic_load(&clock_us) * 1000 + atomic_load(&clock_ns);
+}
+
+void host_clock_advance(int64_t us)
+{
+	atomic_fetch_add(&clock_us, us);
+}
+
+void host_clock_advance_ns(int64_t ns)
+{
+	int64_t n = atomic_load(&clock_ns);
+
+	while (!atomic_compare_exchange_weak(&clock_ns, &n, (n + ns) % 1000));
+	atomic_fetch_add(&clock_us, (n + ns) / 1000);
+}
+
+uint64_t host_ticks(void)
+{
+	return atomic_load(&ticks);
+}
+
+/**
+ * Tick sleeps advance the simulated clock rather than sleeping, so the
+ * time the firmware would spend blocked shows up in host_ticks() without
+ * slowing the benchmarks down.
+ */
+void vTaskDelay(TickType_t n)
+{
+	atomic_fetch_add(&ticks, n);
+	host_clock_advance((int64_t)n * portTICK_PERIOD_MS * 1000);
+	sched_yield();
+}
+
+/**
+ * Busy-waits don't yield, or count as ticks
+ */
+void esp_rom_delay_us(uint32_t us)
+{
+	host_clock_advance(us);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return (TickType_t)(host_clock() / (portTICK_PERIOD_MS * 1000));
+}
+
+/**
+ * Tasks don't run on the host. Like the timers and the event loops,
+ * whatever a task would do is run by the benchmarks as they see fit;
+ * For the control task, that's ctl_run().
+ */
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name,
+                                   uint32_t stack, void *arg,
+                                   UBaseType_t prio, TaskHandle_t *handle,
+                                   BaseType_t core)
+{
+	struct host_task *t;
+	(void)name;
+	(void)stack;
+	(void)core;
+
+	if (!(t = calloc(1, sizeof(*t))))
+		return pdFAIL;
+
+	t->fn   = fn;
+	t->arg  = arg;
+	t->prio = prio;
+	if (handle) *handle = t;
+	return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack,
+                       void *arg, UBaseType_t prio, TaskHandle_t *handle)
+{
+	return xTaskCreatePinnedToCore(fn, name, stack, arg, prio, handle,
+	                               tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+	if (!task) pthread_exit(NULL);
+	free(task);
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task)
+{
+	return task ? task->prio : 1;
+}
+
+/**
+ * Semaphores
+ *
+ * Unlike tick sleeps, blocking on a semaphore takes real time, as that's
+ * what the contention benchmarks are interested in.
+ */
+static SemaphoreHandle_t sem_create(unsigned int count)
+{
+	struct host_sem *s;
+
+	if (!(s = calloc(1, sizeof(*s))))
+		return NULL;
+
+	pthread_mutex_init(&s->mtx, NULL);
+	pthread_cond_init(&s->cond, NULL);
+	s->count = count;
+	return s;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	return sem_create(0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	return sem_create(1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t n)
+{
+	struct timespec ts;
+	int rc = 0;
+
+	pthread_mutex_lock(&s->mtx);
+	if (n != portMAX_DELAY) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += (long)n * portTICK_PERIOD_MS * 1000000L;
+		ts.tv_sec  += ts.tv_nsec / 1000000000L;
+		ts.tv_nsec %= 1000000000L;
+	}
+
+	while (!s->count && rc != ETIMEDOUT) {
+		if (n == portMAX_DELAY)
+			rc = pthread_cond_wait(&s->cond, &s->mtx);
+		else if (!n) rc = ETIMEDOUT;
+		else rc = pthread_cond_timedwait(&s->cond, &s->mtx, &ts);
+	}
+
+	if (s->count) {
+		--s->count;
+		rc = 0;
+	}
+
+	pthread_mutex_unlock(&s->mtx);
+	return rc ? pdFALSE : pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s)
+{
+	BaseType_t ret = pdFALSE;
+
+	pthread_mutex_lock(&s->mtx);
+	if (!s->count) {
+		s->count = 1;
+		ret = pdTRUE;
+		pthread_cond_signal(&s->cond);
+	}
+
+	pthread_mutex_unlock(&s->mtx);
+	return ret;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t s, BaseType_t *woken)
+{
+	if (woken) *woken = pdFALSE;
+	return xSemaphoreGive(s);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t s)
+{
+	pthread_cond_destroy(&s->cond);
+	pthread_mutex_destroy(&s->mtx);
+	free(s);
+}
@@ -0,0 +1,220 @@
+
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <driver/gpio.h>
+
+#include "host.h"
+
+static struct pin {
+	gpio_mode_t mode;
+	gpio_int_type_t intr;
+	int out;          /**< Output latch             */
+	int in;           /**< Externally driven level  */
+	int hold;         /**< Output latch held        */
+	gpio_int_type_t wake;
+	gpio_isr_t isr;
+	void *arg;
+} pins[GPIO_NUM_MAX];
+
+static _Atomic uint64_t writes;
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t host_gpio_writes(void)
+{
+	return atomic_load(&writes);
+}
+
+static int is_dallas(gpio_num_t pin)
+{
+	return pin == CONFIG_DALLAS_GPIO_CE  ||
+	       pin == CONFIG_DALLAS_GPIO_SCL ||
+	       pin == CONFIG_DALLAS_GPIO_SDA;
+}
+
+/**
+ * SDA is driven whenever it's an output
+ */
+static void sda_mode(gpio_num_t pin)
+{
+	if (pin != CONFIG_DALLAS_GPIO_SDA)
+		return;
+
+	ds1302_drive(&host_ds1302, pins[pin].mode == GPIO_MODE_OUTPUT);
+	if (pins[pin].mode == GPIO_MODE_OUTPUT)
+		ds1302_pin(&host_ds1302, pin, pins[pin].out);
+}
+
+esp_err_t gpio_config(const gpio_config_t *conf)
+{
+	int i;
+
+	for (i = 0; i < GPIO_NUM_MAX; i++) {
+		if (!(conf->pin_bit_mask & (1ULL << i)))
+			continue;
+
+		pins[i].mode = conf->mode;
+		pins[i].intr = conf->intr_type;
+		sda_mode(i);
+	}
+
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t pin, uint32_t level)
+{
+	if (pin < 0 || pin >= GPIO_NUM_MAX)
+		return ESP_ERR_INVALID_ARG;
+
+	atomic_fetch_add(&writes, 1);
+	if (is_dallas(pin)) host_clock_advance_ns(HOST_GPIO_NS);
+	if (!pins[pin].hold && host_ledc_pin(pin) < 0)
+		pins[pin].out = !!level;
+	if (is_dallas(pin) && pins[pin].mode == GPIO_MODE_OUTPUT)
+		ds1302_pin(&host_ds1302, pin, !!level);
+	return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t pin)
+{
+	int l;
+
+	if (pin < 0 || pin >= GPIO_NUM_MAX)
+		return 0;
+
+	if (pin == CONFIG_DALLAS_GPIO_SDA &&
+	    pins[pin].mode == GPIO_MODE_INPUT) {
+		host_clock_advance_ns(HOST_GPIO_NS);
+		return ds1302_sda(&host_ds1302);
+	}
+
+	if (pins[pin].mode == GPIO_MODE_OUTPUT && (l = host_ledc_pin(pin)) >= 0)
+		return l;
+
+	return pins[pin].mode == GPIO_MODE_INPUT ? pins[pin].in
+	                                         : pins[pin].out;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t pin, gpio_mode_t mode)
+{
+	if (pin < 0 || pin >= GPIO_NUM_MAX)
+		return ESP_ERR_INVALID_ARG;
+
+	if (is_dallas(pin)) host_clock_advance_ns(HOST_GPIO_NS);
+	pins[pin].mode = mode;
+	sda_mode(pin);
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_drive_capability(gpio_num_t pin, gpio_drive_cap_t cap)
+{
+	(void)cap;
+	return pin < 0 || pin >= GPIO_NUM_MAX ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int flags)
+{
+	(void)flags;
+	return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t pin, gpio_isr_t isr, void *arg)
+{
+	if (pin < 0 || pin >= GPIO_NUM_MAX)
+		return ESP_ERR_INVALID_ARG;
+
+	pins[pin].isr = isr;
+	pins[pin].arg = arg;
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t pin, gpio_int_type_t type)
+{
+	if (pin < 0 || pin >= GPIO_NUM_MAX)
+		return ESP_ERR_INVALID_ARG;
+
+	pins[pin].intr = type;
+	return ESP_OK;
+}
+
+/**
+ * The wakeup level is the pin's interrupt type, as on the ESP32, and
+ * disabling it leaves the interrupt disabled.
+ */
+esp_err_t gpio_wakeup_enable(gpio_num_t pin, gpio_int_type_t type)
+{
+	if (pin < 0 || pin >= GPIO_NUM_MAX)
+		return ESP_ERR_INVALID_ARG;
+
+	pins[pin].wake = type;
+	pins[pin].intr = type;
+	return ESP_OK;
+}
+
+esp_err_t gpio_wakeup_disable(gpio_num_t pin)
+{
+	if (pin < 0 || pin >= GPIO_NUM_MAX)
+		return ESP_ERR_INVALID_ARG;
+
+	pins[pin].wake = GPIO_INTR_DISABLE;
+	pins[pin].intr = GPIO_INTR_DISABLE;
+	return ESP_OK;
+}
+
+esp_err_t gpio_hold_en(gpio_num_t pin)
+{
+	if (pin < 0 || pin >= GPIO_NUM_MAX)
+		return ESP_ERR_INVALID_ARG;
+
+	pins[pin].hold = 1;
+	return ESP_OK;
+}
+
+esp_err_t gpio_hold_dis(gpio_num_t pin)
+{
+	if (pin < 0 || pin >= GPIO_NUM_MAX)
+		return ESP_ERR_INVALID_ARG;
+
+	pins[pin].hold = 0;
+	return ESP_OK;
+}
+
+int host_gpio_wakes(int pin, int level)
+{
+	if (pin < 0 || pin >= GPIO_NUM_MAX)
+		return 0;
+
+	return (pins[pin].wake == GPIO_INTR_HIGH_LEVEL && level) ||
+	       (pins[pin].wake == GPIO_INTR_LOW_LEVEL && !level);
+}
+
+/**
+ * Drive an input pin, and run its ISR as the interrupt matrix would.
+ * ISRs are serialized, as they are on a single core.
+ */
+void host_gpio_input(int pin, int level)
+{
+	struct pin *p;
+	int fire = 0;
+
+	if (pin < 0 || pin >= GPIO_NUM_MAX)
+		return;
+
+	p = &pins[pin];
+	pthread_mutex_lock(&mtx);
+	level = !!level;
+	switch (p->intr) {
+	case GPIO_INTR_POSEDGE:    fire = !p->in && level;  break;
+	case GPIO_INTR_NEGEDGE:    fire = p->in && !level;  break;
+	case GPIO_INTR_ANYEDGE:    fire = p->in != level;   break;
+	case GPIO_INTR_LOW_LEVEL:  fire = !level;           break;
+	case GPIO_INTR_HIGH_LEVEL: fire = level;            break;
+	default: break;
+	}
+
+	p->in = level;
+	if (fire && p->isr)
+		p->isr(p->arg);
+	pthread_mutex_unlock(&mtx);
+}
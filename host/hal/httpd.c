@@ -0,0 +1,632 @@
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+#include "host.h"
+
+#define MAX_HANDLERS 32
+#define MAX_SOCKETS  16
+
+/**
+ * fd of plain http requests, and of the first websocket client
+ */
+#define HTTP_FD 53
+#define WS_FD   54
+
+/**
+ * Per-request state hung off of req->aux
+ */
+struct aux {
+	const char *hdrs;
+	const char *body;
+	size_t body_len, body_pos;
+	const char *status;
+	unsigned int nhdrs;
+	int sent;
+	struct host_http_resp *resp;
+	int fd;
+	const char *frame;
+};
+
+/**
+ * Websocket client, and the frames it got
+ */
+struct ws {
+	int open;
+	const httpd_uri_t *uri;
+	unsigned int frames;
+	char last[256];
+};
+
+/**
+ * A single server instance, run in the caller's thread. Requests are
+ * serialized like they are on the httpd task.
+ */
+static struct server {
+	httpd_config_t config;
+	httpd_uri_t uris[MAX_HANDLERS];
+	unsigned int n;
+	struct ws ws[MAX_SOCKETS];
+	int running;
+} server;
+
+/**
+ * Recursive, since queued work may run right away, and can be queued
+ * from a handler.
+ */
+static pthread_mutex_t mtx = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+/**
+ * Work queued while the server is busy, which runs once it's done with
+ * the request at hand, the way the httpd task gets to it on the target.
+ */
+#define MAX_WORK 16
+
+static struct work {
+	httpd_work_fn_t fn;
+	void *arg;
+} work[MAX_WORK];
+
+static unsigned int nwork;
+static pthread_mutex_t work_mtx = PTHREAD_MUTEX_INITIALIZER;
+static __thread int handling;
+
+static void run_work(void)
+{
+	struct work w;
+
+	for (;;) {
+		pthread_mutex_lock(&work_mtx);
+		if (!nwork) {
+			pthread_mutex_unlock(&work_mtx);
+			return;
+		}
+
+		w = work[0];
+		memmove(work, work + 1, --nwork * sizeof(*work));
+		pthread_mutex_unlock(&work_mtx);
+		if (server.running) {
+			handling = 1;
+			w.fn(w.arg);
+			handling = 0;
+		}
+	}
+}
+
+static void unlock(void)
+{
+	run_work();
+	pthread_mutex_unlock(&mtx);
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+	if (server.running)
+		return ESP_ERR_INVALID_STATE;
+
+	memset(&server, 0, sizeof(server));
+	server.config  = *config;
+	server.running = 1;
+	*handle = &server;
+	return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle)
+{
+	if (handle != &server)
+		return ESP_ERR_INVALID_ARG;
+
+	pthread_mutex_lock(&mtx);
+	memset(&server, 0, sizeof(server));
+	pthread_mutex_unlock(&mtx);
+	return ESP_OK;
+}
+
+/**
+ * Clients: The websocket ones are the only ones which stay connected
+ */
+esp_err_t httpd_get_client_list(httpd_handle_t handle, size_t *fds,
+                                int *client_fds)
+{
+	size_t i, n = 0;
+
+	if (handle != &server || !fds || !client_fds)
+		return ESP_ERR_INVALID_ARG;
+
+	pthread_mutex_lock(&mtx);
+	for (i = 0; i < MAX_SOCKETS; i++) {
+		if (!server.ws[i].open)
+			continue;
+
+		if (n == *fds) {
+			pthread_mutex_unlock(&mtx);
+			return ESP_ERR_INVALID_ARG;
+		}
+
+		client_fds[n++] = WS_FD + (int)i;
+	}
+	pthread_mutex_unlock(&mtx);
+
+	*fds = n;
+	return ESP_OK;
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd)
+{
+	if (handle != &server)
+		return ESP_ERR_INVALID_ARG;
+
+	host_ws_close(sockfd);
+	return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle,
+                                     const httpd_uri_t *uri)
+{
+	unsigned int i;
+
+	if (handle != &server || !uri)
+		return ESP_ERR_INVALID_ARG;
+
+	for (i = 0; i < server.n; i++) {
+		if (server.uris[i].method == uri->method &&
+		    !strcmp(server.uris[i].uri, uri->uri))
+			return ESP_ERR_HTTPD_HANDLER_EXISTS;
+	}
+
+	if (server.n == server.config.max_uri_handlers ||
+	    server.n == MAX_HANDLERS)
+		return ESP_ERR_HTTPD_HANDLERS_FULL;
+
+	server.uris[server.n++] = *uri;
+	return ESP_OK;
+}
+
+/**
+ * Same semantics as the esp-idf version: A trailing '*' matches
+ * anything, and a '?' before it makes the preceding character optional.
+ */
+bool httpd_uri_match_wildcard(const char *tmpl, const char *uri, size_t len)
+{
+	size_t tlen = strlen(tmpl);
+	size_t plen;
+
+	if (!tlen || tmpl[tlen - 1] != '*')
+		return tlen == len && !strncmp(tmpl, uri, len);
+
+	plen = tlen - 1;
+	if (plen && tmpl[plen - 1] == '?') {
+		--plen;
+		if (len == plen - 1 && !strncmp(tmpl, uri, len))
+			return true;
+	}
+
+	return len >= plen && !strncmp(tmpl, uri, plen);
+}
+
+static size_t copy(char *dst, const char *src, size_t n, size_t len)
+{
+	size_t m = n < len ? n : len - 1;
+
+	memcpy(dst, src, m);
+	dst[m] = '\0';
+	return m;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t len)
+{
+	const char *q = strchr(r->uri, '?');
+
+	if (!q) return ESP_ERR_NOT_FOUND;
+	if (!len) return ESP_ERR_INVALID_ARG;
+	++q;
+	return copy(buf, q, strlen(q), len) < strlen(q)
+	       ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key,
+                                char *val, size_t len)
+{
+	size_t klen = strlen(key), vlen;
+	const char *p = qry, *e;
+
+	if (!len) return ESP_ERR_INVALID_ARG;
+	while (p && *p) {
+		e = strchr(p, '&');
+		if (!strncmp(p, key, klen) && p[klen] == '=') {
+			p   += klen + 1;
+			vlen = e ? (size_t)(e - p) : strlen(p);
+			return copy(val, p, vlen, len) < vlen
+			       ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+		}
+
+		p = e ? e + 1 : NULL;
+	}
+
+	return ESP_ERR_NOT_FOUND;
+}
+
+static const char *find_hdr(httpd_req_t *r, const char *field, size_t *len)
+{
+	struct aux *a = r->aux;
+	size_t flen = strlen(field);
+	const char *p = a->hdrs, *e;
+
+	while (p && *p) {
+		e = strstr(p, "\r\n");
+		if (!strncasecmp(p, field, flen) && p[flen] == ':') {
+			p += flen + 1;
+			while (*p == ' ') p++;
+			*len = e ? (size_t)(e - p) : strlen(p);
+			return p;
+		}
+
+		p = e ? e + 2 : NULL;
+	}
+
+	return NULL;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
+{
+	size_t len = 0;
+
+	return find_hdr(r, field, &len) ? len : 0;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field,
+                                      char *val, size_t len)
+{
+	const char *v;
+	size_t vlen;
+
+	if (!(v = find_hdr(r, field, &vlen)))
+		return ESP_ERR_NOT_FOUND;
+
+	if (!len) return ESP_ERR_INVALID_ARG;
+	return copy(val, v, vlen, len) < vlen
+	       ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+}
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t len)
+{
+	struct aux *a = r->aux;
+	size_t n = a->body_len - a->body_pos;
+
+	if (n > len) n = len;
+	memcpy(buf, a->body + a->body_pos, n);
+	a->body_pos += n;
+	return (int)n;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status)
+{
+	((struct aux *)r->aux)->status = status;
+	return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+	((struct aux *)r->aux)->resp->type = type;
+	return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field,
+                             const char *value)
+{
+	struct aux *a = r->aux;
+	size_t n = strlen(a->resp->hdrs);
+
+	if (a->nhdrs == server.config.max_resp_headers)
+		return ESP_ERR_HTTPD_RESP_HDR;
+
+	a->nhdrs++;
+	snprintf(a->resp->hdrs + n, sizeof(a->resp->hdrs) - n,
+	         "%s: %s\r\n", field, value);
+	return ESP_OK;
+}
+
+/**
+ * The status line is copied at the time the headers go out, same as
+ * on the target.
+ */
+static void send_hdrs(struct aux *a)
+{
+	if (a->sent++) return;
+	snprintf(a->resp->status_str, sizeof(a->resp->status_str), "%s",
+	         a->status);
+	a->resp->status = atoi(a->status);
+}
+
+static void append(struct host_http_resp *resp, const char *buf, size_t len)
+{
+	size_t room = sizeof(resp->body) - 1;
+
+	if (resp->len < room) {
+		memcpy(resp->body + resp->len, buf,
+		       len < room - resp->len ? len : room - resp->len);
+	}
+
+	resp->len += len;
+	resp->body[resp->len < room ? resp->len : room] = '\0';
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t len)
+{
+	struct aux *a = r->aux;
+
+	if (a->sent) return ESP_ERR_HTTPD_RESP_SEND;
+	if (len < 0) len = buf ? (ssize_t)strlen(buf) : 0;
+	send_hdrs(a);
+	if (buf && len) append(a->resp, buf, (size_t)len);
+	return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t len)
+{
+	struct aux *a = r->aux;
+
+	if (len < 0) len = buf ? (ssize_t)strlen(buf) : 0;
+	send_hdrs(a);
+	if (buf && len) append(a->resp, buf, (size_t)len);
+	return ESP_OK;
+}
+
+esp_err_t httpd_resp_sendstr_chunk(httpd_req_t *r, const char *str)
+{
+	return httpd_resp_send_chunk(r, str, str ? (ssize_t)strlen(str) : 0);
+}
+
+static httpd_uri_t *find(int method, const char *uri)
+{
+	size_t len = strcspn(uri, "?");
+	unsigned int i;
+
+	for (i = 0; i < server.n; i++) {
+		if ((int)server.uris[i].method != method)
+			continue;
+
+		if (server.config.uri_match_fn
+		    ? server.config.uri_match_fn(server.uris[i].uri, uri, len)
+		    : (strlen(server.uris[i].uri) == len &&
+		       !strncmp(server.uris[i].uri, uri, len)))
+			return &server.uris[i];
+	}
+
+	return NULL;
+}
+
+static void req_init(httpd_req_t *req, struct aux *a, int method,
+                     const char *uri, struct host_http_resp *resp)
+{
+	memset(resp, 0, sizeof(*resp));
+	memset(req, 0, sizeof(*req));
+	memset(a, 0, sizeof(*a));
+	a->hdrs     = "";
+	a->body     = "";
+	a->status   = HTTPD_200;
+	a->resp     = resp;
+	a->fd       = HTTP_FD;
+	resp->type  = HTTPD_TYPE_TEXT;
+	req->method = method;
+	req->aux    = a;
+	req->handle = &server;
+	snprintf((char *)req->uri, sizeof(req->uri), "%s", uri);
+}
+
+int host_http_request(int method, const char *uri, const char *hdrs,
+                      const char *body, struct host_http_resp *resp)
+{
+	httpd_req_t req;
+	struct aux a;
+	httpd_uri_t *h;
+	int ret = -1;
+
+	req_init(&req, &a, method, uri, resp);
+	if (hdrs) a.hdrs = hdrs;
+	if (body) a.body = body;
+	a.body_len      = strlen(a.body);
+	req.content_len = a.body_len;
+
+	pthread_mutex_lock(&mtx);
+	if (!server.running) {
+		pthread_mutex_unlock(&mtx);
+		return -1;
+	}
+
+	handling = 1;
+	if ((h = find(method, uri)) && !h->is_websocket) {
+		req.user_ctx = h->user_ctx;
+		ret = h->handler(&req);
+	} else {
+		a.status = HTTPD_404;
+		httpd_resp_send(&req, NULL, 0);
+	}
+
+	handling = 0;
+	unlock();
+	return ret;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *r)
+{
+	return ((struct aux *)r->aux)->fd;
+}
+
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t fn,
+                           void *arg)
+{
+	if (handle != &server || !server.running)
+		return ESP_FAIL;
+
+	pthread_mutex_lock(&work_mtx);
+	if (nwork == MAX_WORK) {
+		pthread_mutex_unlock(&work_mtx);
+		return ESP_FAIL;
+	}
+
+	work[nwork++] = (struct work){ fn, arg };
+	pthread_mutex_unlock(&work_mtx);
+
+	/* Run it now, unless a request is being handled */
+	if (!handling && !pthread_mutex_trylock(&mtx))
+		unlock();
+	return ESP_OK;
+}
+
+static struct ws *ws_find(int fd)
+{
+	if (fd < WS_FD || fd >= WS_FD + MAX_SOCKETS ||
+	    !server.ws[fd - WS_FD].open)
+		return NULL;
+	return &server.ws[fd - WS_FD];
+}
+
+esp_err_t httpd_ws_recv_frame(httpd_req_t *r, httpd_ws_frame_t *frame,
+                              size_t max_len)
+{
+	struct aux *a = r->aux;
+	size_t len;
+
+	if (!a->frame)
+		return ESP_ERR_INVALID_STATE;
+
+	len          = strlen(a->frame);
+	frame->type  = HTTPD_WS_TYPE_TEXT;
+	frame->final = true;
+	frame->len   = len;
+	if (!max_len)
+		return ESP_OK;
+
+	if (len > max_len)
+		return ESP_ERR_INVALID_SIZE;
+	memcpy(frame->payload, a->frame, len);
+	return ESP_OK;
+}
+
+esp_err_t httpd_ws_send_frame_async(httpd_handle_t hd, int fd,
+                                    httpd_ws_frame_t *frame)
+{
+	struct ws *ws;
+	size_t n;
+
+	pthread_mutex_lock(&mtx);
+	if (hd != &server || !(ws = ws_find(fd))) {
+		pthread_mutex_unlock(&mtx);
+		return ESP_FAIL;
+	}
+
+	n = frame->len < sizeof(ws->last) - 1 ? frame->len
+	                                      : sizeof(ws->last) - 1;
+	memcpy(ws->last, frame->payload, n);
+	ws->last[n] = '\0';
+	ws->frames++;
+	pthread_mutex_unlock(&mtx);
+	return ESP_OK;
+}
+
+esp_err_t httpd_ws_send_frame(httpd_req_t *r, httpd_ws_frame_t *frame)
+{
+	return httpd_ws_send_frame_async(r->handle, httpd_req_to_sockfd(r),
+	                                 frame);
+}
+
+httpd_ws_client_info_t httpd_ws_get_fd_info(httpd_handle_t hd, int fd)
+{
+	httpd_ws_client_info_t ret = HTTPD_WS_CLIENT_INVALID;
+
+	pthread_mutex_lock(&mtx);
+	if (hd == &server && server.running) {
+		if (ws_find(fd))
+			ret = HTTPD_WS_CLIENT_WEBSOCKET;
+		else if (fd == HTTP_FD)
+			ret = HTTPD_WS_CLIENT_HTTP;
+	}
+	pthread_mutex_unlock(&mtx);
+	return ret;
+}
+
+int host_ws_open(const char *uri)
+{
+	struct host_http_resp resp;
+	httpd_req_t req;
+	struct aux a;
+	httpd_uri_t *h;
+	unsigned int i;
+	int fd = -1;
+
+	req_init(&req, &a, HTTP_GET, uri, &resp);
+	pthread_mutex_lock(&mtx);
+	for (i = 0; i < MAX_SOCKETS && server.ws[i].open; i++);
+	if (server.running && i < MAX_SOCKETS &&
+	    (h = find(HTTP_GET, uri)) && h->is_websocket) {
+		memset(&server.ws[i], 0, sizeof(server.ws[i]));
+		server.ws[i].open = 1;
+		server.ws[i].uri  = h;
+		a.fd         = WS_FD + (int)i;
+		req.user_ctx = h->user_ctx;
+
+		handling = 1;
+		if (h->handler(&req) == ESP_OK) fd = a.fd;
+		else server.ws[i].open = 0;
+		handling = 0;
+	}
+	unlock();
+	return fd;
+}
+
+void host_ws_close(int fd)
+{
+	struct ws *ws;
+
+	pthread_mutex_lock(&mtx);
+	if ((ws = ws_find(fd)))
+		ws->open = 0;
+	pthread_mutex_unlock(&mtx);
+}
+
+int host_ws_send(int fd, const char *text)
+{
+	struct host_http_resp resp;
+	httpd_req_t req;
+	struct aux a;
+	struct ws *ws;
+	int ret = -1;
+
+	pthread_mutex_lock(&mtx);
+	if ((ws = ws_find(fd))) {
+		req_init(&req, &a, 0, ws->uri->uri, &resp);
+		a.fd         = fd;
+		a.frame      = text;
+		req.user_ctx = ws->uri->user_ctx;
+		handling = 1;
+		if ((ret = ws->uri->handler(&req)) != ESP_OK)
+			ws->open = 0;
+		handling = 0;
+	}
+	unlock();
+	return ret;
+}
+
+unsigned int host_ws_frames(int fd, char *last, size_t len)
+{
+	unsigned int n = 0;
+	struct ws *ws;
+
+	pthread_mutex_lock(&mtx);
+	if (fd >= WS_FD && fd < WS_FD + MAX_SOCKETS) {
+		ws = &server.ws[fd - WS_FD];
+		n  = ws->frames;
+		if (last && len) snprintf(last, len, "%s", ws->last);
+	}
+	pthread_mutex_unlock(&mtx);
+	return n;
+}
@@ -0,0 +1,248 @@
+
+#include <stdint.h>
+
+#include <driver/gpio.h>
+#include <driver/ledc.h>
+
+#include "host.h"
+
+/**
+ * LEDC model: One timer, whose duty updates and fades take when it's
+ * next running, and low-speed channels which fade linearly on the host
+ * clock.
+ *
+ * As in esp-idf, a fade started without waiting holds the channel's
+ * fade lock until it ends, and setting the duty or a fade takes it:
+ * That waits out the fade, which never ends while the timer's paused.
+ * Each such call is counted, and the clock's advanced to the end of
+ * the fade, if it can end. ledc_fade_stop() lets it go right away, at
+ * the duty it got to, but also needs the timer running.
+ */
+static struct chan {
+	int gpio;         /**< Routed pin, or -1          */
+	uint32_t from;    /**< Duty the fade started at   */
+	uint32_t to;      /**< Duty it ends at            */
+	int64_t t0;       /**< Fade started               */
+	int64_t t1;       /**< Fade done                  */
+	uint32_t duty;    /**< Staged duty                */
+	int64_t ms;       /**< Staged fade time, in ms    */
+	int pending;      /**< Staged, waiting on timer   */
+	int fading;       /**< Holds the fade lock        */
+} chans[LEDC_CHANNEL_MAX] = {
+	[0 ... LEDC_CHANNEL_MAX - 1] = { .gpio = -1 }
+};
+
+static unsigned int res;
+static int paused, faders;
+static uint64_t blocked;
+
+static uint32_t now_duty(const struct chan *c, int64_t t)
+{
+	if (t >= c->t1)
+		return c->to;
+	if (t <= c->t0)
+		return c->from;
+
+	return (uint32_t)((int64_t)c->from + ((int64_t)c->to -
+	                  (int64_t)c->from) * (t - c->t0) / (c->t1 - c->t0));
+}
+
+static void take(struct chan *c, int64_t t)
+{
+	c->from    = now_duty(c, t);
+	c->to      = c->duty;
+	c->t0      = t;
+	c->t1      = t + (c->ms > 0 ? c->ms * 1000 : 0);
+	c->pending = 0;
+}
+
+static int bad(ledc_mode_t mode, ledc_channel_t ch)
+{
+	return mode != LEDC_LOW_SPEED_MODE || ch < 0 || ch >= LEDC_CHANNEL_MAX;
+}
+
+/**
+ * Take the fade lock, waiting for the fade to end if there's one
+ * running. Returns 0 if that would be for ever.
+ */
+static int lock(struct chan *c)
+{
+	int64_t t = host_clock();
+
+	if (!c->fading || t >= c->t1) {
+		c->fading = 0;
+		return 1;
+	}
+
+	blocked++;
+	if (paused)
+		return 0;
+
+	host_clock_advance(c->t1 - t);
+	c->fading = 0;
+	return 1;
+}
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *conf)
+{
+	if (conf->speed_mode != LEDC_LOW_SPEED_MODE ||
+	    conf->duty_resolution < 1 || conf->duty_resolution > 20)
+		return ESP_ERR_INVALID_ARG;
+
+	res = (unsigned int)conf->duty_resolution;
+	return ESP_OK;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *conf)
+{
+	struct chan *c;
+
+	if (!res || bad(conf->speed_mode, conf->channel) ||
+	    conf->gpio_num < 0 || conf->gpio_num >= GPIO_NUM_MAX)
+		return ESP_ERR_INVALID_ARG;
+
+	c       = &chans[conf->channel];
+	c->gpio = conf->gpio_num;
+	c->from = c->to = c->duty = conf->duty;
+	c->t0   = c->t1 = host_clock();
+	return gpio_set_direction(conf->gpio_num, GPIO_MODE_OUTPUT);
+}
+
+esp_err_t ledc_timer_pause(ledc_mode_t mode, ledc_timer_t timer)
+{
+	if (mode != LEDC_LOW_SPEED_MODE || timer != LEDC_TIMER_0)
+		return ESP_ERR_INVALID_ARG;
+
+	paused = 1;
+	return ESP_OK;
+}
+
+esp_err_t ledc_timer_resume(ledc_mode_t mode, ledc_timer_t timer)
+{
+	int64_t t = host_clock();
+	unsigned int i;
+
+	if (mode != LEDC_LOW_SPEED_MODE || timer != LEDC_TIMER_0)
+		return ESP_ERR_INVALID_ARG;
+
+	paused = 0;
+	for (i = 0; i < LEDC_CHANNEL_MAX; i++) {
+		if (chans[i].pending)
+			take(&chans[i], t);
+	}
+
+	return ESP_OK;
+}
+
+esp_err_t ledc_set_duty(ledc_mode_t mode, ledc_channel_t ch, uint32_t duty)
+{
+	if (bad(mode, ch) || duty > 1U << res)
+		return ESP_ERR_INVALID_ARG;
+	if (!lock(&chans[ch]))
+		return ESP_ERR_TIMEOUT;
+
+	chans[ch].duty = duty;
+	chans[ch].ms   = 0;
+	return ESP_OK;
+}
+
+esp_err_t ledc_update_duty(ledc_mode_t mode, ledc_channel_t ch)
+{
+	if (bad(mode, ch))
+		return ESP_ERR_INVALID_ARG;
+
+	chans[ch].pending = 1;
+	if (!paused) take(&chans[ch], host_clock());
+	return ESP_OK;
+}
+
+uint32_t ledc_get_duty(ledc_mode_t mode, ledc_channel_t ch)
+{
+	return bad(mode, ch) ? 0 : now_duty(&chans[ch], host_clock());
+}
+
+esp_err_t ledc_set_fade_with_time(ledc_mode_t mode, ledc_channel_t ch,
+                                  uint32_t duty, int ms)
+{
+	if (!faders)
+		return ESP_ERR_INVALID_STATE;
+	if (bad(mode, ch) || duty > 1U << res || ms < 0)
+		return ESP_ERR_INVALID_ARG;
+	if (!lock(&chans[ch]))
+		return ESP_ERR_TIMEOUT;
+
+	chans[ch].duty = duty;
+	chans[ch].ms   = ms;
+	return ESP_OK;
+}
+
+esp_err_t ledc_fade_start(ledc_mode_t mode, ledc_channel_t ch,
+                          ledc_fade_mode_t fade)
+{
+	if (!faders)
+		return ESP_ERR_INVALID_STATE;
+	if (bad(mode, ch) || fade != LEDC_FADE_NO_WAIT)
+		return ESP_ERR_INVALID_ARG;
+
+	chans[ch].fading = chans[ch].ms > 0;
+	return ledc_update_duty(mode, ch);
+}
+
+esp_err_t ledc_fade_stop(ledc_mode_t mode, ledc_channel_t ch)
+{
+	struct chan *c;
+	int64_t t = host_clock();
+
+	if (!faders)
+		return ESP_ERR_INVALID_STATE;
+	if (bad(mode, ch))
+		return ESP_ERR_INVALID_ARG;
+
+	/* It only stops on the timer's next cycle */
+	c = &chans[ch];
+	if (c->fading && t < c->t1 && paused) {
+		blocked++;
+		return ESP_ERR_TIMEOUT;
+	}
+
+	c->from    = c->to = c->duty = now_duty(c, t);
+	c->t0      = c->t1 = t;
+	c->fading  = 0;
+	c->pending = 0;
+	return ESP_OK;
+}
+
+esp_err_t ledc_fade_func_install(int flags)
+{
+	(void)flags;
+	faders = 1;
+	return ESP_OK;
+}
+
+uint32_t host_ledc_duty(int ch)
+{
+	return ch < 0 || ch >= LEDC_CHANNEL_MAX ? 0 :
+	       now_duty(&chans[ch], host_clock());
+}
+
+uint64_t host_ledc_blocked(void)
+{
+	return blocked;
+}
+
+int64_t host_ledc_started(int ch)
+{
+	return ch < 0 || ch >= LEDC_CHANNEL_MAX ? 0 : chans[ch].t0;
+}
+
+int host_ledc_pin(int pin)
+{
+	unsigned int i;
+
+	for (i = 0; i < LEDC_CHANNEL_MAX; i++) {
+		if (chans[i].gpio == pin)
+			return host_ledc_duty((int)i) > 0;
+	}
+
+	return -1;
+}
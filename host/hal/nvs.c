@@ -0,0 +1,145 @@
+
+#include <string.h>
+#include <pthread.h>
+
+#include <nvs_flash.h>
+
+/**
+ * NVS: Blobs kept in memory, by namespace and key. Handles are the
+ * index of the namespace, plus one, with the high bit set if they're
+ * writable.
+ */
+#define MAX_NS      4
+#define MAX_ENTRIES 32
+#define MAX_BLOB    512
+#define WRITABLE    0x80000000U
+
+static char names[MAX_NS][16];
+static struct {
+	unsigned int ns;
+	char key[16];
+	size_t len;
+	unsigned char data[MAX_BLOB];
+} entries[MAX_ENTRIES];
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int initialized;
+
+esp_err_t nvs_flash_init(void)
+{
+	initialized = 1;
+	return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+	pthread_mutex_lock(&lock);
+	memset(names, 0, sizeof(names));
+	memset(entries, 0, sizeof(entries));
+	pthread_mutex_unlock(&lock);
+	return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *ns, nvs_open_mode_t mode, nvs_handle_t *h)
+{
+	unsigned int i;
+	esp_err_t ret = ESP_ERR_NVS_NOT_FOUND;
+
+	if (!initialized)
+		return ESP_ERR_NVS_NOT_INITIALIZED;
+
+	pthread_mutex_lock(&lock);
+	for (i = 0; i < MAX_NS && names[i][0] && strcmp(names[i], ns); i++);
+	if (i < MAX_NS && (names[i][0] || mode == NVS_READWRITE)) {
+		strncpy(names[i], ns, sizeof(names[i]) - 1);
+		*h  = (i + 1) | (mode == NVS_READWRITE ? WRITABLE : 0);
+		ret = ESP_OK;
+	}
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+static int find(nvs_handle_t h, const char *key)
+{
+	unsigned int i;
+
+	for (i = 0; i < MAX_ENTRIES; i++) {
+		if (entries[i].ns == (h & ~WRITABLE) &&
+		    !strcmp(entries[i].key, key))
+			return (int)i;
+	}
+
+	return -1;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t h, const char *key, void *out,
+                       size_t *len)
+{
+	esp_err_t ret = ESP_ERR_NVS_NOT_FOUND;
+	int i;
+
+	pthread_mutex_lock(&lock);
+	if ((i = find(h, key)) >= 0) {
+		ret = ESP_OK;
+		if (out && *len < entries[i].len)
+			ret = ESP_ERR_NVS_INVALID_LENGTH;
+		else if (out)
+			memcpy(out, entries[i].data, entries[i].len);
+		*len = entries[i].len;
+	}
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t h, const char *key, const void *v,
+                       size_t len)
+{
+	esp_err_t ret = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+	int i;
+
+	if (!(h & WRITABLE))
+		return ESP_ERR_NVS_READ_ONLY;
+	if (len > MAX_BLOB)
+		return ESP_ERR_NVS_INVALID_LENGTH;
+
+	pthread_mutex_lock(&lock);
+	if ((i = find(h, key)) < 0)
+		i = find(0, "");
+
+	if (i >= 0) {
+		entries[i].ns = h & ~WRITABLE;
+		strncpy(entries[i].key, key, sizeof(entries[i].key) - 1);
+		memcpy(entries[i].data, v, len);
+		entries[i].len = len;
+		ret = ESP_OK;
+	}
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t h, const char *key)
+{
+	esp_err_t ret = ESP_ERR_NVS_NOT_FOUND;
+	int i;
+
+	if (!(h & WRITABLE))
+		return ESP_ERR_NVS_READ_ONLY;
+
+	pthread_mutex_lock(&lock);
+	if ((i = find(h, key)) >= 0) {
+		memset(&entries[i], 0, sizeof(entries[i]));
+		ret = ESP_OK;
+	}
+	pthread_mutex_unlock(&lock);
+	return ret;
+}
+
+esp_err_t nvs_commit(nvs_handle_t h)
+{
+	return h & ~WRITABLE ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+void nvs_close(nvs_handle_t h)
+{
+	(void)h;
+}
@@ -0,0 +1,81 @@
+
+#include <stdint.h>
+
+#include <esp_sleep.h>
+
+#include "host.h"
+
+static uint64_t timer_us;
+static int gpio_wake;
+static esp_sleep_wakeup_cause_t cause;
+static unsigned int sleeps;
+
+static struct {
+	int pin;
+	int level;
+	int64_t at;
+	int pending;
+} input;
+
+esp_err_t esp_sleep_pd_config(esp_sleep_pd_domain_t domain,
+                              esp_sleep_pd_option_t option)
+{
+	(void)option;
+	return domain < ESP_PD_DOMAIN_MAX ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t us)
+{
+	timer_us = us;
+	return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_gpio_wakeup(void)
+{
+	gpio_wake = 1;
+	return ESP_OK;
+}
+
+void host_sleep_input(int pin, int level, int64_t at)
+{
+	input.pin     = pin;
+	input.level   = level;
+	input.at      = at;
+	input.pending = 1;
+}
+
+unsigned int host_sleeps(void)
+{
+	return sleeps;
+}
+
+/**
+ * Nothing runs while asleep: The timers that come due are run by
+ * whoever runs them next, as they would be on waking.
+ */
+esp_err_t esp_light_sleep_start(void)
+{
+	int64_t wake = host_clock() + (int64_t)timer_us;
+
+	++sleeps;
+	cause = ESP_SLEEP_WAKEUP_TIMER;
+	if (input.pending && input.at < wake) {
+		input.pending = 0;
+		if (input.at > host_clock())
+			host_clock_advance(input.at - host_clock());
+
+		host_gpio_input(input.pin, input.level);
+		if (gpio_wake && host_gpio_wakes(input.pin, input.level)) {
+			cause = ESP_SLEEP_WAKEUP_GPIO;
+			return ESP_OK;
+		}
+	}
+
+	host_clock_advance(wake - host_clock());
+	return ESP_OK;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void)
+{
+	return cause;
+}
@@ -0,0 +1,171 @@
+
+#include <stdint.h>
+#include <string.h>
+
+#include <driver/spi_master.h>
+
+#include "host.h"
+
+/**
+ * SPI master model, with the DS1302 model as the only thing on the bus
+ *
+ * Transactions are clocked out edge by edge, in mode 0, with the clock
+ * advancing half an SCLK period between them: Each bit is put out as
+ * SCLK falls, and read bits are sampled as it rises. CS is held for the
+ * setup and hold periods around them. In 3-wire mode, MOSI is let go of
+ * as SCLK falls after the last bit out, when there's a read phase, and
+ * bits are read from it from then on.
+ */
+struct spi_device_t {
+	spi_device_interface_config_t conf;
+};
+
+static struct {
+	spi_bus_config_t conf;
+	int up;             /**< Bus initialized            */
+	int fail;           /**< Fail whatever comes next   */
+	uint64_t bits;      /**< Bits clocked, in all       */
+	struct spi_device_t dev;
+	int added;
+} bus;
+
+void host_spi_fail(int fail)
+{
+	bus.fail = fail;
+}
+
+uint64_t host_spi_bits(void)
+{
+	return bus.bits;
+}
+
+static void pin(int pin, int level)
+{
+	if (pin >= 0) ds1302_pin(&host_ds1302, pin, level);
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host,
+                             const spi_bus_config_t *conf, int dma_chan)
+{
+	if (host == SPI1_HOST || host >= SPI_HOST_MAX || dma_chan)
+		return ESP_ERR_INVALID_ARG;
+	if (bus.fail || bus.up)
+		return ESP_ERR_INVALID_STATE;
+
+	bus.conf = *conf;
+	bus.up   = 1;
+	pin(conf->sclk_io_num, 0);
+	return ESP_OK;
+}
+
+esp_err_t spi_bus_free(spi_host_device_t host)
+{
+	(void)host;
+	if (!bus.up || bus.added)
+		return ESP_ERR_INVALID_STATE;
+
+	bus.up = 0;
+	return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host,
+                             const spi_device_interface_config_t *conf,
+                             spi_device_handle_t *handle)
+{
+	(void)host;
+	if (!bus.up || bus.added || bus.fail)
+		return ESP_ERR_INVALID_STATE;
+	if (conf->mode || conf->clock_speed_hz <= 0 ||
+	    conf->cs_ena_pretrans > 16 || conf->cs_ena_posttrans > 16)
+		return ESP_ERR_NOT_SUPPORTED;
+
+	bus.dev.conf = *conf;
+	bus.added    = 1;
+	*handle      = &bus.dev;
+	pin(conf->spics_io_num, !(conf->flags & SPI_DEVICE_POSITIVE_CS));
+	return ESP_OK;
+}
+
+esp_err_t spi_bus_remove_device(spi_device_handle_t handle)
+{
+	if (!bus.added || handle != &bus.dev)
+		return ESP_ERR_INVALID_STATE;
+
+	bus.added = 0;
+	return ESP_OK;
+}
+
+/**
+ * Half an SCLK period, in ns
+ */
+static int64_t half(const spi_device_interface_config_t *c)
+{
+	return (500000000 + c->clock_speed_hz - 1) / c->clock_speed_hz;
+}
+
+static void clock_out(const spi_device_interface_config_t *c,
+                      const uint8_t *buf, size_t bits, int release)
+{
+	size_t i;
+	int b;
+
+	for (i = 0; i < bits; i++) {
+		b = c->flags & SPI_DEVICE_TXBIT_LSBFIRST ? i % 8 : 7 - i % 8;
+		pin(bus.conf.mosi_io_num, (buf[i / 8] >> b) & 1);
+		host_clock_advance_ns(half(c));
+		pin(bus.conf.sclk_io_num, 1);
+		host_clock_advance_ns(half(c));
+		if (release && i == bits - 1)
+			ds1302_drive(&host_ds1302, 0);
+		pin(bus.conf.sclk_io_num, 0);
+	}
+}
+
+static void clock_in(const spi_device_interface_config_t *c, uint8_t *buf,
+                     size_t bits)
+{
+	size_t i;
+	int b;
+
+	memset(buf, 0, (bits + 7) / 8);
+	for (i = 0; i < bits; i++) {
+		b = c->flags & SPI_DEVICE_RXBIT_LSBFIRST ? i % 8 : 7 - i % 8;
+		host_clock_advance_ns(half(c));
+		buf[i / 8] |= (uint8_t)(ds1302_sda(&host_ds1302) << b);
+		pin(bus.conf.sclk_io_num, 1);
+		host_clock_advance_ns(half(c));
+		pin(bus.conf.sclk_io_num, 0);
+	}
+}
+
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle,
+                                      spi_transaction_t *t)
+{
+	const spi_device_interface_config_t *c = &handle->conf;
+	int cs = !!(c->flags & SPI_DEVICE_POSITIVE_CS);
+
+	if (!bus.added || handle != &bus.dev)
+		return ESP_ERR_INVALID_STATE;
+	if (bus.fail)
+		return ESP_ERR_TIMEOUT;
+	if (t->length && t->rxlength && !(c->flags & SPI_DEVICE_HALFDUPLEX))
+		return ESP_ERR_INVALID_ARG;
+	if (t->rxlength && !(c->flags & SPI_DEVICE_3WIRE) &&
+	    bus.conf.miso_io_num < 0)
+		return ESP_ERR_INVALID_ARG;
+	if (t->length + t->rxlength > 64 * 8)
+		return ESP_ERR_INVALID_SIZE;
+
+	pin(c->spics_io_num, cs);
+	if (t->length) ds1302_drive(&host_ds1302, 1);
+	host_clock_advance_ns(2 * half(c) * c->cs_ena_pretrans);
+	clock_out(c, t->tx_buffer, t->length, t->rxlength != 0);
+	if (t->rxlength)
+		clock_in(c, t->rx_buffer, t->rxlength);
+	host_clock_advance_ns(2 * half(c) * c->cs_ena_posttrans);
+	pin(c->spics_io_num, !cs);
+	ds1302_drive(&host_ds1302, 0);
+
+	bus.bits += t->length + t->rxlength;
+	return ESP_OK;
+}
@@ -0,0 +1,252 @@
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_sntp.h>
+#include <mdns.h>
+
+#include "host.h"
+
+/**
+ * Wall clock: The simulated monotonic clock plus an offset that the
+ * firmware sets via settimeofday(), and whatever adjtime() has slewed
+ * it by so far. As in esp-idf, a slew runs at 1/64 of the clock's rate.
+ */
+static _Atomic int64_t epoch_us;
+static pthread_mutex_t slew_mtx = PTHREAD_MUTEX_INITIALIZER;
+static int64_t slew_us;         /**< Correction to make        */
+static int64_t slew_at;         /**< Started                   */
+
+static int64_t slewed(int64_t now)
+{
+	int64_t us = (now - slew_at) >> 6;
+
+	if (us >= llabs(slew_us))
+		return slew_us;
+	return slew_us < 0 ? -us : us;
+}
+
+static int64_t wall(void)
+{
+	int64_t now;
+
+	pthread_mutex_lock(&slew_mtx);
+	now = host_clock();
+	now += epoch_us + slewed(now);
+	pthread_mutex_unlock(&slew_mtx);
+	return now;
+}
+
+time_t host_time(time_t *t)
+{
+	time_t now = (time_t)(wall() / 1000000);
+
+	if (t) *t = now;
+	return now;
+}
+
+int host_gettimeofday(struct timeval *tv, void *tz)
+{
+	int64_t now = wall();
+	(void)tz;
+
+	tv->tv_sec  = (time_t)(now / 1000000);
+	tv->tv_usec = (suseconds_t)(now % 1000000);
+	return 0;
+}
+
+int host_settimeofday(const struct timeval *tv, const void *tz)
+{
+	(void)tz;
+
+	if (tv) {
+		pthread_mutex_lock(&slew_mtx);
+		epoch_us = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec -
+		           host_clock();
+		slew_us  = 0;
+		pthread_mutex_unlock(&slew_mtx);
+	}
+
+	return 0;
+}
+
+int host_adjtime(const struct timeval *delta, struct timeval *old)
+{
+	int64_t now, left;
+
+	pthread_mutex_lock(&slew_mtx);
+	now       = host_clock();
+	left      = slew_us - slewed(now);
+	epoch_us += slewed(now);
+	slew_us   = delta ? (int64_t)delta->tv_sec * 1000000 +
+	                    delta->tv_usec : left;
+	slew_at   = now;
+	pthread_mutex_unlock(&slew_mtx);
+	if (old) {
+		old->tv_sec  = (time_t)(left / 1000000);
+		old->tv_usec = (suseconds_t)(left % 1000000);
+	}
+
+	return 0;
+}
+
+/**
+ * Random numbers, seeded from the real clock so each run differs
+ */
+static pthread_mutex_t rnd_mtx = PTHREAD_MUTEX_INITIALIZER;
+static unsigned short xsubi[3];
+static int seeded;
+
+uint32_t esp_random(void)
+{
+	struct timespec ts;
+	uint32_t r;
+
+	pthread_mutex_lock(&rnd_mtx);
+	if (!seeded++) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		xsubi[0] = (unsigned short)ts.tv_nsec;
+		xsubi[1] = (unsigned short)(ts.tv_nsec >> 16);
+		xsubi[2] = (unsigned short)getpid();
+	}
+
+	r = (uint32_t)jrand48(xsubi);
+	pthread_mutex_unlock(&rnd_mtx);
+	return r;
+}
+
+/**
+ * Logging: Quiet unless LIGHTCTL_LOG is set in the environment
+ */
+static esp_log_level_t log_level = ESP_LOG_NONE;
+static pthread_once_t log_once   = PTHREAD_ONCE_INIT;
+
+static void log_init(void)
+{
+	const char *s = getenv("LIGHTCTL_LOG");
+
+	if (s) log_level = (esp_log_level_t)atoi(s);
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+	(void)tag;
+	pthread_once(&log_once, log_init);
+	log_level = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag,
+                   const char *fmt, ...)
+{
+	va_list ap;
+
+	pthread_once(&log_once, log_init);
+	if (level > log_level)
+		return;
+
+	(void)tag;
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+uint32_t esp_log_timestamp(void)
+{
+	return (uint32_t)(host_clock() / 1000);
+}
+
+/**
+ * SNTP
+ */
+static sntp_sync_time_cb_t sync_cb;
+static uint32_t sync_interval = 3600000;
+static int sntp_running;
+
+void sntp_setoperatingmode(uint8_t mode) { (void)mode; }
+void sntp_setservername(uint8_t i, const char *s) { (void)i; (void)s; }
+void sntp_set_sync_mode(sntp_sync_mode_t mode) { (void)mode; }
+void sntp_set_sync_interval(uint32_t ms) { sync_interval = ms; }
+uint32_t sntp_get_sync_interval(void) { return sync_interval; }
+void sntp_init(void) { sntp_running = 1; }
+void sntp_stop(void) { sntp_running = 0; }
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t cb)
+{
+	sync_cb = cb;
+}
+
+bool sntp_restart(void)
+{
+	if (sntp_running)
+		return true;
+
+	return false;
+}
+
+__attribute__((weak)) void sntp_sync_time(struct timeval *tv)
+{
+	host_settimeofday(tv, NULL);
+	if (sync_cb) sync_cb(tv);
+}
+
+void host_sntp_sync(const struct timeval *tv)
+{
+	struct timeval t = *tv;
+
+	sntp_sync_time(&t);
+}
+
+/**
+ * mDNS and Wi-Fi aren't modelled
+ */
+esp_err_t mdns_init(void) { return ESP_OK; }
+
+esp_err_t mdns_hostname_set(const char *hostname)
+{
+	(void)hostname;
+	return ESP_OK;
+}
+
+esp_err_t mdns_service_add(const char *instance, const char *service,
+                           const char *proto, uint16_t port,
+                           mdns_txt_item_t txt[], size_t n)
+{
+	(void)instance; (void)service; (void)proto;
+	(void)port; (void)txt; (void)n;
+	return ESP_OK;
+}
+
+/**
+ * WiFi: Only whether the station is started is kept; Whoever cares
+ * posts CONNECTED and LOSTCONN themselves.
+ */
+static int wifi_started;
+
+void wifi_init(void)
+{
+	wifi_started = 1;
+}
+
+void wifi_start(void)
+{
+	wifi_started = 1;
+}
+
+void wifi_stop(void)
+{
+	wifi_started = 0;
+}
+
+int host_wifi(void)
+{
+	return wifi_started;
+}
@@ -0,0 +1,76 @@
+#ifndef LIGHTCTL_HOST_DRIVER_GPIO_H
+#define LIGHTCTL_HOST_DRIVER_GPIO_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_attr.h"
+
+#define GPIO_NUM_MAX 40
+
+typedef int gpio_num_t;
+
+typedef enum {
+	GPIO_MODE_DISABLE = 0,
+	GPIO_MODE_INPUT   = 1,
+	GPIO_MODE_OUTPUT  = 2,
+} gpio_mode_t;
+
+typedef enum {
+	GPIO_INTR_DISABLE    = 0,
+	GPIO_INTR_POSEDGE    = 1,
+	GPIO_INTR_NEGEDGE    = 2,
+	GPIO_INTR_ANYEDGE    = 3,
+	GPIO_INTR_LOW_LEVEL  = 4,
+	GPIO_INTR_HIGH_LEVEL = 5,
+} gpio_int_type_t;
+
+#define GPIO_PIN_INTR_DISABLE GPIO_INTR_DISABLE
+#define GPIO_PIN_INTR_POSEDGE GPIO_INTR_POSEDGE
+#define GPIO_PIN_INTR_NEGEDGE GPIO_INTR_NEGEDGE
+#define GPIO_PIN_INTR_ANYEDGE GPIO_INTR_ANYEDGE
+#define GPIO_PIN_INTR_LOLEVEL GPIO_INTR_LOW_LEVEL
+#define GPIO_PIN_INTR_HILEVEL GPIO_INTR_HIGH_LEVEL
+
+typedef enum {
+	GPIO_PULLUP_DISABLE = 0,
+	GPIO_PULLUP_ENABLE  = 1
+} gpio_pullup_t;
+
+typedef enum {
+	GPIO_PULLDOWN_DISABLE = 0,
+	GPIO_PULLDOWN_ENABLE  = 1
+} gpio_pulldown_t;
+
+typedef enum {
+	GPIO_DRIVE_CAP_0,
+	GPIO_DRIVE_CAP_1,
+	GPIO_DRIVE_CAP_2,
+	GPIO_DRIVE_CAP_3,
+	GPIO_DRIVE_CAP_DEFAULT = GPIO_DRIVE_CAP_2
+} gpio_drive_cap_t;
+
+typedef struct {
+	uint64_t pin_bit_mask;
+	gpio_mode_t mode;
+	gpio_pullup_t pull_up_en;
+	gpio_pulldown_t pull_down_en;
+	gpio_int_type_t intr_type;
+} gpio_config_t;
+
+typedef void (*gpio_isr_t)(void *);
+
+esp_err_t gpio_config(const gpio_config_t *conf);
+esp_err_t gpio_set_level(gpio_num_t pin, uint32_t level);
+int gpio_get_level(gpio_num_t pin);
+esp_err_t gpio_set_direction(gpio_num_t pin, gpio_mode_t mode);
+esp_err_t gpio_set_drive_capability(gpio_num_t pin, gpio_drive_cap_t cap);
+esp_err_t gpio_install_isr_service(int flags);
+esp_err_t gpio_isr_handler_add(gpio_num_t pin, gpio_isr_t isr, void *arg);
+esp_err_t gpio_set_intr_type(gpio_num_t pin, gpio_int_type_t type);
+esp_err_t gpio_wakeup_enable(gpio_num_t pin, gpio_int_type_t type);
+esp_err_t gpio_wakeup_disable(gpio_num_t pin);
+esp_err_t gpio_hold_en(gpio_num_t pin);
+esp_err_t gpio_hold_dis(gpio_num_t pin);
+
+#endif /* LIGHTCTL_HOST_DRIVER_GPIO_H */
@@ -0,0 +1,78 @@
+#ifndef LIGHTCTL_HOST_DRIVER_SPI_MASTER_H
+#define LIGHTCTL_HOST_DRIVER_SPI_MASTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef enum {
+	SPI1_HOST,
+	SPI2_HOST,
+	SPI3_HOST,
+	SPI_HOST_MAX
+} spi_host_device_t;
+
+#define HSPI_HOST SPI2_HOST
+#define VSPI_HOST SPI3_HOST
+
+#define SPI_DEVICE_TXBIT_LSBFIRST (1U << 0)
+#define SPI_DEVICE_RXBIT_LSBFIRST (1U << 1)
+#define SPI_DEVICE_BIT_LSBFIRST   (SPI_DEVICE_TXBIT_LSBFIRST | \
+                                   SPI_DEVICE_RXBIT_LSBFIRST)
+#define SPI_DEVICE_3WIRE          (1U << 2)
+#define SPI_DEVICE_POSITIVE_CS    (1U << 3)
+#define SPI_DEVICE_HALFDUPLEX     (1U << 4)
+
+typedef struct {
+	int mosi_io_num;
+	int miso_io_num;
+	int sclk_io_num;
+	int quadwp_io_num;
+	int quadhd_io_num;
+	int max_transfer_sz;
+	uint32_t flags;
+	int intr_flags;
+} spi_bus_config_t;
+
+typedef struct {
+	uint8_t command_bits;
+	uint8_t address_bits;
+	uint8_t dummy_bits;
+	uint8_t mode;
+	uint16_t duty_cycle_pos;
+	uint16_t cs_ena_pretrans;
+	uint8_t cs_ena_posttrans;
+	int clock_speed_hz;
+	int input_delay_ns;
+	int spics_io_num;
+	uint32_t flags;
+	int queue_size;
+	void *pre_cb;
+	void *post_cb;
+} spi_device_interface_config_t;
+
+typedef struct {
+	uint32_t flags;
+	uint16_t cmd;
+	uint64_t addr;
+	size_t length;
+	size_t rxlength;
+	void *user;
+	const void *tx_buffer;
+	void *rx_buffer;
+} spi_transaction_t;
+
+typedef struct spi_device_t *spi_device_handle_t;
+
+esp_err_t spi_bus_initialize(spi_host_device_t host,
+                             const spi_bus_config_t *conf, int dma_chan);
+esp_err_t spi_bus_free(spi_host_device_t host);
+esp_err_t spi_bus_add_device(spi_host_device_t host,
+                             const spi_device_interface_config_t *conf,
+                             spi_device_handle_t *handle);
+esp_err_t spi_bus_remove_device(spi_device_handle_t handle);
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle,
+                                      spi_transaction_t *t);
+
+#endif /* LIGHTCTL_HOST_DRIVER_SPI_MASTER_H */
@@ -0,0 +1,9 @@
+#ifndef LIGHTCTL_HOST_ESP_ATTR_H
+#define LIGHTCTL_HOST_ESP_ATTR_H
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+
+#endif /* LIGHTCTL_HOST_ESP_ATTR_H */
@@ -0,0 +1,161 @@
+#ifndef LIGHTCTL_HOST_ESP_HTTP_SERVER_H
+#define LIGHTCTL_HOST_ESP_HTTP_SERVER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "esp_err.h"
+
+#define HTTPD_MAX_URI_LEN 512
+
+#define HTTPD_200 "200 OK"
+#define HTTPD_204 "204 No Content"
+#define HTTPD_207 "207 Multi-Status"
+#define HTTPD_400 "400 Bad Request"
+#define HTTPD_404 "404 Not Found"
+#define HTTPD_408 "408 Request Timeout"
+#define HTTPD_500 "500 Internal Server Error"
+
+#define HTTPD_TYPE_JSON  "application/json"
+#define HTTPD_TYPE_TEXT  "text/html"
+#define HTTPD_TYPE_OCTET "application/octet-stream"
+
+#define ESP_ERR_HTTPD_BASE            0xb000
+#define ESP_ERR_HTTPD_HANDLERS_FULL   (ESP_ERR_HTTPD_BASE + 1)
+#define ESP_ERR_HTTPD_HANDLER_EXISTS  (ESP_ERR_HTTPD_BASE + 2)
+#define ESP_ERR_HTTPD_INVALID_REQ     (ESP_ERR_HTTPD_BASE + 3)
+#define ESP_ERR_HTTPD_RESULT_TRUNC    (ESP_ERR_HTTPD_BASE + 4)
+#define ESP_ERR_HTTPD_RESP_HDR        (ESP_ERR_HTTPD_BASE + 5)
+#define ESP_ERR_HTTPD_RESP_SEND       (ESP_ERR_HTTPD_BASE + 6)
+
+typedef enum {
+	HTTP_DELETE = 0,
+	HTTP_GET    = 1,
+	HTTP_HEAD   = 2,
+	HTTP_POST   = 3,
+	HTTP_PUT    = 4,
+} httpd_method_t;
+
+typedef void *httpd_handle_t;
+typedef bool (*httpd_uri_match_func_t)(const char *tmpl, const char *uri,
+                                       size_t len);
+
+typedef struct {
+	unsigned task_priority;
+	size_t stack_size;
+	int core_id;
+	uint16_t server_port;
+	uint16_t ctrl_port;
+	uint16_t max_open_sockets;
+	uint16_t max_uri_handlers;
+	uint16_t max_resp_headers;
+	uint16_t backlog_conn;
+	bool lru_purge_enable;
+	uint16_t recv_wait_timeout;
+	uint16_t send_wait_timeout;
+	httpd_uri_match_func_t uri_match_fn;
+} httpd_config_t;
+
+#define HTTPD_DEFAULT_CONFIG() {   \
+	.task_priority      = 5,   \
+	.stack_size         = 4096,\
+	.core_id            = 0x7fffffff, \
+	.server_port        = 80,  \
+	.ctrl_port          = 32768, \
+	.max_open_sockets   = 7,   \
+	.max_uri_handlers   = 8,   \
+	.max_resp_headers   = 8,   \
+	.backlog_conn       = 5,   \
+	.lru_purge_enable   = false, \
+	.recv_wait_timeout  = 5,   \
+	.send_wait_timeout  = 5,   \
+	.uri_match_fn       = NULL \
+}
+
+typedef struct httpd_req {
+	httpd_handle_t handle;
+	int method;
+	const char uri[HTTPD_MAX_URI_LEN + 1];
+	size_t content_len;
+	void *aux;
+	void *user_ctx;
+} httpd_req_t;
+
+typedef struct {
+	const char *uri;
+	httpd_method_t method;
+	esp_err_t (*handler)(httpd_req_t *r);
+	void *user_ctx;
+	bool is_websocket;
+	bool handle_ws_control_frames;
+	const char *supported_subprotocol;
+} httpd_uri_t;
+
+typedef enum {
+	HTTPD_WS_TYPE_CONTINUE = 0x0,
+	HTTPD_WS_TYPE_TEXT     = 0x1,
+	HTTPD_WS_TYPE_BINARY   = 0x2,
+	HTTPD_WS_TYPE_CLOSE    = 0x8,
+	HTTPD_WS_TYPE_PING     = 0x9,
+	HTTPD_WS_TYPE_PONG     = 0xa
+} httpd_ws_type_t;
+
+typedef enum {
+	HTTPD_WS_CLIENT_INVALID   = 0x0,
+	HTTPD_WS_CLIENT_HTTP      = 0x1,
+	HTTPD_WS_CLIENT_WEBSOCKET = 0x2
+} httpd_ws_client_info_t;
+
+typedef struct {
+	bool final;
+	bool fragmented;
+	httpd_ws_type_t type;
+	uint8_t *payload;
+	size_t len;
+} httpd_ws_frame_t;
+
+typedef void (*httpd_work_fn_t)(void *arg);
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config);
+esp_err_t httpd_stop(httpd_handle_t handle);
+esp_err_t httpd_get_client_list(httpd_handle_t handle, size_t *fds,
+                                int *client_fds);
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd);
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle,
+                                     const httpd_uri_t *uri);
+bool httpd_uri_match_wildcard(const char *tmpl, const char *uri,
+                              size_t len);
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf,
+                                      size_t len);
+esp_err_t httpd_query_key_value(const char *qry, const char *key,
+                                char *val, size_t len);
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field);
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field,
+                                      char *val, size_t len);
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t len);
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status);
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type);
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field,
+                             const char *value);
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t len);
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf,
+                                ssize_t len);
+esp_err_t httpd_resp_sendstr_chunk(httpd_req_t *r, const char *str);
+
+int httpd_req_to_sockfd(httpd_req_t *r);
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work,
+                           void *arg);
+esp_err_t httpd_ws_recv_frame(httpd_req_t *r, httpd_ws_frame_t *frame,
+                              size_t max_len);
+esp_err_t httpd_ws_send_frame(httpd_req_t *r, httpd_ws_frame_t *frame);
+esp_err_t httpd_ws_send_frame_async(httpd_handle_t hd, int fd,
+                                    httpd_ws_frame_t *frame);
+httpd_ws_client_info_t httpd_ws_get_fd_info(httpd_handle_t hd, int fd);
+
+#endif /* LIGHTCTL_HOST_ESP_HTTP_SERVER_H */
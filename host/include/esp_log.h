@@ -0,0 +1,39 @@
+#ifndef LIGHTCTL_HOST_ESP_LOG_H
+#define LIGHTCTL_HOST_ESP_LOG_H
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+typedef enum {
+	ESP_LOG_NONE,
+	ESP_LOG_ERROR,
+	ESP_LOG_WARN,
+	ESP_LOG_INFO,
+	ESP_LOG_DEBUG,
+	ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+uint32_t esp_log_timestamp(void);
+void esp_log_write(esp_log_level_t level, const char *tag,
+                   const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+
+/**
+ * As in esp-idf, the macros add the prefix and newline themselves
+ */
+#define ESP_LOG_(level, c, tag, fmt, ...) \
+	esp_log_write(level, tag, #c " (%u) %s: " fmt "\n", \
+	              (unsigned int)esp_log_timestamp(), tag, ##__VA_ARGS__)
+
+#define ESP_LOGE(tag, fmt, ...) \
+	ESP_LOG_(ESP_LOG_ERROR, E, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) \
+	ESP_LOG_(ESP_LOG_WARN, W, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) \
+	ESP_LOG_(ESP_LOG_INFO, I, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) \
+	ESP_LOG_(ESP_LOG_DEBUG, D, tag, fmt, ##__VA_ARGS__)
+
+#endif /* LIGHTCTL_HOST_ESP_LOG_H */
@@ -0,0 +1,8 @@
+#ifndef LIGHTCTL_HOST_ESP_ROM_SYS_H
+#define LIGHTCTL_HOST_ESP_ROM_SYS_H
+
+#include <stdint.h>
+
+void esp_rom_delay_us(uint32_t us);
+
+#endif /* LIGHTCTL_HOST_ESP_ROM_SYS_H */
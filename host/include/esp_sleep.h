@@ -0,0 +1,37 @@
+#ifndef LIGHTCTL_HOST_ESP_SLEEP_H
+#define LIGHTCTL_HOST_ESP_SLEEP_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef enum {
+	ESP_SLEEP_WAKEUP_UNDEFINED = 0,
+	ESP_SLEEP_WAKEUP_TIMER     = 4,
+	ESP_SLEEP_WAKEUP_GPIO      = 7,
+} esp_sleep_wakeup_cause_t;
+
+typedef enum {
+	ESP_PD_DOMAIN_RTC_PERIPH,
+	ESP_PD_DOMAIN_RTC_SLOW_MEM,
+	ESP_PD_DOMAIN_RTC_FAST_MEM,
+	ESP_PD_DOMAIN_XTAL,
+	ESP_PD_DOMAIN_RTC8M,
+	ESP_PD_DOMAIN_VDDSDIO,
+	ESP_PD_DOMAIN_MAX
+} esp_sleep_pd_domain_t;
+
+typedef enum {
+	ESP_PD_OPTION_OFF,
+	ESP_PD_OPTION_ON,
+	ESP_PD_OPTION_AUTO
+} esp_sleep_pd_option_t;
+
+esp_err_t esp_sleep_pd_config(esp_sleep_pd_domain_t domain,
+                              esp_sleep_pd_option_t option);
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t us);
+esp_err_t esp_sleep_enable_gpio_wakeup(void);
+esp_err_t esp_light_sleep_start(void);
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void);
+
+#endif /* LIGHTCTL_HOST_ESP_SLEEP_H */
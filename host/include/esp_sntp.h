@@ -0,0 +1,28 @@
+#ifndef LIGHTCTL_HOST_ESP_SNTP_H
+#define LIGHTCTL_HOST_ESP_SNTP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>
+
+#define SNTP_OPMODE_POLL 0
+
+typedef enum {
+	SNTP_SYNC_MODE_IMMED,
+	SNTP_SYNC_MODE_SMOOTH,
+} sntp_sync_mode_t;
+
+typedef void (*sntp_sync_time_cb_t)(struct timeval *tv);
+
+void sntp_setoperatingmode(uint8_t mode);
+void sntp_setservername(uint8_t idx, const char *server);
+void sntp_set_sync_mode(sntp_sync_mode_t mode);
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t cb);
+void sntp_set_sync_interval(uint32_t ms);
+uint32_t sntp_get_sync_interval(void);
+void sntp_init(void);
+void sntp_stop(void);
+bool sntp_restart(void);
+void sntp_sync_time(struct timeval *tv);
+
+#endif /* LIGHTCTL_HOST_ESP_SNTP_H */
@@ -0,0 +1,10 @@
+#ifndef LIGHTCTL_HOST_ESP_SYSTEM_H
+#define LIGHTCTL_HOST_ESP_SYSTEM_H
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+uint32_t esp_random(void);
+
+#endif /* LIGHTCTL_HOST_ESP_SYSTEM_H */
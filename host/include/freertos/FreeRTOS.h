@@ -0,0 +1,50 @@
+#ifndef LIGHTCTL_HOST_FREERTOS_H
+#define LIGHTCTL_HOST_FREERTOS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "sdkconfig.h"
+#include "esp_attr.h"
+
+typedef uint32_t TickType_t;
+typedef int      BaseType_t;
+typedef unsigned UBaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE  1
+#define pdPASS  pdTRUE
+#define pdFAIL  pdFALSE
+
+#define portMAX_DELAY      ((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ CONFIG_FREERTOS_HZ
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)  \
+	((TickType_t)(((TickType_t)(ms) * configTICK_RATE_HZ) / 1000))
+
+#define portYIELD_FROM_ISR() do { } while (0)
+
+/**
+ * Everything runs as if on one core
+ */
+#define portNUM_PROCESSORS 1
+
+static inline BaseType_t xPortGetCoreID(void)
+{
+	return 0;
+}
+
+/**
+ * Critical sections are a mutex here, which is enough to keep the
+ * ISRs and the tasks from seeing each other's partial updates.
+ */
+typedef pthread_mutex_t portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED PTHREAD_MUTEX_INITIALIZER
+#define portENTER_CRITICAL(m)        pthread_mutex_lock(m)
+#define portEXIT_CRITICAL(m)         pthread_mutex_unlock(m)
+#define portENTER_CRITICAL_ISR(m)    pthread_mutex_lock(m)
+#define portEXIT_CRITICAL_ISR(m)     pthread_mutex_unlock(m)
+
+#endif /* LIGHTCTL_HOST_FREERTOS_H */
@@ -0,0 +1,28 @@
+#ifndef LIGHTCTL_HOST_FREERTOS_TASK_H
+#define LIGHTCTL_HOST_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+/**
+ * Tasks are backed by POSIX threads, and there is no preemption
+ * or priority on the host.
+ */
+typedef struct host_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define tskNO_AFFINITY 0x7fffffff
+#define tskIDLE_PRIORITY 0
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name,
+                       uint32_t stack, void *arg, UBaseType_t prio,
+                       TaskHandle_t *handle);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name,
+                                   uint32_t stack, void *arg,
+                                   UBaseType_t prio, TaskHandle_t *handle,
+                                   BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+
+#endif /* LIGHTCTL_HOST_FREERTOS_TASK_H */
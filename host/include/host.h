@@ -0,0 +1,195 @@
+#ifndef LIGHTCTL_HOST_H
+#define LIGHTCTL_HOST_H
+
+/**
+ * Host HAL
+ *
+ * This header is force-included into the firmware sources in the host
+ * build. Besides redirecting the wall clock to the simulated one, it
+ * declares the hooks the benchmarks use to drive the stand-in esp-idf
+ * components.
+ */
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "sdkconfig.h"
+
+/**
+ * The firmware sets the system clock, which we don't want to happen
+ * to the machine we're running on.
+ */
+#define time(t)            host_time(t)
+#define settimeofday(t, z) host_settimeofday(t, z)
+#define gettimeofday(t, z) host_gettimeofday(t, z)
+#define adjtime(d, o)      host_adjtime(d, o)
+
+time_t host_time(time_t *t);
+int host_settimeofday(const struct timeval *tv, const void *tz);
+int host_gettimeofday(struct timeval *tv, void *tz);
+int host_adjtime(const struct timeval *delta, struct timeval *old);
+
+/**
+ * Simulated monotonic clock (microseconds)
+ *
+ * This only advances by way of vTaskDelay(), esp_rom_delay_us() and
+ * host_clock_advance(), so that the scheduler ticks spent by the
+ * firmware can be measured independently of how fast the host is.
+ * It's kept in ns, for the DS1302's bus timing; GPIO calls on its pins
+ * take HOST_GPIO_NS each.
+ */
+#define HOST_GPIO_NS 50
+
+int64_t host_clock(void);
+int64_t host_clock_ns(void);
+void host_clock_advance(int64_t us);
+void host_clock_advance_ns(int64_t ns);
+
+/**
+ * Scheduler ticks spent in vTaskDelay() since startup
+ */
+uint64_t host_ticks(void);
+
+/**
+ * GPIO
+ *
+ * host_gpio_input() sets the externally driven level of an input pin,
+ * running the installed ISR for that pin on a matching edge. Whether
+ * a level would wake the chip is up to host_gpio_wakes().
+ */
+void host_gpio_input(int pin, int level);
+uint64_t host_gpio_writes(void);
+int host_gpio_wakes(int pin, int level);
+
+/**
+ * LEDC: A channel's duty as of now, following its fade, and when its
+ * last change started. A pin routed to a channel reads 1 while the duty
+ * is above 0; host_ledc_pin() returns that, or -1 if it isn't routed.
+ * host_ledc_blocked() counts the calls that had to wait on a running
+ * fade, or would have for ever.
+ */
+uint32_t host_ledc_duty(int ch);
+uint64_t host_ledc_blocked(void);
+int64_t host_ledc_started(int ch);
+int host_ledc_pin(int pin);
+
+/**
+ * DS1302 model attached to the CONFIG_DALLAS_GPIO_* pins
+ *
+ * Its clock runs off the host clock, fast by ds1302_set_drift() (in
+ * ppb), unless it's halted.
+ *
+ * ds1302_drive() has the host drive SDA, or let go of it. The model
+ * checks the bus as it goes: ds1302_violations() is the number of times
+ * a check failed, or all of them, given DS1302_CHECKS, and ds1302_busy()
+ * is the time CE's been high, in ns.
+ */
+enum {
+	DS1302_TCC,     /**< CE to SCLK setup               */
+	DS1302_TCWH,    /**< CE inactive time               */
+	DS1302_TCCH,    /**< SCLK to CE hold                */
+	DS1302_TDC,     /**< Data to SCLK setup             */
+	DS1302_TCDH,    /**< SCLK to data hold              */
+	DS1302_TCL,     /**< SCLK low time                  */
+	DS1302_TCH,     /**< SCLK high time                 */
+	DS1302_TCDD,    /**< Read before the data's out     */
+	DS1302_SCLK,    /**< SCLK high as CE rose           */
+	DS1302_BUS,     /**< Both of us driving SDA         */
+	DS1302_CE,      /**< CE fell mid-byte, or bad cmd   */
+	DS1302_WP,      /**< Write while write protected    */
+	DS1302_BURST,   /**< Clock burst of under 8 bytes   */
+	DS1302_CHECKS
+};
+
+struct ds1302;
+extern struct ds1302 host_ds1302;
+
+void ds1302_reset(struct ds1302 *d);
+void ds1302_set_time(struct ds1302 *d, time_t t);
+time_t ds1302_get_time(const struct ds1302 *d);
+void ds1302_set_drift(struct ds1302 *d, int32_t ppb);
+uint8_t ds1302_ram(const struct ds1302 *d, unsigned int i);
+void ds1302_set_ram(struct ds1302 *d, unsigned int i, uint8_t b);
+void ds1302_pin(struct ds1302 *d, int pin, int level);
+void ds1302_drive(struct ds1302 *d, int drive);
+int ds1302_sda(struct ds1302 *d);
+uint64_t ds1302_xfers(const struct ds1302 *d);
+uint64_t ds1302_busy(const struct ds1302 *d);
+unsigned int ds1302_violations(const struct ds1302 *d, unsigned int check);
+const char *ds1302_check(unsigned int check);
+
+/**
+ * SPI: The DS1302 model is on the bus. host_spi_fail() has the bus, and
+ * every transaction, fail from then on (or not), as a bus that isn't
+ * there would. host_spi_bits() is the number of bits clocked so far.
+ */
+void host_spi_fail(int fail);
+uint64_t host_spi_bits(void);
+
+/**
+ * Timers: Run the callbacks of any timers which have expired
+ * as of now, or the named timer's callback right away.
+ */
+void host_timer_run(void);
+int host_timer_fire(const char *name);
+
+/**
+ * Event loops: Dispatch all pending events on the loop, or have a
+ * thread dispatch them as they're posted.
+ */
+struct esp_event_loop;
+unsigned int host_event_drain(struct esp_event_loop *loop);
+void host_event_start(struct esp_event_loop *loop);
+void host_event_stop(struct esp_event_loop *loop);
+
+/**
+ * httpd: Run a request through the registered handlers
+ */
+struct host_http_resp {
+	int status;             /**< Numeric status code */
+	char status_str[64];    /**< Status line         */
+	const char *type;       /**< Content-Type        */
+	char hdrs[512];         /**< Response headers    */
+	size_t len;             /**< Body length         */
+	char body[4096];        /**< Body (truncated)    */
+};
+
+int host_http_request(int method, const char *uri, const char *hdrs,
+                      const char *body, struct host_http_resp *resp);
+
+/**
+ * httpd: websocket clients
+ *
+ * host_ws_open() does the handshake, returning the client's fd, or -1.
+ * host_ws_send() has the client send a text frame. host_ws_frames()
+ * returns the number of frames the client got, copying the last one.
+ */
+int host_ws_open(const char *uri);
+void host_ws_close(int fd);
+int host_ws_send(int fd, const char *text);
+unsigned int host_ws_frames(int fd, char *last, size_t len);
+
+/**
+ * SNTP: Pretend we got the time. That's handed to sntp_sync_time(),
+ * which sets the clock, and calls the notification callback, unless
+ * the firmware has its own.
+ */
+void host_sntp_sync(const struct timeval *tv);
+
+/**
+ * WiFi: Starting the station connects it right away, and stopping it
+ * loses the connection. host_wifi() is 1 if it's started.
+ */
+int host_wifi(void);
+
+/**
+ * Light sleep: The clock advances to the timer wakeup, or to the time
+ * (as in host_clock()) given to host_sleep_input(), whichever is first.
+ * At that time, the pin is driven to the level, which wakes the chip
+ * if the pin's wakeup is enabled for that level.
+ */
+void host_sleep_input(int pin, int level, int64_t at);
+unsigned int host_sleeps(void);
+
+#endif /* LIGHTCTL_HOST_H */
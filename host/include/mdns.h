@@ -0,0 +1,20 @@
+#ifndef LIGHTCTL_HOST_MDNS_H
+#define LIGHTCTL_HOST_MDNS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+
+typedef struct {
+	const char *key;
+	const char *value;
+} mdns_txt_item_t;
+
+esp_err_t mdns_init(void);
+esp_err_t mdns_hostname_set(const char *hostname);
+esp_err_t mdns_service_add(const char *instance, const char *service,
+                           const char *proto, uint16_t port,
+                           mdns_txt_item_t txt[], size_t n);
+
+#endif /* LIGHTCTL_HOST_MDNS_H */
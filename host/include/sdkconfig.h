@@ -0,0 +1,59 @@
+#ifndef LIGHTCTL_HOST_SDKCONFIG_H
+#define LIGHTCTL_HOST_SDKCONFIG_H
+
+/**
+ * Configuration for the host build
+ *
+ * These mirror the defaults in main/Kconfig and sdkconfig.defaults, and
+ * the handful of esp-idf options the firmware references. The low-power
+ * mode (CONFIG_LIGHTCTL_LOWPOWER) is off, but for the firmware_lowpower
+ * library, which is built with it on. There are 8 light channels, where
+ * the default is 1.
+ */
+#define CONFIG_LIGHTCTL_CTL_STACK_SIZE     3584
+#define CONFIG_LIGHTCTL_CTL_PRIORITY       6
+#define CONFIG_LIGHTCTL_SETTINGS_FLUSH_MS  1000
+#define CONFIG_LIGHTCTL_CMD_TIMEOUT_MS     500
+#define CONFIG_LIGHTCTL_SWITCH_DEBOUNCE_MS 30
+#define CONFIG_LIGHTCTL_TRACE_LEN          256
+#define CONFIG_LIGHTCTL_LOG_LEVEL          3
+#define CONFIG_LIGHTCTL_LOG_LEN            32
+#define CONFIG_LIGHTCTL_LOG_STACK_SIZE     2560
+#define CONFIG_LIGHTCTL_BOOT_STACK_SIZE    4096
+#define CONFIG_LIGHTCTL_LOWPOWER_AWAKE_S   120
+#define CONFIG_LIGHTCTL_LOWPOWER_SYNC_MIN  360
+#define CONFIG_LIGHTCTL_DIM_GPIOS          "16,18,19,23,25,26,27"
+#define CONFIG_LIGHTCTL_DIM_FADE_MS        0
+#define CONFIG_LIGHTCTL_CLOCK_ERR_MS       100
+#define CONFIG_LIGHTCTL_CLOCK_STEP_MS      1000
+#define CONFIG_LIGHTCTL_CLOCK_POLL_MIN     60
+#define CONFIG_LIGHTCTL_CLOCK_POLL_MAX     1440
+#define CONFIG_LIGHTCTL_CLOCK_RTC_ERR_S    2
+#define CONFIG_GPIO_STATUS_LED             2
+#define CONFIG_GPIO_LIGHTS                 4
+#define CONFIG_GPIO_SWON                   34
+#define CONFIG_GPIO_SWOFF                  35
+#define CONFIG_DALLAS_GPIO_SDA             21
+#define CONFIG_DALLAS_GPIO_SCL             22
+#define CONFIG_DALLAS_GPIO_CE              17
+#define CONFIG_DALLAS_SPI                  1
+#define CONFIG_DALLAS_SPI_HZ               500000
+#define CONFIG_WIFI_SSID                   "lightctl"
+#define CONFIG_WIFI_PSK                    "lightctl"
+#define CONFIG_WIFI_MAX_RETRIES            3
+#define CONFIG_WIFI_RETRY_MS               500
+#define CONFIG_WIFI_RETRY_MAX_MS           60000
+#define CONFIG_WIFI_BLINK_MS               500
+#define CONFIG_WIFI_COUNTRY                "US"
+#define CONFIG_WIFI_SCHAN                  1
+#define CONFIG_WIFI_NCHAN                  11
+
+#define CONFIG_FREERTOS_HZ                 100
+#define CONFIG_ESP_SYSTEM_EVENT_QUEUE_SIZE 32
+#define CONFIG_ESP_EVENT_POST_FROM_ISR     1
+#define CONFIG_ESP32_XTAL_FREQ             40
+#define CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ  240
+#define CONFIG_ESP32_PHY_MAX_WIFI_TX_POWER 20
+#define CONFIG_LWIP_LOCAL_HOSTNAME         "lightctl"
+
+#endif /* LIGHTCTL_HOST_SDKCONFIG_H */
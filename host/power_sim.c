@@ -0,0 +1,176 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <esp_timer.h>
+#include <driver/gpio.h>
+
+#include "host.h"
+#include "event.h"
+#include "ctl.h"
+#include "settings.h"
+#include "power.h"
+
+/**
+ * Low-power mode simulator
+ *
+ * Runs three days of an 18:00 to 06:00 schedule in low-power mode, with
+ * the override switch moved to "on" and back while asleep on the first
+ * afternoon. The lights have to follow the schedule and the switch, the
+ * WiFi has to be down while asleep, and up after the switch moves; And
+ * the device should only be woken for the transitions, the syncs and
+ * the switch. Once awake, the switch has to be seen moving again.
+ */
+
+#define SECONDS 1000000
+#define MINUTE  60
+#define HOUR    (60 * MINUTE)
+#define DAY     (24 * HOUR)
+#define T0      1717200000 /* 2024-06-01 00:00:00 */
+#define DAYS    3
+
+#define SW_ON   (T0 + 13 * HOUR + 17 * MINUTE)
+#define SW_AUTO (T0 + 14 * HOUR + 3 * MINUTE)
+
+void app_main(void);
+
+static unsigned int fail;
+
+static int expected(time_t t)
+{
+	time_t s = t % DAY;
+
+	if (t >= SW_ON && t < SW_AUTO)
+		return 1;
+	return s >= 18 * HOUR || s < 6 * HOUR;
+}
+
+static void settle(void)
+{
+	host_clock_advance(CONFIG_LIGHTCTL_SWITCH_DEBOUNCE_MS * 1000 + 1);
+	host_timer_run();
+	ctl_run();
+}
+
+/**
+ * When t is, as in host_clock()
+ */
+static int64_t at(time_t t)
+{
+	return host_clock() + ((int64_t)t - time(NULL)) * SECONDS;
+}
+
+int main(void)
+{
+	struct timeval tv = { .tv_sec = T0 };
+	unsigned int sleeps, timer, wakes, changes = 0;
+	struct power_stats ps;
+	int64_t next;
+	int lights = 0;
+	time_t now;
+
+	ds1302_reset(&host_ds1302);
+	ds1302_set_time(&host_ds1302, T0);
+	app_main();
+	ctl_run();
+	host_settimeofday(&tv, NULL);
+
+	settings_lock();
+	settings.shr = 18;
+	settings.smn = 0;
+	settings.ehr = 6;
+	settings.emn = 0;
+	settings_unlock();
+	ctl_send(SCHED_ON, 0);
+	ctl_run();
+
+	host_sleep_input(CONFIG_GPIO_SWON, 1, at(SW_ON));
+	while ((now = time(NULL)) < T0 + DAYS * DAY) {
+		if ((next = esp_timer_get_next_alarm()) > host_clock())
+			host_clock_advance(next - host_clock());
+
+		sleeps = host_sleeps();
+		power_stats(&ps);
+		timer = ps.wakeups[POWER_TIMER];
+		host_timer_run();
+		ctl_run();
+		now = time(NULL);
+
+		/*
+		 * Woken: Only a timer leaves the WiFi down. The timers that
+		 * are due on waking are run next time around.
+		 */
+		if (host_sleeps() != sleeps) {
+			power_stats(&ps);
+			if (host_wifi() != (ps.wakeups[POWER_TIMER] == timer)) {
+				printf("%ld: woken, with the WiFi %s\n",
+				       (long)(now - T0), host_wifi() ? "up" : "down");
+				fail++;
+			}
+
+			if (now >= SW_ON && now < SW_AUTO)
+				host_sleep_input(CONFIG_GPIO_SWON, 0, at(SW_AUTO));
+			continue;
+		}
+
+		if (gpio_get_level(CONFIG_GPIO_LIGHTS) != lights) {
+			lights ^= 1;
+			changes++;
+		}
+
+		/* Enabling the schedule doesn't switch the lights */
+		if (now >= T0 + 6 * HOUR && lights != expected(now)) {
+			printf("%ld: lights %s, should be %s\n", (long)(now - T0),
+			       lights ? "on" : "off", lights ? "off" : "on");
+			fail++;
+		}
+	}
+
+	/* Woken, the switch's edges have to be seen again, both ways */
+	host_gpio_input(CONFIG_GPIO_SWOFF, 1);
+	ctl_run();
+	settle();
+	if (gpio_get_level(CONFIG_GPIO_LIGHTS)) {
+		printf("switched off while awake, lights still on\n");
+		fail++;
+	}
+
+	host_gpio_input(CONFIG_GPIO_SWOFF, 0);
+	ctl_run();
+	settle();
+	if (settings.override_sw) {
+		printf("switched back while awake, still overridden\n");
+		fail++;
+	}
+
+	power_stats(&ps);
+	wakes = ps.wakeups[POWER_TIMER] + ps.wakeups[POWER_SWITCH] +
+	        ps.wakeups[POWER_SYNC];
+	printf("%u sleeps, %u light changes\n", host_sleeps(), changes);
+	printf("woken %u times: %u for timers, %u by the switch, "
+	       "%u for syncs\n", wakes, ps.wakeups[POWER_TIMER],
+	       ps.wakeups[POWER_SWITCH], ps.wakeups[POWER_SYNC]);
+	printf("%.1f wakeups per day, %.1f s awake per wakeup, "
+	       "%.3f%% of the time\n", (double)wakes / DAYS,
+	       (double)ps.awake_us / SECONDS / (wakes + ps.boots),
+	       100.0 * (double)ps.awake_us / (double)(ps.awake_us +
+	                                               ps.slept_us));
+
+	if (ps.wakeups[POWER_SWITCH] != 2) {
+		printf("expected 2 switch wakeups\n");
+		fail++;
+	}
+
+	/* A sync every 6 hours, and each transition */
+	if (ps.wakeups[POWER_SYNC] < DAYS * DAY / HOUR / 6 - 1 ||
+	    ps.wakeups[POWER_SYNC] > DAYS * DAY / HOUR / 6 ||
+	    wakes > 2 + DAYS * 2 + DAYS * DAY / HOUR / 6 + 4) {
+		printf("too many wakeups\n");
+		fail++;
+	}
+
+	printf("%u failures\n", fail);
+	return fail ? 1 : 0;
+}
@@ -0,0 +1,316 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <esp_timer.h>
+#include <driver/gpio.h>
+
+#include "host.h"
+#include "event.h"
+#include "ctl.h"
+#include "settings.h"
+#include "sched.h"
+#include "dim.h"
+
+/**
+ * Schedule simulator
+ *
+ * Runs the firmware's scheduler for every start/end pair over three
+ * simulated days, and compares the state of the lights against the
+ * hourly-polling scheduler it replaced. The schedule is enabled at
+ * midnight, and has to bring the lights to its state right away.
+ *
+ * The old scheduler turned the lights off again right after turning
+ * them on when both times were in the same hour with the end minute
+ * first. For those pairs, we only check the firmware against the
+ * intended on/off window.
+ *
+ * Last, the daily window is disabled, and a weekly rule has to switch
+ * the lights on its own, while a dated rule running past midnight has
+ * to be turned away.
+ */
+
+#define MINUTE 60
+#define HOUR   (60 * MINUTE)
+#define DAY    (24 * HOUR)
+#define T0     1717200000 /* 2024-06-01 00:00:00 */
+#define MAXREC 256
+
+void app_main(void);
+
+struct rec {
+	time_t t[MAXREC];
+	int s[MAXREC];
+	unsigned int n;
+};
+
+static void record(struct rec *r, time_t t, int s)
+{
+	if (r->n && r->s[r->n - 1] == s)
+		return;
+
+	if (r->n < MAXREC) {
+		r->t[r->n]   = t;
+		r->s[r->n++] = s;
+	}
+}
+
+/**
+ * State of the lights at time t
+ */
+static int state(const struct rec *r, time_t t)
+{
+	unsigned int i;
+	int s = 0;
+
+	for (i = 0; i < r->n && r->t[i] <= t; i++)
+		s = r->s[i];
+
+	return s;
+}
+
+/**
+ * Does the window run past midnight, so the lights are on at T0?
+ */
+static int end_first(unsigned int shr, unsigned int smn, unsigned int ehr,
+                     unsigned int emn)
+{
+	return ehr * 60 + emn < shr * 60 + smn;
+}
+
+/**
+ * The scheduler as it was, polling at the top of every hour
+ */
+static time_t ref_schedule(time_t now, int *lights, unsigned int shr,
+                           unsigned int smn, unsigned int ehr,
+                           unsigned int emn)
+{
+	struct tm tm;
+	unsigned int min;
+
+	gmtime_r(&now, &tm);
+	min = (unsigned int)tm.tm_min;
+	if ((unsigned int)tm.tm_hour == ehr && ehr == shr && emn < smn) {
+		if (min < emn)
+			return now + (emn - min) * MINUTE - tm.tm_sec;
+
+		if (min < smn)
+			*lights = 0;
+	}
+
+	if ((unsigned int)tm.tm_hour == shr && min < smn)
+		return now + (smn - min) * MINUTE - tm.tm_sec;
+	else if ((unsigned int)tm.tm_hour == shr && min >= smn)
+		*lights = 1;
+
+	if ((unsigned int)tm.tm_hour == ehr && min < emn)
+		return now + (emn - min) * MINUTE - tm.tm_sec;
+	else if ((unsigned int)tm.tm_hour == ehr && min >= emn)
+		*lights = 0;
+
+	return now + HOUR - min * MINUTE - tm.tm_sec;
+}
+
+static void ref_run(struct rec *r, unsigned int shr, unsigned int smn,
+                    unsigned int ehr, unsigned int emn)
+{
+	time_t t = T0, next;
+	int lights = end_first(shr, smn, ehr, emn);
+
+	record(r, t, lights);
+	while (t < T0 + 3 * DAY) {
+		next = ref_schedule(t, &lights, shr, smn, ehr, emn);
+		record(r, t, lights);
+		t = next;
+	}
+}
+
+/**
+ * Run the firmware from one alarm to the next, and count the wakeups
+ */
+static unsigned int fw_run(struct rec *r, unsigned int shr, unsigned int smn,
+                           unsigned int ehr, unsigned int emn)
+{
+	struct timeval tv = { .tv_sec = T0 };
+	unsigned int wakeups = 0;
+	int64_t next;
+
+	ctl_send(SCHED_OFF, 0);
+	ctl_run();
+	host_settimeofday(&tv, NULL);
+
+	settings_lock();
+	dim_set(DIM_ALL, 0, 0);
+	settings.lights_status = 0;
+	settings.shr = shr;
+	settings.smn = smn;
+	settings.ehr = ehr;
+	settings.emn = emn;
+	settings_unlock();
+
+	ctl_send(SCHED_ON, 0);
+	ctl_run();
+	record(r, T0, gpio_get_level(CONFIG_GPIO_LIGHTS));
+
+	while ((next = esp_timer_get_next_alarm()) != INT64_MAX) {
+		if (next > host_clock())
+			host_clock_advance(next - host_clock());
+
+		if (time(NULL) >= T0 + 3 * DAY)
+			break;
+
+		host_timer_run();
+		ctl_run();
+		record(r, time(NULL), gpio_get_level(CONFIG_GPIO_LIGHTS));
+		wakeups++;
+	}
+
+	return wakeups;
+}
+
+/**
+ * Compare a and b at every point either changes
+ */
+static int same(const struct rec *a, const struct rec *b)
+{
+	const struct rec *r[2] = { a, b };
+	unsigned int i, j;
+	time_t t;
+
+	for (j = 0; j < 2; j++) {
+		for (i = 0; i < r[j]->n; i++) {
+			t = r[j]->t[i];
+			if (t < T0 + 3 * DAY && state(a, t) != state(b, t))
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * The intended window: on from start (inclusive) to end
+ */
+static void window(struct rec *r, unsigned int shr, unsigned int smn,
+                   unsigned int ehr, unsigned int emn)
+{
+	time_t day, on, off;
+
+	record(r, T0, end_first(shr, smn, ehr, emn));
+	for (day = T0; day < T0 + 4 * DAY; day += DAY) {
+		on  = day + shr * HOUR + smn * MINUTE;
+		off = day + ehr * HOUR + emn * MINUTE;
+		if (off < on) {
+			record(r, off, 0);
+			record(r, on, 1);
+		} else {
+			record(r, on, 1);
+			record(r, off, 0);
+		}
+	}
+}
+
+/**
+ * A rule, without the daily window
+ */
+static unsigned long rules_only(void)
+{
+	struct sched_rule r = { .days = SCHED_ALL, .start = 18 * 60,
+	                        .end = 6 * 60 };
+	struct timeval tv = { .tv_sec = T0 + 20 * HOUR };
+	unsigned long fail = 0;
+	int64_t next;
+
+	ctl_send(SCHED_OFF, 0);
+	ctl_run();
+	host_settimeofday(&tv, NULL);
+	if (sched_add(&r) < 0) {
+		printf("rule turned away\n");
+		return 1;
+	}
+
+	ctl_send(SCHED_RULES, 0);
+	ctl_run();
+	if (!gpio_get_level(CONFIG_GPIO_LIGHTS)) {
+		printf("rule didn't switch the lights on\n");
+		fail++;
+	}
+
+	while (gpio_get_level(CONFIG_GPIO_LIGHTS) &&
+	       (next = esp_timer_get_next_alarm()) != INT64_MAX) {
+		if (next > host_clock())
+			host_clock_advance(next - host_clock());
+		host_timer_run();
+		ctl_run();
+	}
+
+	if (time(NULL) != T0 + DAY + 6 * HOUR) {
+		printf("rule didn't switch the lights off at 06:00\n");
+		fail++;
+	}
+
+	r.date  = (uint16_t)(T0 / DAY + 2);
+	r.start = 20 * 60;
+	r.end   = 2 * 60;
+	if (sched_add(&r) >= 0) {
+		printf("dated rule past midnight taken\n");
+		fail++;
+	}
+
+	while (!sched_del(0));
+	ctl_send(SCHED_RULES, 0);
+	ctl_run();
+	return fail;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int start, end, step = 1;
+	unsigned long pairs = 0, quirks = 0, fail = 0, wakeups = 0;
+	struct rec ref, fw, win;
+
+	if (argc > 1) step = (unsigned int)atoi(argv[1]);
+	if (!step) step = 1;
+
+	ds1302_reset(&host_ds1302);
+	app_main();
+	ctl_run();
+
+	for (start = 0; start < DAY / MINUTE; start += step) {
+		for (end = 0; end < DAY / MINUTE; end += step) {
+			unsigned int shr = start / 60, smn = start % 60;
+			unsigned int ehr = end / 60, emn = end % 60;
+			int quirk = shr == ehr && emn < smn;
+
+			/* The UI rejects equal start and end times */
+			if (start == end)
+				continue;
+
+			memset(&ref, 0, sizeof(ref));
+			memset(&fw, 0, sizeof(fw));
+			memset(&win, 0, sizeof(win));
+			ref_run(&ref, shr, smn, ehr, emn);
+			wakeups += fw_run(&fw, shr, smn, ehr, emn);
+			window(&win, shr, smn, ehr, emn);
+
+			pairs++;
+			quirks += quirk;
+			if (!same(&fw, &win) || (!quirk && !same(&fw, &ref))) {
+				if (fail++ < 10) {
+					printf("mismatch: %02u:%02u-%02u:%02u\n",
+					       shr, smn, ehr, emn);
+				}
+			}
+		}
+	}
+
+	printf("%lu pairs, %lu checked against the window only, "
+	       "%lu mismatches\n", pairs, quirks, fail);
+	fail += rules_only();
+	printf("%.2f wakeups/day (hourly polling: >= 24)\n",
+	       (double)wakeups / pairs / 3);
+	return fail ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <esp_timer.h>
+#include <driver/gpio.h>
+
+#include "host.h"
+#include "event.h"
+#include "ctl.h"
+#include "settings.h"
+#include "switch.h"
+
+/**
+ * Switch debounce simulator
+ *
+ * Throws bursts of bouncing edges at the override switch pins, with
+ * the gaps between edges always under the debounce window, and checks
+ * that each burst which moves the switch yields exactly one SWITCH,
+ * and that one which ends where it started yields none. The settle
+ * latency has to be exactly the length of the burst plus the window.
+ *
+ * Moving the switch from "on" to "off" goes through "auto", so both
+ * pins bounce in those bursts.
+ */
+
+#define WINDOW ((int64_t)CONFIG_LIGHTCTL_SWITCH_DEBOUNCE_MS * 1000)
+#define BURSTS 2000
+
+void app_main(void);
+
+static uint32_t rng = 2463534242U;
+
+static uint32_t rnd(uint32_t n)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng % n;
+}
+
+/**
+ * Let the clock run up to t, firing the timers as they come due
+ */
+static void run_until(int64_t t)
+{
+	int64_t next;
+
+	ctl_run();
+	while ((next = esp_timer_get_next_alarm()) <= t) {
+		if (next > host_clock())
+			host_clock_advance(next - host_clock());
+		host_timer_run();
+		ctl_run();
+	}
+
+	if (t > host_clock())
+		host_clock_advance(t - host_clock());
+}
+
+/**
+ * Bounce a pin on its way to level, starting with an edge at host_clock()
+ */
+static unsigned int bounce(int pin, int from, int level)
+{
+	unsigned int i, n = 1 + 2 * rnd(6) + (from == level);
+
+	for (i = 0; i < n; i++) {
+		if (i) run_until(host_clock() + 50 + rnd(WINDOW - 50));
+		host_gpio_input(pin, from ^ (int)(~i & 1));
+		ctl_run();
+	}
+
+	return n;
+}
+
+int main(void)
+{
+	unsigned int i, edges = 0, moves = 0, fail = 0, n, switches;
+	int pos = 0, to, expect;
+	struct switch_stats st;
+	struct ctl_stats cs;
+	uint32_t runs;
+	int64_t first;
+
+	ds1302_reset(&host_ds1302);
+	app_main();
+	ctl_run();
+
+	for (i = 0; i < BURSTS; i++) {
+		/* 0: auto, 1: on, 2: off; Sometimes just a glitch */
+		to       = (int)rnd(4);
+		to       = to == 3 ? pos : to;
+		expect   = to != pos;
+		first    = host_clock();
+		ctl_stats(&cs);
+		runs     = cs.run[SWITCH];
+
+		if ((pos | to) & 1) {
+			n = bounce(CONFIG_GPIO_SWON, pos & 1, to & 1);
+			edges += n;
+		}
+
+		if ((pos | to) & 2) {
+			if ((pos | to) & 1)
+				run_until(host_clock() + 50 + rnd(WINDOW - 50));
+			n = bounce(CONFIG_GPIO_SWOFF, pos >> 1, to >> 1);
+			edges += n;
+		}
+
+		/* Glitch on a pin at rest */
+		if (!pos && !to) {
+			n = bounce(CONFIG_GPIO_SWON, 0, 0);
+			edges += n;
+		}
+
+		first = host_clock() - first;
+		run_until(host_clock() + WINDOW + 1000000);
+		switch_stats(&st);
+		ctl_stats(&cs);
+		switches = cs.run[SWITCH] - runs;
+
+		settings_lock();
+		n = settings.override_sw;
+		settings_unlock();
+
+		if (switches != (unsigned int)expect || (int)n != to ||
+		    (int64_t)st.settle_us != first + WINDOW) {
+			if (fail++ < 10) {
+				printf("burst %u: %d -> %d: %u SWITCH, "
+				       "override %u, settled in %u us\n",
+				       i, pos, to, switches, n,
+				       (unsigned int)st.settle_us);
+			}
+		}
+
+		moves += expect;
+		pos    = to;
+	}
+
+	switch_stats(&st);
+	if (st.edges != edges || st.bursts != BURSTS ||
+	    st.glitches != BURSTS - moves) {
+		printf("stats: %u edges, %u bursts, %u glitches\n",
+		       (unsigned int)st.edges, (unsigned int)st.bursts,
+		       (unsigned int)st.glitches);
+		fail++;
+	}
+
+	printf("%u bursts, %u edges (%u bounces), %u moves, %u glitches\n",
+	       BURSTS, edges, edges - BURSTS, moves, BURSTS - moves);
+	printf("%u edges per burst at most, settled in %u us at worst\n",
+	       (unsigned int)st.max_edges, (unsigned int)st.max_settle_us);
+	printf("%u failures\n", fail);
+	return fail ? 1 : 0;
+}
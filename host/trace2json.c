@@ -0,0 +1,234 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "event.h"
+#include "metrics.h"
+#include "trace.h"
+#include "boot.h"
+
+/**
+ * Trace decoder
+ *
+ * Turns a dump of the trace rings (GET /trace) into the JSON the
+ * Chrome trace viewer (chrome://tracing, or ui.perfetto.dev) loads,
+ * with a thread per core:
+ *
+ *   curl -o lightctl.trace http://lightctl.local/trace
+ *   trace2json lightctl.trace > lightctl.json
+ *
+ * Commands, requests and boot phases are shown as slices, everything
+ * else as instants.
+ */
+
+static const char *const cmds[CTL_CMDS] = {
+	[CONNECTED]   = "CONNECTED",
+	[LOSTCONN]    = "LOSTCONN",
+	[SWITCH]      = "SWITCH",
+	[ON]          = "ON",
+	[OFF]         = "OFF",
+	[SCHED_ON]    = "SCHED_ON",
+	[SCHED_OFF]   = "SCHED_OFF",
+	[FLUSH]       = "FLUSH",
+	[SCHEDULE]    = "SCHEDULE",
+	[TIMESYNC]    = "TIMESYNC",
+	[SCHED_RULES] = "SCHED_RULES",
+	[BATCH]       = "BATCH",
+	[DEBOUNCE]    = "DEBOUNCE",
+	[SLEEP]       = "SLEEP",
+	[DIM]         = "DIM",
+	[CLOCK]       = "CLOCK",
+};
+
+static const char *const handlers[M_HTTP_INDEX + 1] = {
+	[M_HTTP_ON]       = "/on",
+	[M_HTTP_OFF]      = "/off",
+	[M_HTTP_STATUS]   = "/status",
+	[M_HTTP_SCHEDULE] = "/schedule",
+	[M_HTTP_BATCH]    = "/batch",
+	[M_HTTP_DIM]      = "/dim",
+	[M_HTTP_INDEX]    = "index",
+};
+
+static const char *const boot[BOOT_STEPS] = {
+	[BOOT_NVS]    = "nvs",
+	[BOOT_GPIO]   = "gpio",
+	[BOOT_WIFI]   = "wifi",
+	[BOOT_RTC]    = "rtc",
+	[BOOT_DIM]    = "dim",
+	[BOOT_SCHED]  = "sched",
+	[BOOT_CTL]    = "ctl",
+	[BOOT_MDNS]   = "mdns",
+	[BOOT_LIGHTS] = "lights set",
+	[BOOT_IP]     = "got an address",
+	[BOOT_HTTP]   = "http ready",
+};
+
+/* esp_wifi_types.h, esp_netif_types.h */
+static const char *const wifi[] = {
+	"WIFI_READY", "SCAN_DONE", "STA_START", "STA_STOP",
+	"STA_CONNECTED", "STA_DISCONNECTED", "STA_AUTHMODE_CHANGE"
+};
+
+static const char *const ip[] = {
+	"STA_GOT_IP", "STA_LOST_IP", "AP_STAIPASSIGNED", "GOT_IP6"
+};
+
+#define NAME(t, i) \
+	((i) < sizeof(t) / sizeof(*(t)) && (t)[i] ? (t)[i] : "?")
+
+struct ev {
+	int64_t t;
+	unsigned int i;
+	struct trace_rec r;
+};
+
+static int cmp(const void *a, const void *b)
+{
+	const struct ev *x = a, *y = b;
+
+	if (x->t != y->t)
+		return (x->t > y->t) - (x->t < y->t);
+	return (x->i > y->i) - (x->i < y->i);
+}
+
+static void emit(FILE *out, unsigned int core, const struct ev *e,
+                 int *first)
+{
+	const struct trace_rec *r = &e->r;
+	const char *ph = "i", *name, *cat;
+	char args[64] = "";
+
+	switch (r->type) {
+	case TR_EDGE:
+		cat  = "switch";
+		name = "edge";
+		snprintf(args, sizeof(args), "\"pin\":%u,\"level\":%u",
+		         r->arg & 0x7fU, r->arg >> 7);
+		break;
+	case TR_POST:
+		cat  = "ctl";
+		name = NAME(cmds, r->arg);
+		snprintf(args, sizeof(args), "\"queued\":\"%s\"", name);
+		name = "post";
+		break;
+	case TR_CMD:
+	case TR_CMD_END:
+		cat  = "ctl";
+		ph   = r->type == TR_CMD ? "B" : "E";
+		name = NAME(cmds, r->arg);
+		break;
+	case TR_LIGHTS:
+		cat  = "lights";
+		name = r->arg ? "lights on" : "lights off";
+		break;
+	case TR_SCHEDULE:
+		cat  = "schedule";
+		name = r->arg ? "schedule: on" : "schedule: off";
+		break;
+	case TR_WIFI:
+		cat  = "wifi";
+		name = NAME(wifi, r->arg);
+		break;
+	case TR_IP:
+		cat  = "wifi";
+		name = NAME(ip, r->arg);
+		break;
+	case TR_HTTP:
+	case TR_HTTP_END:
+		cat  = "http";
+		ph   = r->type == TR_HTTP ? "B" : "E";
+		name = NAME(handlers, r->arg);
+		break;
+	case TR_BOOT:
+	case TR_BOOT_END:
+		cat  = "boot";
+		ph   = r->type == TR_BOOT ? "B" : "E";
+		name = NAME(boot, r->arg);
+		break;
+	case TR_BOOT_MARK:
+		cat  = "boot";
+		name = NAME(boot, r->arg);
+		break;
+	default:
+		return;
+	}
+
+	fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\","
+	        "\"ts\":%lld,\"pid\":1,\"tid\":%u%s,\"args\":{%s}}",
+	        *first ? "" : ",", name, cat, ph, (long long)e->t, core,
+	        *ph == 'i' ? ",\"s\":\"t\"" : "", args);
+	*first = 0;
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *in = stdin, *out = stdout;
+	struct trace_hdr h;
+	struct trace_core c;
+	struct ev *ev = NULL;
+	unsigned int core, i;
+	int first = 1, ret = 1;
+
+	if (argc > 1 && !(in = fopen(argv[1], "rb"))) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	if (argc > 2 && !(out = fopen(argv[2], "w"))) {
+		perror(argv[2]);
+		goto done;
+	}
+
+	if (fread(&h, sizeof(h), 1, in) != 1 || h.magic != TRACE_MAGIC ||
+	    h.version != TRACE_VERSION) {
+		fprintf(stderr, "not a lightctl trace\n");
+		goto done;
+	}
+
+	if (!(ev = calloc(h.len ? h.len : 1, sizeof(*ev))))
+		goto done;
+
+	fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	for (core = 0; core < h.cores; core++) {
+		if (fread(&c, sizeof(c), 1, in) != 1 || c.n > h.len) {
+			fprintf(stderr, "core %u: truncated\n", core);
+			goto done;
+		}
+
+		for (i = 0; i < c.n; i++) {
+			if (fread(&ev[i].r, sizeof(ev[i].r), 1, in) != 1) {
+				fprintf(stderr, "core %u: truncated\n", core);
+				goto done;
+			}
+
+			ev[i].t = (int64_t)ev[i].r.lo |
+			          (int64_t)ev[i].r.hi << 32;
+			ev[i].i = i;
+		}
+
+		/* ISRs can record out of order with what they preempted */
+		qsort(ev, c.n, sizeof(*ev), cmp);
+		fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\","
+		        "\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"core %u\"}}",
+		        first ? "" : ",", core, core);
+		first = 0;
+
+		for (i = 0; i < c.n; i++)
+			emit(out, core, &ev[i], &first);
+		fprintf(stderr, "core %u: %u events, %u lost\n", core,
+		        (unsigned int)c.n, (unsigned int)c.lost);
+	}
+
+	fprintf(out, "\n],\"otherData\":{\"dumped_us\":%lld}}\n",
+	        (long long)h.now);
+	ret = 0;
+
+done:
+	free(ev);
+	if (out && out != stdout) fclose(out);
+	if (in != stdin) fclose(in);
+	return ret;
+}
@@ -0,0 +1,163 @@
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <esp_timer.h>
+#include <esp_http_server.h>
+
+#include "host.h"
+#include "event.h"
+#include "ctl.h"
+#include "metrics.h"
+#include "trace.h"
+
+/**
+ * Trace ring test
+ *
+ * Switches the lights, bounces the override switch, fires the schedule
+ * timer and makes a request, then checks that GET /trace has each of
+ * them, in order. Then makes enough requests to wrap the ring, and
+ * checks that it has the latest of them. The last dump is written to
+ * the file given, if any, for trace2json.
+ */
+
+void app_main(void);
+
+static struct host_http_resp resp;
+static const struct trace_rec *recs;
+static struct trace_core core;
+static unsigned int fail;
+
+static void dump(void)
+{
+	struct trace_hdr h;
+
+	host_http_request(HTTP_GET, "/trace", NULL, NULL, &resp);
+	memcpy(&h, resp.body, sizeof(h));
+	memcpy(&core, resp.body + sizeof(h), sizeof(core));
+	recs = (const struct trace_rec *)(resp.body + sizeof(h) +
+	                                  sizeof(core));
+
+	if (resp.status != 200 || h.magic != TRACE_MAGIC ||
+	    h.version != TRACE_VERSION || h.cores != 1 ||
+	    h.len != CONFIG_LIGHTCTL_TRACE_LEN || core.n > h.len ||
+	    resp.len != sizeof(h) + sizeof(core) + core.n * sizeof(*recs)) {
+		printf("bad dump: status %d, %zu bytes, %u records\n",
+		       resp.status, resp.len, (unsigned int)core.n);
+		fail++;
+		core.n = 0;
+	}
+}
+
+/**
+ * Find the next record of a type and argument (any, if < 0), from *i on
+ */
+static void expect(unsigned int *i, uint8_t type, int arg)
+{
+	for (; *i < core.n; ++*i) {
+		if (recs[*i].type == type && (arg < 0 || recs[*i].arg == arg)) {
+			++*i;
+			return;
+		}
+	}
+
+	printf("missing: type %u, arg %d\n", type, arg);
+	fail++;
+}
+
+static void settle(void)
+{
+	host_clock_advance(CONFIG_LIGHTCTL_SWITCH_DEBOUNCE_MS * 1000 + 1);
+	host_timer_run();
+	ctl_run();
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i = 0, n;
+	int64_t t, last = 0;
+	FILE *f;
+
+	ds1302_reset(&host_ds1302);
+	app_main();
+	ctl_run();
+	ctl_send(CONNECTED, 0);
+	ctl_run();
+
+	ctl_send(ON, 0);
+	ctl_run();
+	host_clock_advance(1000);
+	host_gpio_input(CONFIG_GPIO_SWOFF, 1);
+	ctl_run();
+	settle();
+	host_gpio_input(CONFIG_GPIO_SWOFF, 0);
+	ctl_run();
+	settle();
+	host_timer_fire("schedule_timer");
+	ctl_run();
+	host_http_request(HTTP_HEAD, "/status", NULL, NULL, &resp);
+
+	dump();
+	expect(&i, TR_CMD, CONNECTED);
+	expect(&i, TR_CMD_END, CONNECTED);
+	expect(&i, TR_POST, ON);
+	expect(&i, TR_CMD, ON);
+	expect(&i, TR_LIGHTS, 1);
+	expect(&i, TR_CMD_END, ON);
+	expect(&i, TR_EDGE, CONFIG_GPIO_SWOFF | 1 << 7);
+	expect(&i, TR_POST, DEBOUNCE);
+	expect(&i, TR_CMD, SWITCH);
+	expect(&i, TR_LIGHTS, 0);
+	expect(&i, TR_CMD_END, SWITCH);
+	expect(&i, TR_EDGE, CONFIG_GPIO_SWOFF);
+	expect(&i, TR_POST, SWITCH);
+	expect(&i, TR_SCHEDULE, -1);
+	expect(&i, TR_CMD, SCHEDULE);
+	expect(&i, TR_HTTP, M_HTTP_STATUS);
+	expect(&i, TR_HTTP_END, M_HTTP_STATUS);
+
+	for (n = 0; n < core.n; n++) {
+		t = (int64_t)recs[n].lo | (int64_t)recs[n].hi << 32;
+		if (t < last) {
+			printf("record %u: time went backwards\n", n);
+			fail++;
+		}
+
+		last = t;
+	}
+
+	printf("%u records, %u lost\n", (unsigned int)core.n,
+	       (unsigned int)core.lost);
+
+	/* Wrap the ring a couple of times */
+	for (n = 0; n < CONFIG_LIGHTCTL_TRACE_LEN; n++)
+		host_http_request(HTTP_HEAD, "/status", NULL, NULL, &resp);
+
+	dump();
+	if (core.n != CONFIG_LIGHTCTL_TRACE_LEN) {
+		printf("wrapped: %u records\n", (unsigned int)core.n);
+		fail++;
+	}
+
+	for (n = 0; n < core.n; n++) {
+		if (recs[n].type != (n & 1 ? TR_HTTP_END : TR_HTTP) ||
+		    recs[n].arg != M_HTTP_STATUS) {
+			printf("wrapped: record %u: type %u, arg %u\n", n,
+			       recs[n].type, recs[n].arg);
+			fail++;
+			break;
+		}
+	}
+
+	printf("%u records, %u lost after wrapping\n",
+	       (unsigned int)core.n, (unsigned int)core.lost);
+
+	if (argc > 1 && (f = fopen(argv[1], "wb"))) {
+		fwrite(resp.body, 1, resp.len, f);
+		fclose(f);
+	}
+
+	printf("%u failures\n", fail);
+	return fail ? 1 : 0;
+}
@@ -0,0 +1,90 @@
+# Generate a C source embedding the gzip'd UI in DIST, along with a
+# table of the request path, MIME type, length, ETag, modification time
+# and caching policy of each file.
+#
+#   cmake -DDIST=ui/dist -DOUT=assets.c -P assets.cmake
+#
+# The data is const, so it stays in flash and is sent from there.
+file(GLOB files RELATIVE "${DIST}" "${DIST}/*.gz")
+
+# Twelve bytes per line (no {n} in cmake regexes)
+string(REPEAT "0x..," 12 row)
+
+# Content hash in the names parcel gives the bundles
+string(REPEAT "[0-9a-f]" 8 hex8)
+
+set(data "")
+set(table "")
+set(i 0)
+
+foreach(f ${files})
+	string(REGEX REPLACE "\\.gz$" "" path "${f}")
+	string(REGEX MATCH "[^.]*$" ext "${path}")
+
+	if(ext STREQUAL "html")
+		set(type "text/html")
+	elseif(ext STREQUAL "js")
+		set(type "application/javascript")
+	elseif(ext STREQUAL "css")
+		set(type "text/css")
+	elseif(ext STREQUAL "svg")
+		set(type "image/svg+xml")
+	elseif(ext STREQUAL "png")
+		set(type "image/png")
+	elseif(ext STREQUAL "ico")
+		set(type "image/x-icon")
+	elseif(ext STREQUAL "woff2")
+		set(type "font/woff2")
+	elseif(ext STREQUAL "json")
+		set(type "application/json")
+	else()
+		set(type "application/octet-stream")
+	endif()
+
+	# Files with a hash in the name never change; Others are revalidated
+	if(path MATCHES "\\.${hex8}\\.[^.]+$")
+		set(cache "public, max-age=31536000, immutable")
+	else()
+		set(cache "no-cache")
+	endif()
+
+	file(READ "${DIST}/${f}" hex HEX)
+	file(SHA256 "${DIST}/${f}" sum)
+	string(SUBSTRING "${sum}" 0 16 hash)
+	file(TIMESTAMP "${DIST}/${f}" mtime "%a, %d %b %Y %H:%M:%S GMT" UTC)
+	string(LENGTH "${hex}" len)
+	math(EXPR len "${len} / 2")
+
+	string(REGEX REPLACE "(..)" "0x\\1," hex "${hex}")
+	string(REGEX REPLACE "(${row})" "\\1\n\t" hex "${hex}")
+	string(APPEND data "static const uint8_t asset${i}[] = {\n\t${hex}\n};\n\n")
+	string(APPEND table
+		"\t{ \"/${path}\", \"${type}\", asset${i}, ${len},\n"
+		"\t  \"\\\"${hash}\\\"\", \"${mtime}\",\n"
+		"\t  \"${cache}\" },\n")
+	math(EXPR i "${i} + 1")
+endforeach()
+
+if(NOT files)
+	message(WARNING "No assets in ${DIST}")
+	set(table "\t{ NULL, NULL, NULL, 0, NULL, NULL, NULL }\n")
+endif()
+
+file(WRITE "${OUT}.tmp"
+"/* Generated by assets.cmake from ${DIST} */\n\n"
+"#include \"assets.h\"\n\n"
+"${data}"
+"const struct asset assets[] = {\n${table}};\n\n"
+"const size_t n_assets = ${i};\n")
+
+# Don't touch the output if nothing changed
+file(READ "${OUT}.tmp" new)
+if(EXISTS "${OUT}")
+	file(READ "${OUT}" old)
+endif()
+
+if(NOT new STREQUAL old)
+	file(RENAME "${OUT}.tmp" "${OUT}")
+else()
+	file(REMOVE "${OUT}.tmp")
+endif()
@@ -0,0 +1,23 @@
+#ifndef LIGHTCTL_ASSETS_H
+#define LIGHTCTL_ASSETS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The gzip'd UI, embedded at build time (see assets.cmake)
+ */
+struct asset {
+	const char *path;     /**< Request path           */
+	const char *type;     /**< MIME type              */
+	const uint8_t *data;  /**< gzip'd contents        */
+	size_t len;           /**< Length of the content  */
+	const char *etag;     /**< Quoted content hash    */
+	const char *modified; /**< Last-Modified date     */
+	const char *cache;    /**< Cache-Control          */
+};
+
+extern const struct asset assets[];
+extern const size_t n_assets;
+
+#endif /* LIGHTCTL_ASSETS_H */
@@ -0,0 +1,172 @@
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include <esp_timer.h>
+
+#include "log.h"
+#include "boot.h"
+#include "trace.h"
+
+#define ALL (BOOT_DEP(BOOT_PHASES) - 1)
+
+static const char *TAG = "boot";
+
+static const char *const names[BOOT_STEPS] = {
+	[BOOT_NVS]    = "nvs",
+	[BOOT_GPIO]   = "gpio",
+	[BOOT_WIFI]   = "wifi",
+	[BOOT_RTC]    = "rtc",
+	[BOOT_DIM]    = "dim",
+	[BOOT_SCHED]  = "sched",
+	[BOOT_CTL]    = "ctl",
+	[BOOT_MDNS]   = "mdns",
+	[BOOT_LIGHTS] = "lights",
+	[BOOT_IP]     = "ip",
+	[BOOT_HTTP]   = "http",
+};
+
+/**
+ * A phase's times are written by whoever ran it, before it's marked
+ * done; A milestone's, by whoever reached it first.
+ */
+static struct {
+	int64_t start; /**< Started, or milestone reached */
+	int64_t end;   /**< Done                          */
+	uint8_t core;  /**< Core it ran on                */
+} at[BOOT_STEPS];
+
+static atomic_uint taken;   /**< Phases started      */
+static atomic_uint done;    /**< Phases done         */
+static atomic_uint marked;  /**< Milestones reached  */
+
+/* Given whenever a phase is done, for app_main() to wait on */
+static SemaphoreHandle_t ready;
+
+static void run(const struct boot_phase *p, unsigned int i)
+{
+	at[i].core  = (uint8_t)xPortGetCoreID();
+	at[i].start = esp_timer_get_time();
+	trace(TR_BOOT, (uint8_t)i);
+	p[i].fn();
+	trace(TR_BOOT_END, (uint8_t)i);
+	at[i].end = esp_timer_get_time();
+
+	atomic_fetch_or_explicit(&done, BOOT_DEP(i), memory_order_release);
+	if (ready) xSemaphoreGive(ready);
+}
+
+/**
+ * Take ready phases until they're all done. If none is ready, the rest
+ * are waiting on one being run elsewhere: app_main() waits for it, and
+ * the helper quits.
+ */
+static void work(const struct boot_phase *p, int wait)
+{
+	unsigned int d, i;
+
+	for (;;) {
+		d = atomic_load_explicit(&done, memory_order_acquire);
+		if (d == ALL)
+			return;
+
+		for (i = 0; i < BOOT_PHASES; i++) {
+			if ((p[i].deps & d) != p[i].deps ||
+			    atomic_load(&taken) & BOOT_DEP(i))
+				continue;
+			if (!(atomic_fetch_or(&taken, BOOT_DEP(i)) &
+			      BOOT_DEP(i)))
+				break;
+		}
+
+		if (i < BOOT_PHASES) run(p, i);
+		else if (!wait) return;
+		else xSemaphoreTake(ready, portMAX_DELAY);
+	}
+}
+
+static void helper(void *arg)
+{
+	work(arg, 0);
+	vTaskDelete(NULL);
+}
+
+void boot_run(const struct boot_phase *phases)
+{
+	int64_t end = 0;
+	unsigned int i;
+
+	/* Without the semaphore, there's no helper, and nothing to wait on */
+	if ((ready = xSemaphoreCreateBinary())) {
+		xTaskCreatePinnedToCore(helper, "lightctl_boot",
+		                        CONFIG_LIGHTCTL_BOOT_STACK_SIZE,
+		                        (void *)phases, uxTaskPriorityGet(NULL),
+		                        NULL, portNUM_PROCESSORS - 1 -
+		                        xPortGetCoreID());
+	}
+
+	/* The report itself is left to GET /boot */
+	work(phases, 1);
+	for (i = 0; i < BOOT_PHASES; i++) {
+		if (at[i].end > end)
+			end = at[i].end;
+	}
+
+	info("phases done %u us after boot", (unsigned int)end);
+}
+
+int64_t boot_mark(unsigned int step)
+{
+	int64_t t = esp_timer_get_time();
+
+	if (step < BOOT_PHASES || step >= BOOT_STEPS ||
+	    atomic_fetch_or(&marked, BOOT_DEP(step)) & BOOT_DEP(step))
+		return 0;
+
+	at[step].core  = (uint8_t)xPortGetCoreID();
+	at[step].start = t;
+	trace(TR_BOOT_MARK, (uint8_t)step);
+	return t;
+}
+
+/**
+ * A line per phase: The core it ran on, when it started and finished,
+ * and how long it took, in microseconds since boot; Then a line per
+ * milestone, with when it was reached.
+ */
+size_t boot_format(char *buf, size_t len)
+{
+	unsigned int d = atomic_load_explicit(&done, memory_order_acquire);
+	unsigned int i;
+	size_t n;
+	int ret;
+
+	ret = snprintf(buf, len, "%-6s %4s %10s %10s %10s\n",
+	               "step", "core", "start_us", "end_us", "us");
+	for (n = 0, i = 0; ret >= 0 && (size_t)ret < len - n; i++) {
+		n += (size_t)ret;
+		if (i >= BOOT_STEPS)
+			return n;
+
+		if (i < BOOT_PHASES && d & BOOT_DEP(i)) {
+			ret = snprintf(buf + n, len - n,
+			               "%-6s %4u %10lld %10lld %10lld\n",
+			               names[i], at[i].core,
+			               (long long)at[i].start,
+			               (long long)at[i].end,
+			               (long long)(at[i].end - at[i].start));
+		} else if (i >= BOOT_PHASES && at[i].start) {
+			ret = snprintf(buf + n, len - n,
+			               "%-6s %4u %10lld\n", names[i],
+			               at[i].core, (long long)at[i].start);
+		} else {
+			ret = snprintf(buf + n, len - n, "%-6s %4s %10s\n",
+			               names[i], "-", "-");
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef LIGHTCTL_BOOT_H
+#define LIGHTCTL_BOOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Boot pipeline
+ *
+ * Initialization is split into phases, each with the phases it needs
+ * done first. app_main() and a helper task, on the other core, each
+ * take the first phase that's ready, in the order below, until every
+ * phase is done; So the station is started while the DS1302 is read.
+ *
+ * Each phase is timestamped, as are the milestones after it, for the
+ * boot report (GET /boot, and the log).
+ */
+enum {
+	BOOT_NVS,    /**< NVS flash                          */
+	BOOT_GPIO,   /**< Pins, the ISR service, the switch  */
+	BOOT_WIFI,   /**< netif, starting the station        */
+	BOOT_RTC,    /**< DS1302 clock and settings          */
+	BOOT_DIM,    /**< Light channels, presets from NVS   */
+	BOOT_SCHED,  /**< Schedule rules, from NVS           */
+	BOOT_CTL,    /**< Initial commands, control task     */
+	BOOT_MDNS,   /**< mDNS responder                     */
+	BOOT_PHASES,
+	BOOT_LIGHTS = BOOT_PHASES, /**< Lights as they should be */
+	BOOT_IP,     /**< Got an address                     */
+	BOOT_HTTP,   /**< Server started                     */
+	BOOT_STEPS
+};
+
+#define BOOT_DEP(p) (1U << (p))
+
+struct boot_phase {
+	void (*fn)(void); /**< Does the work                */
+	uint32_t deps;    /**< BOOT_DEP()s to be done first */
+};
+
+/**
+ * Run the phases, indexed by BOOT_*, returning once they're all done
+ */
+void boot_run(const struct boot_phase *phases);
+
+/**
+ * Note that a milestone was reached. Returns the time it was, as in
+ * esp_timer_get_time(), the first time, and 0 after that.
+ */
+int64_t boot_mark(unsigned int step);
+
+/**
+ * Format the boot report as text, returning the length, which is 0 if
+ * it didn't fit.
+ */
+size_t boot_format(char *buf, size_t len);
+
+#endif /* LIGHTCTL_BOOT_H */
@@ -0,0 +1,282 @@
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include <freertos/FreeRTOS.h>
+
+#include <esp_timer.h>
+#include <esp_sntp.h>
+
+#include "log.h"
+#include "event.h"
+#include "ctl.h"
+#include "dallas.h"
+#include "clock.h"
+
+#define SECONDS 1000000
+#define PPB     1000000000LL
+
+/**
+ * Error to keep the system clock within, and past which it's stepped
+ * rather than slewed, in us
+ */
+#define ERR  ((int64_t)CONFIG_LIGHTCTL_CLOCK_ERR_MS * 1000)
+#define STEP ((int64_t)CONFIG_LIGHTCTL_CLOCK_STEP_MS * 1000)
+
+/**
+ * SNTP poll interval bounds, in s. In low-power mode, each poll wakes
+ * the WiFi, so that's not done any more often than it was.
+ */
+#if CONFIG_LIGHTCTL_LOWPOWER && \
+    CONFIG_LIGHTCTL_LOWPOWER_SYNC_MIN > CONFIG_LIGHTCTL_CLOCK_POLL_MIN
+#define POLL_MIN (CONFIG_LIGHTCTL_LOWPOWER_SYNC_MIN * 60U)
+#else
+#define POLL_MIN (CONFIG_LIGHTCTL_CLOCK_POLL_MIN * 60U)
+#endif
+#define POLL_MAX (CONFIG_LIGHTCTL_CLOCK_POLL_MAX * 60U)
+
+/**
+ * Replies closer together than this don't say much about the drift,
+ * e.g. the one right after reconnecting. The DS1302 only has whole
+ * seconds, so its drift takes longer to show.
+ */
+#define BASELINE     (60 * SECONDS)
+#define RTC_BASELINE (6 * 3600)
+
+/**
+ * More drift than this is taken to be a bad reply
+ */
+#define MAX_PPB 500000
+
+static const char *TAG = "clock";
+static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t timer;
+
+/**
+ * An SNTP reply, and the clocks as it came in
+ */
+struct sample {
+	int64_t mono;           /**< esp_timer time                */
+	int64_t sys;            /**< System clock, in us           */
+	int64_t ntp;            /**< SNTP time, in us              */
+	int valid;
+};
+
+static struct sample pending;   /**< Reply not yet taken           */
+static struct sample ref;       /**< Last reply taken              */
+static struct sample base;      /**< Reply the drift is taken from */
+static unsigned int drifts;     /**< Drift estimates so far        */
+
+static time_t rtc_at;           /**< DS1302 written, or first read */
+static int32_t rtc_off;         /**< Its offset then               */
+
+static struct clock_stats st, published;
+
+static int64_t now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * SECONDS + tv.tv_usec;
+}
+
+static void to_tv(struct timeval *tv, int64_t us)
+{
+	tv->tv_sec  = (time_t)(us / SECONDS);
+	tv->tv_usec = (suseconds_t)(us % SECONDS);
+}
+
+static void publish(void)
+{
+	portENTER_CRITICAL(&mux);
+	published = st;
+	portEXIT_CRITICAL(&mux);
+}
+
+/**
+ * Called by the SNTP client, in place of esp-idf's, with the time it
+ * got. The clock is left to the control task.
+ */
+void sntp_sync_time(struct timeval *tv)
+{
+	struct sample s;
+
+	s.mono  = esp_timer_get_time();
+	s.sys   = now_us();
+	s.ntp   = (int64_t)tv->tv_sec * SECONDS + tv->tv_usec;
+	s.valid = 1;
+
+	portENTER_CRITICAL(&mux);
+	pending = s;
+	portEXIT_CRITICAL(&mux);
+	ctl_send(TIMESYNC, 0);
+}
+
+/**
+ * SNTP time, as of esp_timer time t, going by the last reply and the
+ * drift since.
+ */
+static int64_t expected(int64_t t)
+{
+	int64_t d = t - ref.mono;
+
+	return ref.ntp + d - d / 1000 * st.esp_ppb / 1000000;
+}
+
+int64_t clock_span(int64_t us)
+{
+	return us + us / 1000 * st.esp_ppb / 1000000;
+}
+
+int64_t clock_poll(void)
+{
+	return (int64_t)st.poll_s * SECONDS;
+}
+
+/**
+ * Slew again once the clock's expected to be half of ERR off, if that's
+ * before the next reply, leaving the other half for the slew to take.
+ */
+static void arm(void)
+{
+	int64_t us;
+
+	esp_timer_stop(timer);
+	if (!st.esp_ppb)
+		return;
+
+	us = ERR / 2 * PPB / llabs(st.esp_ppb);
+	if (us < BASELINE) us = BASELINE;
+	if (us < clock_poll())
+		esp_timer_start_once(timer, (uint64_t)us);
+}
+
+int clock_slew(void)
+{
+	int64_t t = esp_timer_get_time(), err;
+	struct timeval tv;
+	int step = 0;
+
+	if (!ref.valid)
+		return 0;
+
+	err = expected(t) - now_us();
+	if ((step = llabs(err) > STEP)) {
+		to_tv(&tv, expected(t));
+		settimeofday(&tv, NULL);
+		++st.steps;
+		info("stepped by %d ms", (int)(err / 1000));
+	} else if (err) {
+		to_tv(&tv, err);
+		adjtime(&tv, NULL);
+		++st.slews;
+	}
+
+	arm();
+	publish();
+	return step;
+}
+
+/**
+ * Rewrite the DS1302 if it's too far off, otherwise see how far it's
+ * drifted since it was written.
+ */
+static void rtc_check(void)
+{
+	int64_t now = expected(esp_timer_get_time());
+	time_t t = (time_t)(now / SECONDS);
+	int32_t off = (int32_t)(dallas_time() - t);
+	struct timeval tv;
+
+	st.rtc_offset = off;
+	if (abs(off) >= CONFIG_LIGHTCTL_CLOCK_RTC_ERR_S) {
+		info("rtc off by %d s, writing it", off);
+		to_tv(&tv, expected(esp_timer_get_time()));
+		dallas_sync(&tv);
+		++st.rtc_writes;
+		st.rtc_offset = 0;
+		rtc_at        = t;
+		rtc_off       = 0;
+	} else if (!rtc_at) {
+		rtc_at  = t;
+		rtc_off = off;
+	} else if (t - rtc_at >= RTC_BASELINE) {
+		st.rtc_ppb = (int32_t)((int64_t)(off - rtc_off) * PPB /
+		                       (t - rtc_at));
+	}
+}
+
+void clock_sync(void)
+{
+	struct sample s;
+	int64_t d, est, miss;
+
+	portENTER_CRITICAL(&mux);
+	s = pending;
+	pending.valid = 0;
+	portEXIT_CRITICAL(&mux);
+	if (!s.valid)
+		return;
+
+	/* Fast, if esp_timer ran for longer than SNTP time did */
+	if (!base.valid) {
+		base = s;
+	} else if ((d = s.ntp - base.ntp) >= BASELINE) {
+		est = ((s.mono - base.mono) - d) * PPB / d;
+		if (llabs(est) <= MAX_PPB) {
+			st.esp_ppb = (int32_t)(drifts++ ? st.esp_ppb +
+			             (est - st.esp_ppb) / 4 : est);
+		}
+
+		base = s;
+	}
+
+	/* Poll less often while the reply's where the drift said it'd be */
+	++st.samples;
+	st.offset_us = s.ntp - s.sys;
+	miss = llabs(ref.valid ? s.ntp - expected(s.mono) : st.offset_us);
+	if (drifts && miss <= ERR / 2 && st.poll_s < POLL_MAX)
+		st.poll_s = st.poll_s * 2 < POLL_MAX ? st.poll_s * 2 : POLL_MAX;
+	else if (miss > ERR && st.poll_s > POLL_MIN)
+		st.poll_s = st.poll_s / 2 > POLL_MIN ? st.poll_s / 2 : POLL_MIN;
+	sntp_set_sync_interval(st.poll_s * 1000);
+
+	info("offset %d ms, drift %d ppb, polling every %u s",
+	     (int)(st.offset_us / 1000), (int)st.esp_ppb,
+	     (unsigned int)st.poll_s);
+
+	ref = s;
+	clock_slew();
+	rtc_check();
+	publish();
+}
+
+void clock_stats(struct clock_stats *s)
+{
+	portENTER_CRITICAL(&mux);
+	*s = published;
+	portEXIT_CRITICAL(&mux);
+}
+
+static void slew_expired(void *arg)
+{
+	(void)arg;
+	ctl_send(CLOCK, 0);
+}
+
+static esp_timer_create_args_t slew_args = {
+	.name     = "clock_slew",
+	.callback = slew_expired,
+	.dispatch_method = ESP_TIMER_TASK
+};
+
+void clock_init(void)
+{
+	st.poll_s = POLL_MIN;
+	sntp_set_sync_interval(POLL_MIN * 1000);
+	publish();
+
+	if (esp_timer_create(&slew_args, &timer) != ESP_OK)
+		err("failed to create timer");
+}
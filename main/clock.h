@@ -0,0 +1,62 @@
+#ifndef LIGHTCTL_CLOCK_H
+#define LIGHTCTL_CLOCK_H
+
+#include <stdint.h>
+
+/**
+ * Clock discipline
+ *
+ * SNTP replies are taken in place of esp-idf's sntp_sync_time(), which
+ * would just set the clock. The ESP32's drift is estimated from how far
+ * esp_timer has run against SNTP time between replies, and the system
+ * clock is slewed with adjtime() to follow SNTP time as the drift says
+ * it goes, each time it's expected to be half of
+ * CONFIG_LIGHTCTL_CLOCK_ERR_MS off, keeping it within that. An offset
+ * of over CONFIG_LIGHTCTL_CLOCK_STEP_MS is stepped.
+ *
+ * While each reply is within half that error of where the drift said
+ * it'd be, the SNTP poll interval doubles, up to
+ * CONFIG_LIGHTCTL_CLOCK_POLL_MAX minutes; When it's over, it halves,
+ * down to CONFIG_LIGHTCTL_CLOCK_POLL_MIN.
+ *
+ * The DS1302 is read at each reply, and only written when it's more
+ * than CONFIG_LIGHTCTL_CLOCK_RTC_ERR_S off. Its drift is estimated
+ * from how its offset has changed since.
+ */
+struct clock_stats {
+	int64_t offset_us;      /**< SNTP less the system clock, last     */
+	int32_t esp_ppb;        /**< ESP32 drift, fast if positive        */
+	int32_t rtc_ppb;        /**< DS1302 drift, fast if positive       */
+	int32_t rtc_offset;     /**< DS1302 less SNTP, in s               */
+	uint32_t poll_s;        /**< SNTP poll interval                   */
+	uint32_t samples;       /**< SNTP replies                         */
+	uint32_t steps;         /**< Clock steps                          */
+	uint32_t slews;         /**< Clock slews                          */
+	uint32_t rtc_writes;    /**< DS1302 writes                        */
+};
+
+/**
+ * Take the last SNTP reply, on TIMESYNC
+ */
+void clock_sync(void);
+
+/**
+ * Slew the clock to where it's expected to be, on CLOCK. Returns non-zero
+ * if it had to be stepped instead.
+ */
+int clock_slew(void);
+
+/**
+ * The esp_timer time a span of the wall clock's takes, in us
+ */
+int64_t clock_span(int64_t us);
+
+/**
+ * The SNTP poll interval, in us
+ */
+int64_t clock_poll(void);
+
+void clock_stats(struct clock_stats *s);
+void clock_init(void);
+
+#endif /* LIGHTCTL_CLOCK_H */
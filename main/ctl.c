@@ -0,0 +1,256 @@
+
+#include <string.h>
+#include <stdatomic.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include <esp_attr.h>
+#include <esp_timer.h>
+
+#include "log.h"
+#include "ctl.h"
+#include "metrics.h"
+#include "trace.h"
+
+#define MASK (CTL_QUEUE_LEN - 1)
+
+_Static_assert(!(CTL_QUEUE_LEN & MASK), "CTL_QUEUE_LEN isn't a power of 2");
+
+static const char *TAG = "ctl";
+
+/**
+ * Bounded MPSC ring. Each slot's sequence number says whose turn it is:
+ * A producer may fill slot pos % len when it's pos, and the consumer may
+ * take it when it's pos + 1, after which it's pos + len. Producers claim
+ * a position by bumping head; A producer preempted between claiming a
+ * slot and filling it only holds up the consumer, never other producers.
+ */
+static struct slot {
+	atomic_uint seq;
+	struct ctl_cmd cmd;
+} ring[CTL_QUEUE_LEN];
+
+static atomic_uint head;
+static atomic_uint tail;
+
+/**
+ * The consumer sets sleeping before it checks the ring one last time
+ * and blocks on wake; A producer only gives wake if it clears that, so
+ * there's no semaphore traffic while the control task is busy.
+ */
+static SemaphoreHandle_t wake;
+static atomic_int sleeping;
+static void (*handler)(const struct ctl_cmd *c);
+static void (*on_idle)(void);
+
+static atomic_uint posted;
+static atomic_uint full;
+static atomic_uint hwm;
+static uint32_t merged;
+static uint32_t run[CTL_CMDS];
+
+/**
+ * Commands taken out of the ring, to be merged and run. There's only
+ * one consumer, so this needn't be on its stack.
+ */
+static struct ctl_cmd cmds[CTL_QUEUE_LEN];
+
+static int IRAM_ATTR push(const struct ctl_cmd *c)
+{
+	unsigned int pos = atomic_load_explicit(&head, memory_order_relaxed);
+	unsigned int depth, max;
+	struct slot *s;
+	int diff;
+
+	for (;;) {
+		s    = &ring[pos & MASK];
+		diff = (int)(atomic_load_explicit(&s->seq, memory_order_acquire)
+		             - pos);
+		if (!diff) {
+			if (atomic_compare_exchange_weak_explicit(&head, &pos,
+			    pos + 1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = atomic_load_explicit(&head, memory_order_relaxed);
+		}
+	}
+
+	s->cmd   = *c;
+	s->cmd.t = esp_timer_get_time();
+	atomic_store_explicit(&s->seq, pos + 1, memory_order_release);
+	atomic_fetch_add_explicit(&posted, 1, memory_order_relaxed);
+	trace(TR_POST, c->id);
+
+	depth = pos + 1 - atomic_load_explicit(&tail, memory_order_relaxed);
+	max   = atomic_load_explicit(&hwm, memory_order_relaxed);
+	while (depth > max && !atomic_compare_exchange_weak_explicit(&hwm,
+	       &max, depth, memory_order_relaxed, memory_order_relaxed));
+	return 0;
+}
+
+static int pop(struct ctl_cmd *c)
+{
+	unsigned int pos = atomic_load_explicit(&tail, memory_order_relaxed);
+	struct slot *s   = &ring[pos & MASK];
+
+	if (atomic_load_explicit(&s->seq, memory_order_acquire) != pos + 1)
+		return 0;
+
+	*c = s->cmd;
+	atomic_store_explicit(&s->seq, pos + CTL_QUEUE_LEN,
+	                      memory_order_release);
+	atomic_store_explicit(&tail, pos + 1, memory_order_relaxed);
+	return 1;
+}
+
+int ctl_post(const struct ctl_cmd *c, TickType_t ticks)
+{
+	while (push(c)) {
+		if (!ticks--) {
+			atomic_fetch_add(&full, 1);
+			return -1;
+		}
+
+		vTaskDelay(1);
+	}
+
+	if (atomic_exchange(&sleeping, 0))
+		xSemaphoreGive(wake);
+	return 0;
+}
+
+int IRAM_ATTR ctl_post_isr(const struct ctl_cmd *c)
+{
+	BaseType_t woken = pdFALSE;
+
+	if (push(c)) {
+		atomic_fetch_add(&full, 1);
+		return -1;
+	}
+
+	if (atomic_exchange(&sleeping, 0)) {
+		xSemaphoreGiveFromISR(wake, &woken);
+		if (woken) portYIELD_FROM_ISR();
+	}
+
+	return 0;
+}
+
+int ctl_send(uint8_t id, TickType_t ticks)
+{
+	struct ctl_cmd c = { .id = id };
+	return ctl_post(&c, ticks);
+}
+
+int IRAM_ATTR ctl_send_isr(uint8_t id)
+{
+	struct ctl_cmd c = { .id = id };
+	return ctl_post_isr(&c);
+}
+
+static int on_off(uint8_t id)
+{
+	return id == ON || id == OFF;
+}
+
+/**
+ * Merge redundant commands, in place, returning how many are left
+ */
+static unsigned int merge(struct ctl_cmd *c, unsigned int n)
+{
+	unsigned int i, j = 0;
+
+	for (i = 0; i < n; i++) {
+		if (j && c[i].id != BATCH && c[i].id != DIM &&
+		    ((on_off(c[i].id) && on_off(c[j - 1].id)) ||
+		     (c[i].id == c[j - 1].id && !c[i].seq &&
+		      !c[j - 1].seq))) {
+			c[j - 1].id = c[i].id;
+			if (c[i].seq) c[j - 1].seq = c[i].seq;
+			continue;
+		}
+
+		if (i != j) c[j] = c[i];
+		++j;
+	}
+
+	merged += n - j;
+	return j;
+}
+
+unsigned int ctl_run(void)
+{
+	unsigned int i, n, total = 0;
+	int64_t t;
+
+	for (;;) {
+		for (n = 0; n < CTL_QUEUE_LEN && pop(&cmds[n]); n++);
+		if (!n) break;
+
+		n = merge(cmds, n);
+		for (i = 0; i < n; i++) {
+			if (cmds[i].id < CTL_CMDS) ++run[cmds[i].id];
+			metrics_since(M_QUEUE, cmds[i].t);
+			trace(TR_CMD, cmds[i].id);
+			t = esp_timer_get_time();
+			handler(&cmds[i]);
+			metrics_since(M_CONTROL, t);
+			trace(TR_CMD_END, cmds[i].id);
+		}
+
+		total += n;
+	}
+
+	if (total && on_idle)
+		on_idle();
+	return total;
+}
+
+unsigned int ctl_wait(TickType_t ticks)
+{
+	unsigned int pos = atomic_load_explicit(&tail, memory_order_relaxed);
+
+	atomic_store(&sleeping, 1);
+	if (atomic_load(&ring[pos & MASK].seq) != pos + 1)
+		xSemaphoreTake(wake, ticks);
+	atomic_store(&sleeping, 0);
+	return ctl_run();
+}
+
+void ctl_stats(struct ctl_stats *s)
+{
+	s->posted = atomic_load(&posted);
+	s->full   = atomic_load(&full);
+	s->hwm    = atomic_load(&hwm);
+	s->merged = merged;
+	memcpy(s->run, run, sizeof(run));
+}
+
+static void task(void *arg)
+{
+	(void)arg;
+	for (;;) ctl_wait(portMAX_DELAY);
+}
+
+void ctl_init(void (*fn)(const struct ctl_cmd *c), void (*idle)(void))
+{
+	unsigned int i;
+
+	for (i = 0; i < CTL_QUEUE_LEN; i++)
+		atomic_init(&ring[i].seq, i);
+
+	handler = fn;
+	on_idle = idle;
+	if (!(wake = xSemaphoreCreateBinary()))
+		err("failed to create semaphore");
+}
+
+void ctl_start(void)
+{
+	if (xTaskCreate(task, "lightctl_ctl", CONFIG_LIGHTCTL_CTL_STACK_SIZE,
+	                NULL, CONFIG_LIGHTCTL_CTL_PRIORITY, NULL) != pdPASS)
+		err("failed to start the control task");
+}
@@ -0,0 +1,85 @@
+#ifndef LIGHTCTL_CTL_H
+#define LIGHTCTL_CTL_H
+
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+
+#include "event.h"
+
+/**
+ * Control queue
+ *
+ * Commands from the ISRs, the http handlers, the wifi callbacks and the
+ * timers go into a fixed-size, lock-free ring, which the control task
+ * is the only consumer of. Whatever is queued is taken out at once, and
+ * redundant commands are merged before they're carried out:
+ *
+ *  - A run of ON and OFF commands becomes the last of them;
+ *  - A run of the same command, without data, becomes one.
+ *
+ * A merged command takes the completion of the last one in the run
+ * which had one, as only one http handler waits on a command at a time,
+ * and the time the first one was queued. So an ON from /on, followed by
+ * an OFF without a completion (as from the schedule), completes /on once
+ * the lights have been switched off; /on replies with the status line,
+ * which has them off.
+ */
+#define CTL_QUEUE_LEN 16 /**< Commands in the ring (power of 2) */
+
+struct ctl_cmd {
+	uint8_t id;             /**< Command, as in event.h     */
+	int64_t t;              /**< Time queued (filled in)    */
+	union {
+		uint32_t seq;       /**< Completion, or 0 if none   */
+		struct batch batch; /**< BATCH (starts with seq)    */
+		struct dim dim;     /**< DIM (starts with seq)      */
+	};
+};
+
+struct ctl_stats {
+	uint32_t posted;        /**< Commands queued            */
+	uint32_t full;          /**< Commands dropped, as full  */
+	uint32_t merged;        /**< Commands merged away       */
+	uint32_t hwm;           /**< Most commands queued       */
+	uint32_t run[CTL_CMDS]; /**< Commands carried out, by id */
+};
+
+/**
+ * Queue a command, waiting up to ticks for room. Returns 0 on success,
+ * or -1 if the queue stayed full.
+ */
+int ctl_post(const struct ctl_cmd *c, TickType_t ticks);
+int ctl_post_isr(const struct ctl_cmd *c);
+
+/**
+ * Queue a command without data
+ */
+int ctl_send(uint8_t id, TickType_t ticks);
+int ctl_send_isr(uint8_t id);
+
+/**
+ * Carry out everything that's queued, including commands queued along
+ * the way, returning the number of commands run. Only one caller may
+ * be running this at a time; On the target, that's the control task.
+ */
+unsigned int ctl_run(void);
+
+/**
+ * Wait up to ticks for a command, then run the queue
+ */
+unsigned int ctl_wait(TickType_t ticks);
+
+void ctl_stats(struct ctl_stats *s);
+
+/**
+ * Set up the queue. fn carries out each command, and idle is called
+ * whenever the queue has been run dry.
+ */
+void ctl_init(void (*fn)(const struct ctl_cmd *c), void (*idle)(void));
+
+/**
+ * Start the control task
+ */
+void ctl_start(void);
+
+#endif /* LIGHTCTL_CTL_H */
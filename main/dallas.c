@@ -3,12 +3,18 @@
 #include <stdint.h>
 #include <string.h>
 #include <time.h>
+#include <sys/time.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
-#include <esp_sntp.h>
+#include <esp_timer.h>
+#include <esp_rom_sys.h>
 #include <driver/gpio.h>
 
+#if CONFIG_DALLAS_SPI
+#include <driver/spi_master.h>
+#endif
+
 #ifdef CONFIG_PM_ENABLE
 #include <esp_pm.h>
 #endif
@@ -16,6 +22,7 @@
 #include "log.h"
 #include "settings.h"
 #include "dallas.h"
+#include "metrics.h"
 
 /**
  * The calendar info is bcd.
@@ -23,7 +30,21 @@
 #define bcd2i(B) (((((B) & 0xf0) >> 4) * 10) + ((B) & 0x0f))
 #define i2bcd(I) ((((I) / 10) << 4) + ((I) % 10))
 
+/**
+ * Settings byte at the given address, from a RAM burst
+ */
+#define RAM(A) ram[((A) - SETTINGS_SW) >> 1]
+
+/**
+ * Bus timing, from the datasheet at 2 V, in us, rounded up
+ */
+#define TCC  4 /**< CE to SCLK setup                           */
+#define TCWH 4 /**< CE inactive time                           */
+#define TCLK 1 /**< SCLK low or high, data setup/hold and tCDZ */
+
 static const char *TAG = "dallas";
+static int64_t xfer_t = -1; /**< When CE went high, or -1         */
+static int64_t idle_t;      /**< When CE went low, rounded up     */
 
 static gpio_config_t ce_conf = {
 	.mode         = GPIO_MODE_OUTPUT,
@@ -44,16 +65,29 @@ static gpio_config_t sd_conf = {
 
 /**
  * We'll need this pm lock to ensure the esp32 doesn't go to sleep
- * while we're busy bit-banging the dallas
+ * while we're busy bit-banging the dallas. The SPI driver takes a lock
+ * of its own, for the APB clock, for only as long as a transaction.
  */
 #ifdef CONFIG_PM_ENABLE
 static esp_pm_lock_handle_t pm_lock;
 #endif
 
+/**
+ * CE has to stay low for tCWH between transfers, which it usually
+ * has by the time we get to the next one.
+ */
+static void bus_wait(void)
+{
+	int64_t us = idle_t + TCWH - esp_timer_get_time();
+
+	if (us > 0) esp_rom_delay_us((uint32_t)us);
+}
+
 /**
  * Setup the GPIO pins for a transfer
  *
- * vTaskDelay() is used here to ensure tCC (CE-to-CLK setup) > 1 us.
+ * The delays here are all a few us, so we busy-wait rather than give
+ * up a tick to the scheduler.
  */
 static void dallas_xfer_start(void)
 {
@@ -61,23 +95,31 @@ static void dallas_xfer_start(void)
 	esp_pm_lock_acquire(pm_lock);
 #endif
 
+	bus_wait();
 	gpio_set_direction(CONFIG_DALLAS_GPIO_SDA, GPIO_MODE_OUTPUT);
 	gpio_set_level(CONFIG_DALLAS_GPIO_SDA, 0);
 	gpio_set_level(CONFIG_DALLAS_GPIO_SCL, 0);
 	gpio_set_level(CONFIG_DALLAS_GPIO_CE, 1);
-	vTaskDelay(1);
+	xfer_t = esp_timer_get_time();
+	esp_rom_delay_us(TCC);
 }
 
 /**
  * Reset the GPIO pins post-xfer
+ *
+ * The DS1302 may still be driving SDA as CE falls, so we only drive it
+ * again once it's had tCDZ to let go.
  */
 static void dallas_xfer_stop(void)
 {
 	gpio_set_level(CONFIG_DALLAS_GPIO_SCL, 0);
+	gpio_set_level(CONFIG_DALLAS_GPIO_CE, 0);
+	idle_t = esp_timer_get_time() + 1;
+	esp_rom_delay_us(TCLK);
 	gpio_set_direction(CONFIG_DALLAS_GPIO_SDA, GPIO_MODE_OUTPUT);
 	gpio_set_level(CONFIG_DALLAS_GPIO_SDA, 0);
-	gpio_set_level(CONFIG_DALLAS_GPIO_CE, 0);
-	vTaskDelay(1);
+	if (xfer_t >= 0) metrics_since(M_DALLAS, xfer_t);
+	xfer_t = -1;
 
 #if CONFIG_PM_ENABLE
 	esp_pm_lock_release(pm_lock);
@@ -91,6 +133,9 @@ static void dallas_xfer_stop(void)
  * rising edge of SCL, and outputs the first bit of the value on the
  * falling edge of SCL. So we have to change the pin state in between to
  * avoid a conflict.
+ *
+ * Each half of the clock is held for tCL/tCH, which also covers the
+ * data setup and hold times.
  */
 static void _dallas_tx(uint8_t b)
 {
@@ -100,14 +145,17 @@ static void _dallas_tx(uint8_t b)
 	for (i = 8; i; i--, b >>= 1) {
 		gpio_set_level(CONFIG_DALLAS_GPIO_SCL, 0);
 		gpio_set_level(CONFIG_DALLAS_GPIO_SDA, b & 1);
+		esp_rom_delay_us(TCLK);
 		gpio_set_level(CONFIG_DALLAS_GPIO_SCL, 1);
+		esp_rom_delay_us(TCLK);
 	}
 
 	gpio_set_direction(CONFIG_DALLAS_GPIO_SDA, GPIO_MODE_INPUT);
 }
 
 /**
- * Bits will be present on SDA on the falling edge of SCL
+ * Bits will be present on SDA on the falling edge of SCL, once tCDD
+ * has passed.
  */
 static uint8_t _dallas_rx(void)
 {
@@ -116,24 +164,145 @@ static uint8_t _dallas_rx(void)
 
 	for (i = 0; i < 8; i++) {
 		gpio_set_level(CONFIG_DALLAS_GPIO_SCL, 0);
+		esp_rom_delay_us(TCLK);
 		b |= gpio_get_level(CONFIG_DALLAS_GPIO_SDA) << i;
 		gpio_set_level(CONFIG_DALLAS_GPIO_SCL, 1);
+		esp_rom_delay_us(TCLK);
 	}
 
 	return b;
 }
 
 /**
- * Set the write protect bit
+ * A transfer, with CE high throughout: The command byte, then n bytes,
+ * read into in if it's a read, or written from out otherwise.
  */
-static void dallas_set_wp(unsigned int wp)
+static void bitbang_xfer(uint8_t cmd, const uint8_t *out, uint8_t *in,
+                         size_t n)
 {
 	dallas_xfer_start();
-	_dallas_tx(0x8e);
-	_dallas_tx(wp ? 0x80 : 0);
+	_dallas_tx(cmd);
+	if (cmd & 1) while (n--) *in++ = _dallas_rx();
+	else while (n--) _dallas_tx(*out++);
 	dallas_xfer_stop();
 }
 
+static void (*xfer)(uint8_t cmd, const uint8_t *out, uint8_t *in,
+                    size_t n) = bitbang_xfer;
+
+#if CONFIG_DALLAS_SPI
+#define BUS HSPI_HOST
+
+static spi_device_handle_t spi;
+
+static const spi_bus_config_t bus_conf = {
+	.mosi_io_num     = CONFIG_DALLAS_GPIO_SDA,
+	.miso_io_num     = -1,
+	.sclk_io_num     = CONFIG_DALLAS_GPIO_SCL,
+	.quadwp_io_num   = -1,
+	.quadhd_io_num   = -1,
+	.max_transfer_sz = 32
+};
+
+/**
+ * The DS1302 samples SDA as SCL rises, and shifts a bit out as it falls,
+ * LSB first, which is SPI mode 0. SDA is both ways, so the bus is 3-wire
+ * and half-duplex, and CE is active high. CE is raised 4 us (tCC, at 2 V)
+ * before the first clock; Between transfers, bus_wait() keeps it down
+ * for tCWH.
+ *
+ * The command byte is sent as data, since the command phase would be
+ * sent MSB first.
+ */
+static const spi_device_interface_config_t dev_conf = {
+	.mode             = 0,
+	.clock_speed_hz   = CONFIG_DALLAS_SPI_HZ,
+	.spics_io_num     = CONFIG_DALLAS_GPIO_CE,
+	.flags            = SPI_DEVICE_3WIRE | SPI_DEVICE_HALFDUPLEX |
+	                    SPI_DEVICE_BIT_LSBFIRST | SPI_DEVICE_POSITIVE_CS,
+	.cs_ena_pretrans  = (CONFIG_DALLAS_SPI_HZ * 4 + 999999) / 1000000,
+	.cs_ena_posttrans = 1,
+	.queue_size       = 1
+};
+
+/**
+ * Give the pins back to the GPIO matrix, and bit-bang from now on
+ */
+static void spi_drop(void)
+{
+	if (spi) spi_bus_remove_device(spi);
+	spi_bus_free(BUS);
+	spi  = NULL;
+	xfer = bitbang_xfer;
+	gpio_config(&ce_conf);
+	gpio_config(&sd_conf);
+}
+
+/**
+ * A transfer as one transaction, without DMA, which can't do both a
+ * write and a read phase. That's 64 bytes at most, and a RAM burst is
+ * 32.
+ */
+static void spi_xfer(uint8_t cmd, const uint8_t *out, uint8_t *in,
+                     size_t n)
+{
+	spi_transaction_t t;
+	uint8_t buf[32];
+	esp_err_t ret;
+
+	if (n > sizeof(buf) - 1)
+		n = sizeof(buf) - 1;
+
+	memset(&t, 0, sizeof(t));
+	buf[0]      = cmd;
+	t.tx_buffer = buf;
+	if (cmd & 1) {
+		t.length    = 8;
+		t.rxlength  = 8 * n;
+		t.rx_buffer = in;
+	} else {
+		memcpy(buf + 1, out, n);
+		t.length = 8 * (n + 1);
+	}
+
+	bus_wait();
+	xfer_t = esp_timer_get_time();
+	ret    = spi_device_polling_transmit(spi, &t);
+	idle_t = esp_timer_get_time() + 1;
+	metrics_since(M_DALLAS, xfer_t);
+	xfer_t = -1;
+
+	if (ret != ESP_OK) {
+		err("transfer failed (%d), bit-banging", ret);
+		spi_drop();
+		bitbang_xfer(cmd, out, in, n);
+	}
+}
+
+static void spi_init(void)
+{
+	if (spi_bus_initialize(BUS, &bus_conf, 0) != ESP_OK ||
+	    spi_bus_add_device(BUS, &dev_conf, &spi) != ESP_OK) {
+		err("no spi bus, bit-banging");
+		spi_drop();
+		return;
+	}
+
+	xfer = spi_xfer;
+	info("on spi, at %u kHz", CONFIG_DALLAS_SPI_HZ / 1000);
+}
+#endif /* CONFIG_DALLAS_SPI */
+
+/**
+ * Set the write protect bit
+ */
+static void dallas_set_wp(unsigned int wp)
+{
+	uint8_t b = wp ? 0x80 : 0;
+
+	xfer(0x8e, &b, NULL, 1);
+}
+
 /**
  * Read a byte from the dallas
  */
@@ -141,10 +310,7 @@ uint8_t dallas_read(uint8_t addr)
 {
 	uint8_t b = 0;
 
-	dallas_xfer_start();
-	_dallas_tx(addr | 1);
-	b = _dallas_rx();
-	dallas_xfer_stop();
+	xfer(addr | 1, NULL, &b, 1);
 	return b;
 }
 
@@ -154,36 +320,54 @@ uint8_t dallas_read(uint8_t addr)
 void dallas_write(uint8_t addr, uint8_t b)
 {
 	dallas_set_wp(0);
-	dallas_xfer_start();
-	_dallas_tx(addr & ~1);
-	_dallas_tx(b);
-	dallas_xfer_stop();
+	xfer(addr & ~1, &b, NULL, 1);
 	dallas_set_wp(1);
 }
 
 /**
- * Set the system clock from the dallas
+ * Read a number of bytes in burst mode
  */
-void dallas_set_system_clock(void)
+void dallas_read_burst(uint8_t addr, uint8_t *buf, size_t n)
+{
+	xfer(addr | 1, NULL, buf, n);
+}
+
+/**
+ * Write a number of bytes in burst mode
+ */
+void dallas_write_burst(uint8_t addr, const uint8_t *buf, size_t n)
+{
+	dallas_set_wp(0);
+	xfer(addr & ~1, buf, NULL, n);
+	dallas_set_wp(1);
+}
+
+/**
+ * Time from the clock registers
+ */
+static time_t clk_time(const uint8_t *clk, struct tm *tm)
+{
+	memset(tm, 0, sizeof(*tm));
+	tm->tm_sec  = bcd2i(clk[0] & 0x7f);
+	tm->tm_min  = bcd2i(clk[1] & 0x7f);
+	tm->tm_hour = bcd2i(clk[2] & 0x3f);
+	tm->tm_mday = bcd2i(clk[3] & 0x3f);
+	tm->tm_mon  = bcd2i(clk[4] & 0x1f) - 1;
+	tm->tm_wday = bcd2i(clk[5] & 7) - 1;
+	tm->tm_year = bcd2i(clk[6]) + 100;
+	return mktime(tm);
+}
+
+/**
+ * Set the system clock from the clock registers
+ */
+static void set_system_clock(const uint8_t *clk)
 {
 	struct timeval tv;
 	struct tm tm;
 
-	info("fetching time");
-	memset(&tm, 0, sizeof(tm));
 	memset(&tv, 0, sizeof(tv));
-
-	dallas_xfer_start();
-	tm.tm_sec  = bcd2i(dallas_read(0x80) & 0x7f);
-	tm.tm_min  = bcd2i(dallas_read(0x82) & 0x7f);
-	tm.tm_hour = bcd2i(dallas_read(0x84) & 0x3f);
-	tm.tm_mday = bcd2i(dallas_read(0x86) & 0x3f);
-	tm.tm_mon  = bcd2i(dallas_read(0x88) & 0x1f) - 1;
-	tm.tm_wday = bcd2i(dallas_read(0x8a) & 7) - 1;
-	tm.tm_year = bcd2i(dallas_read(0x8c)) + 100;
-	dallas_xfer_stop();
-
-	tv.tv_sec = mktime(&tm);
+	tv.tv_sec = clk_time(clk, &tm);
 	settimeofday(&tv, NULL);
 	info("got time: %04u-%02u-%02u %02u:%02u:%02u",
 	     tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
@@ -191,32 +375,57 @@ void dallas_set_system_clock(void)
 }
 
 /**
- * Called when we get the time via NTP
+ * Set the system clock from the dallas
+ */
+void dallas_set_system_clock(void)
+{
+	uint8_t clk[8];
+
+	info("fetching time");
+	dallas_read_burst(DALLAS_CLOCK_BURST, clk, sizeof(clk));
+	set_system_clock(clk);
+}
+
+/**
+ * Read the time from the dallas
+ */
+time_t dallas_time(void)
+{
+	uint8_t clk[8];
+	struct tm tm;
+
+	dallas_read_burst(DALLAS_CLOCK_BURST, clk, sizeof(clk));
+	return clk_time(clk, &tm);
+}
+
+/**
+ * Write the time to the dallas: The time given, to the nearest second,
+ * or the system clock.
  */
 void dallas_sync(struct timeval *tv)
 {
 	struct tm *tm;
 	time_t now = time(NULL);
-	(void)tv;
+	uint8_t clk[8];
 
+	if (tv) now = tv->tv_sec + (tv->tv_usec >= 500000);
 	tm = gmtime(&now);
 	info("syncing time: %04u-%02u-%02u %02u:%02u:%02u",
 	     tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
 	     tm->tm_hour, tm->tm_min, tm->tm_sec);
 
+	/* Setting WP with the last byte */
+	clk[0] = i2bcd(tm->tm_sec);
+	clk[1] = i2bcd(tm->tm_min);
+	clk[2] = i2bcd(tm->tm_hour);
+	clk[3] = i2bcd(tm->tm_mday);
+	clk[4] = i2bcd(tm->tm_mon + 1);
+	clk[5] = i2bcd(tm->tm_wday + 1);
+	clk[6] = i2bcd(tm->tm_year - 100);
+	clk[7] = 0x80;
+
 	dallas_set_wp(0);
-	dallas_xfer_start();
-	_dallas_tx(0xbe);
-	_dallas_tx(i2bcd(tm->tm_sec));
-	_dallas_tx(i2bcd(tm->tm_min));
-	_dallas_tx(i2bcd(tm->tm_hour));
-	_dallas_tx(i2bcd(tm->tm_mday));
-	_dallas_tx(i2bcd(tm->tm_mon + 1));
-	_dallas_tx(i2bcd(tm->tm_wday + 1));
-	_dallas_tx(i2bcd(tm->tm_year - 100));
-	_dallas_tx(0x80); /* Set WP */
-	dallas_xfer_stop();
-	sntp_set_time_sync_notification_cb(NULL);
+	xfer(DALLAS_CLOCK_BURST, clk, NULL, sizeof(clk));
 }
 
 /**
@@ -224,23 +433,19 @@ void dallas_sync(struct timeval *tv)
  */
 static void dallas_init_ram(void)
 {
-	unsigned int i;
+	uint8_t ram[SETTINGS_LEN];
 
 	info("initializng settings ram...");
-	dallas_set_wp(0);
-	dallas_xfer_start();
-	_dallas_tx(0xfe);
-	for (i = 0xc0; i <= SETTINGS_V; i += 2) {
-		if (i == SETTINGS_V)
-			_dallas_tx(SETTINGS_VALID);
-		else _dallas_tx(0);
-	}
-	dallas_xfer_stop();
-	dallas_set_wp(1);
+	memset(ram, 0, sizeof(ram));
+	RAM(SETTINGS_V) = SETTINGS_VALID;
+	dallas_write_burst(DALLAS_RAM_BURST, ram, sizeof(ram));
 }
 
 void dallas_init(void)
 {
+	uint8_t clk[8], ram[SETTINGS_LEN];
+	int64_t start = esp_timer_get_time();
+
 #if CONFIG_PM_ENABLE
 	ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0,
 	                "ds1302", &pm_lock));
@@ -259,32 +464,40 @@ void dallas_init(void)
 	gpio_set_drive_capability(CONFIG_DALLAS_GPIO_SDA, GPIO_DRIVE_CAP_1);
 	vTaskDelay(pdMS_TO_TICKS(1));
 
-	/* Reset the dallas and clear the Clock Halt flag */
+	/* Reset the dallas, and fetch the clock and settings */
 	dallas_xfer_stop();
-	dallas_set_wp(0);
-	dallas_write(0x80, dallas_read(0x80) & ~0x80);
-	dallas_set_wp(1);
+#if CONFIG_DALLAS_SPI
+	if (!spi) spi_init();
+#endif
+	dallas_read_burst(DALLAS_CLOCK_BURST, clk, sizeof(clk));
+	dallas_read_burst(DALLAS_RAM_BURST, ram, sizeof(ram));
+
+	/* Clear the Clock Halt flag */
+	if (clk[0] & 0x80)
+		dallas_write(0x80, clk[0] &= ~0x80);
 
 	/* Ensure we have valid settings */
 	settings_lock();
 	memset(&settings, 0, sizeof(settings));
-	if (dallas_read(SETTINGS_V) == SETTINGS_VALID) {
+	if (RAM(SETTINGS_V) == SETTINGS_VALID) {
 		info("reading settings");
 		settings.override_sw = gpio_get_level(CONFIG_GPIO_SWON);
 		if (gpio_get_level(CONFIG_GPIO_SWOFF))
 			settings.override_sw |= 2;
 
-		settings.light_sw = dallas_read(SETTINGS_SW);
-		settings.sched_sw = dallas_read(SETTINGS_SSW);
-		settings.shr      = dallas_read(SETTINGS_SHR);
-		settings.smn      = dallas_read(SETTINGS_SMN);
-		settings.ehr      = dallas_read(SETTINGS_EHR);
-		settings.emn      = dallas_read(SETTINGS_EMN);
+		settings.light_sw = RAM(SETTINGS_SW);
+		settings.sched_sw = RAM(SETTINGS_SSW);
+		settings.shr      = RAM(SETTINGS_SHR);
+		settings.smn      = RAM(SETTINGS_SMN);
+		settings.ehr      = RAM(SETTINGS_EHR);
+		settings.emn      = RAM(SETTINGS_EMN);
 	} else dallas_init_ram();
 	settings_unlock();
 
 	/* Initialize the system clock */
 	info("setting system clock...");
-	dallas_set_system_clock();
+	set_system_clock(clk);
+	info("initialized in %u ms",
+	     (unsigned int)((esp_timer_get_time() - start) / 1000));
 }
 
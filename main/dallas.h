@@ -1,6 +1,7 @@
 #ifndef LIGHTCTL_DALLAS_H
 #define LIGHTCTL_DALLAS_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <time.h>
 
@@ -15,6 +16,13 @@
 #define SETTINGS_EMN   0xca /**< Schedule: Ending minute */
 #define SETTINGS_V     0xcc /**< Settings validity       */
 #define SETTINGS_VALID 0x5a /**< Validity indicator      */
+#define SETTINGS_LEN   (((SETTINGS_V - SETTINGS_SW) >> 1) + 1)
+
+/**
+ * Burst mode addresses
+ */
+#define DALLAS_CLOCK_BURST 0xbe /**< All eight clock registers */
+#define DALLAS_RAM_BURST   0xfe /**< All 31 bytes of RAM       */
 
 /**
  * Read a byte from the dallas
@@ -26,13 +34,31 @@ uint8_t dallas_read(uint8_t addr);
  */
 void dallas_write(uint8_t addr, uint8_t b);
 
+/**
+ * Read n bytes from the dallas in burst mode, starting at the
+ * first clock register or RAM byte, in a single transfer.
+ */
+void dallas_read_burst(uint8_t addr, uint8_t *buf, size_t n);
+
+/**
+ * Write n bytes to the dallas in burst mode, with write-protect
+ * lifted for the duration of the transfer.
+ */
+void dallas_write_burst(uint8_t addr, const uint8_t *buf, size_t n);
+
 /**
  * Set the system clock from the dallas
  */
 void dallas_set_system_clock(void);
 
 /**
- * Called when we get the time via NTP
+ * Read the time from the dallas
+ */
+time_t dallas_time(void);
+
+/**
+ * Write the time to the dallas, to the nearest second; tv's, or the
+ * system clock's, if it's NULL.
  */
 void dallas_sync(struct timeval *tv);
 
@@ -0,0 +1,206 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <nvs.h>
+#include <driver/ledc.h>
+
+#if CONFIG_LIGHTCTL_LOWPOWER
+#include <esp_sleep.h>
+#endif
+
+#include "log.h"
+#include "dim.h"
+
+#define MODE  LEDC_LOW_SPEED_MODE
+#define TIMER LEDC_TIMER_0
+#define RES   10
+
+static const char *TAG = "dim";
+
+/**
+ * The LEDC keeps running in light sleep off the 8 MHz RTC clock, but
+ * not off the APB clock.
+ */
+#if CONFIG_LIGHTCTL_LOWPOWER
+#define CLK LEDC_USE_RTC8M_CLK
+#else
+#define CLK LEDC_AUTO_CLK
+#endif
+
+/**
+ * Channel i is LEDC channel i. Only the control task changes these.
+ */
+static struct {
+	uint8_t gpio[DIM_MAX];   /**< Pin                        */
+	uint8_t level[DIM_MAX];  /**< Level, or where it's going */
+	uint8_t preset[DIM_MAX]; /**< Level for "on"             */
+	uint8_t n;               /**< Number of channels         */
+} ch;
+
+static uint32_t duty(unsigned int level)
+{
+	return (uint32_t)level * (1U << RES) / 255;
+}
+
+void dim_set(unsigned int mask, unsigned int level, unsigned int ms)
+{
+	unsigned int i, l;
+
+	mask &= (1U << ch.n) - 1;
+	if (!mask) return;
+
+	/*
+	 * Updates only take on the timer's next cycle, so these all start
+	 * within a PWM period of each other, without holding the timer up
+	 * for the channels that aren't changing.
+	 *
+	 * A running fade holds its channel until it ends, and setting the
+	 * duty or another fade would wait for that: So it's stopped first,
+	 * at the duty it got to.
+	 */
+	for (i = 0; i < ch.n; i++) {
+		if (!(mask & (1U << i)))
+			continue;
+
+		l = level & DIM_PRESET ? ch.preset[i] : level & 0xff;
+		ch.level[i] = (uint8_t)l;
+		ledc_fade_stop(MODE, i);
+		if (ms) {
+			ledc_set_fade_with_time(MODE, i, duty(l), (int)ms);
+			ledc_fade_start(MODE, i, LEDC_FADE_NO_WAIT);
+		} else {
+			ledc_set_duty(MODE, i, duty(l));
+			ledc_update_duty(MODE, i);
+		}
+	}
+}
+
+void dim_preset(unsigned int mask, unsigned int level)
+{
+	nvs_handle_t h;
+	unsigned int i;
+
+	for (i = 0; i < ch.n; i++) {
+		if (mask & (1U << i))
+			ch.preset[i] = (uint8_t)level;
+	}
+
+	if (nvs_open("lightctl", NVS_READWRITE, &h) != ESP_OK) {
+		err("failed to open nvs");
+		return;
+	}
+
+	if (nvs_set_blob(h, "dim", ch.preset, DIM_MAX) != ESP_OK ||
+	    nvs_commit(h) != ESP_OK)
+		err("failed to save the presets");
+	nvs_close(h);
+}
+
+unsigned int dim_channels(void)
+{
+	return ch.n;
+}
+
+unsigned int dim_lit(void)
+{
+	unsigned int i, mask = 0;
+
+	for (i = 0; i < ch.n; i++) {
+		if (ch.level[i])
+			mask |= 1U << i;
+	}
+
+	return mask;
+}
+
+size_t dim_format(char *buf, size_t len)
+{
+	unsigned int i;
+	size_t n = 0;
+	int ret;
+
+	for (i = 0; i < ch.n; i++) {
+		ret = snprintf(buf + n, len - n, "%u %u %u %u\n", i, ch.gpio[i],
+		               ch.level[i], ch.preset[i]);
+		if (ret < 0 || (size_t)ret >= len - n)
+			break;
+		n += (size_t)ret;
+	}
+
+	return n;
+}
+
+/**
+ * The extra pins, e.g. "16,17,18". GPIO 34 - 39 are input only.
+ */
+static void pins(void)
+{
+	const char *p = CONFIG_LIGHTCTL_DIM_GPIOS;
+	char *end;
+	long pin;
+
+	ch.gpio[0] = CONFIG_GPIO_LIGHTS;
+	for (ch.n = 1; *p && ch.n < DIM_MAX; p = end + (*end == ',')) {
+		pin = strtol(p, &end, 10);
+		if (end == p || (*end && *end != ',') || pin < 0 || pin > 33) {
+			err("bad pin list, at %u", ch.n);
+			return;
+		}
+
+		ch.gpio[ch.n++] = (uint8_t)pin;
+	}
+}
+
+static const ledc_timer_config_t timer_conf = {
+	.speed_mode      = MODE,
+	.duty_resolution = RES,
+	.timer_num       = TIMER,
+	.freq_hz         = 5000,
+	.clk_cfg         = CLK
+};
+
+void dim_init(int on)
+{
+	ledc_channel_config_t conf = {
+		.speed_mode = MODE,
+		.intr_type  = LEDC_INTR_DISABLE,
+		.timer_sel  = TIMER
+	};
+	size_t len = sizeof(ch.preset);
+	nvs_handle_t h;
+	unsigned int i;
+
+	for (i = 0; i < DIM_MAX; i++)
+		ch.preset[i] = 255;
+
+	if (nvs_open("lightctl", NVS_READONLY, &h) == ESP_OK) {
+		if (nvs_get_blob(h, "dim", ch.preset, &len) == ESP_OK)
+			info("loaded %u presets", (unsigned int)len);
+		nvs_close(h);
+	}
+
+	pins();
+	if (ledc_timer_config(&timer_conf) != ESP_OK) {
+		err("failed to configure the timer");
+		ch.n = 0;
+		return;
+	}
+
+#if CONFIG_LIGHTCTL_LOWPOWER
+	esp_sleep_pd_config(ESP_PD_DOMAIN_RTC8M, ESP_PD_OPTION_ON);
+#endif
+
+	/* Left as they were */
+	for (i = 0; i < ch.n; i++) {
+		ch.level[i]   = on ? ch.preset[i] : 0;
+		conf.channel  = (ledc_channel_t)i;
+		conf.gpio_num = ch.gpio[i];
+		conf.duty     = duty(ch.level[i]);
+		ledc_channel_config(&conf);
+	}
+
+	ledc_fade_func_install(0);
+	info("%u channels", ch.n);
+}
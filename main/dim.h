@@ -0,0 +1,61 @@
+#ifndef LIGHTCTL_DIM_H
+#define LIGHTCTL_DIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Light channels
+ *
+ * Each channel is a pin driven by an LEDC channel, on one shared timer,
+ * with a brightness level (0 - 255) and a preset, which is the level
+ * "on" brings it to. Channel 0 is CONFIG_GPIO_LIGHTS, and the rest are
+ * the pins in CONFIG_LIGHTCTL_DIM_GPIOS.
+ *
+ * Fades are run by the LEDC's fade engine, so a change to any number
+ * of channels takes no task or timer of its own. The presets are kept
+ * in NVS.
+ *
+ * Channel masks are 16 bits; The limit on the channels is the LEDC's,
+ * at 8 to a speed mode.
+ */
+#define DIM_MAX    8
+#define DIM_ALL    ((uint16_t)~0U)
+
+_Static_assert(DIM_MAX <= 16, "too many channels for a mask");
+
+/**
+ * Level for dim_set(): Each channel's preset
+ */
+#define DIM_PRESET 0x100
+
+/**
+ * Bring the channels in mask to a level, over ms milliseconds, from
+ * wherever a fade they're in got to. All of them start changing within
+ * a PWM period of each other.
+ */
+void dim_set(unsigned int mask, unsigned int level, unsigned int ms);
+
+/**
+ * Set the preset of the channels in mask, and save the presets
+ */
+void dim_preset(unsigned int mask, unsigned int level);
+
+/**
+ * Number of channels, and the mask of those that aren't at 0
+ */
+unsigned int dim_channels(void);
+unsigned int dim_lit(void);
+
+/**
+ * Format the channels as text, one per line: index, pin, level and
+ * preset. Returns the length.
+ */
+size_t dim_format(char *buf, size_t len);
+
+/**
+ * Set the channels up, with the lights as given
+ */
+void dim_init(int on);
+
+#endif /* LIGHTCTL_DIM_H */
@@ -1,22 +1,59 @@
 #ifndef LIGHTCTL_EVENT_H
 #define LIGHTCTL_EVENT_H
 
-#include <esp_event.h>
+#include <stdint.h>
 
 /**
- * Application-specific event IDs
+ * Commands for the control task (see ctl.h)
  */
 enum {
-	CONNECTED, /**< Connected to WiFi */
-	LOSTCONN,  /**< Lost the WiFi conn. */
-	SWITCH,    /**< Switch state changed */
-	ON,        /**< "On" state requested */
-	OFF,       /**< "Off" state requested */
-	SCHED_ON,  /**< Enable schedule */
-	SCHED_OFF, /**< Disable schedule */
+	CONNECTED,   /**< Connected to WiFi */
+	LOSTCONN,    /**< Lost the WiFi conn. */
+	SWITCH,      /**< Switch state changed */
+	ON,          /**< "On" state requested */
+	OFF,         /**< "Off" state requested */
+	SCHED_ON,    /**< Enable schedule */
+	SCHED_OFF,   /**< Disable schedule */
+	FLUSH,       /**< Write back settings */
+	SCHEDULE,    /**< Scheduled on/off is due */
+	TIMESYNC,    /**< Got the time via SNTP */
+	SCHED_RULES, /**< Schedule rules changed */
+	BATCH,       /**< Apply several commands */
+	DEBOUNCE,    /**< Switch edge, settling */
+	SLEEP,       /**< Idle for long enough */
+	DIM,         /**< Set light channels */
+	CLOCK,       /**< Slew the clock */
+	CTL_CMDS     /**< Number of commands */
 };
 
-ESP_EVENT_DECLARE_BASE(LIGHTCTL_EVENT);
-extern esp_event_loop_handle_t lightctl_ev;
+/**
+ * Data of a BATCH command: ON, OFF, SCHED_ON and SCHED_OFF commands,
+ * applied in order as one change to the settings.
+ */
+#define BATCH_MAX 8
+
+struct batch {
+	uint32_t seq;    /**< Completion, as in http_done() */
+	uint8_t n;       /**< Number of commands            */
+	struct {
+		uint8_t id;  /**< Event ID                      */
+		uint8_t shr; /**< SCHED_ON: Start hour          */
+		uint8_t smn; /**< SCHED_ON: Start minute        */
+		uint8_t ehr; /**< SCHED_ON: Ending hour         */
+		uint8_t emn; /**< SCHED_ON: Ending minute       */
+	} cmd[BATCH_MAX];
+};
+
+/**
+ * Data of a DIM command: Bring the channels in the mask to a level,
+ * or set their preset.
+ */
+struct dim {
+	uint32_t seq;    /**< Completion, as in http_done() */
+	uint16_t mask;   /**< Channels                      */
+	uint8_t level;   /**< Level                         */
+	uint8_t preset;  /**< Set the preset instead        */
+	uint16_t ms;     /**< Fade time                     */
+};
 
 #endif /* LIGHTCTL_EVENT_H */
@@ -1,130 +1,634 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 
 #include <esp_err.h>
-#include <esp_event.h>
-#include <esp_spiffs.h>
+#include <esp_system.h>
+#include <esp_timer.h>
 #include <esp_http_server.h>
 #include <driver/gpio.h>
 
+#include "assets.h"
 #include "settings.h"
+#include "sched.h"
 #include "event.h"
+#include "ctl.h"
+#include "switch.h"
+#include "metrics.h"
+#include "trace.h"
+#include "boot.h"
+#include "power.h"
+#include "dim.h"
+#include "clock.h"
 #include "log.h"
 
 /**
- * Transfer buffer size for files
+ * Not Modified status line
  */
-#define TXBUFSZ (CONFIG_HTTPD_TXBUF_SIZE * 1024)
+#define HTTPD_304 "304 Not Modified"
+
+/**
+ * Gateway Timeout status line
+ */
+#define HTTPD_504 "504 Gateway Timeout"
+
+/**
+ * A date that would be taken for a weekly rule (date 0), or before it
+ */
+#define HTTPD_422_DATE "422 Date Not After 1970-01-01"
+
+/**
+ * Max. number of status subscribers
+ */
+#define MAX_SUBS 4
+
+/**
+ * Longest frame a subscriber can send without being dropped. httpd
+ * can't read part of a frame, so anything longer is left unread.
+ */
+#define MAX_WS_FRAME 256
+
+/**
+ * Max. number of clients to close when the link goes down
+ * (config.max_open_sockets is 7)
+ */
+#define MAX_CLIENTS 8
+
+/**
+ * Ticks a handler waits for the control task to carry out a command
+ */
+#define CMD_TIMEOUT pdMS_TO_TICKS(CONFIG_LIGHTCTL_CMD_TIMEOUT_MS)
 
 static const char *TAG       = "http";
 static httpd_handle_t server = NULL;
 static httpd_config_t config = HTTPD_DEFAULT_CONFIG();
 
-static esp_vfs_spiffs_conf_t fs_conf = {
-	.base_path       = "/www",
-	.max_files       = 4,
-	.partition_label = "www",
-	.format_if_mount_failed = false
-};
+/**
+ * The status line, cached along with the settings version it was built
+ * from. The tag changes only when the line itself does, and includes a
+ * per-boot id so a tag from before a reboot never matches.
+ */
+static struct {
+	uint32_t version;  /**< settings_version() when built */
+	uint32_t seq;      /**< Number of distinct lines      */
+	char line[48];     /**< Status line                   */
+	char tag[20];      /**< Version tag                   */
+	char etag[24];     /**< Quoted version tag            */
+} status_cache;
+
+static uint32_t boot_id;
+
+static void status_update(void)
+{
+	char buf[sizeof(status_cache.line)];
+	struct lightctl_settings s;
+	const char *override = "auto";
+	uint32_t version = settings_version();
+
+	if (status_cache.seq && status_cache.version == version)
+		return;
+
+	settings_snapshot(&s);
+	if (s.override_sw & 2)      override = "off";
+	else if (s.override_sw & 1) override = "on";
+	snprintf(buf, sizeof(buf), "299 %s/%s/%s/%02u:%02u/%02u:%02u/%s",
+	         override,
+	         s.light_sw    ? "on" : "off",
+	         s.sched_sw    ? "on" : "off",
+	         s.shr, s.smn,
+	         s.ehr, s.emn,
+	         s.lights_status ? "on" : "off");
+
+	status_cache.version = version;
+	if (status_cache.seq && !strcmp(buf, status_cache.line))
+		return;
+
+	strcpy(status_cache.line, buf);
+	++status_cache.seq;
+	sprintf(status_cache.tag, "%08x-%x", boot_id, status_cache.seq);
+	sprintf(status_cache.etag, "\"%s\"", status_cache.tag);
+}
 
 /**
- * HEAD /on
+ * Does the client already have the current status? It can tell us
+ * by way of If-None-Match, or the v query parameter.
  */
-static esp_err_t on(httpd_req_t *req)
+static int status_unchanged(httpd_req_t *req)
 {
-	settings_lock();
-	if (!settings.lights_status) {
-		esp_event_post_to(lightctl_ev, LIGHTCTL_EVENT, ON,
-		                  NULL, 0, 10);
-	}
-	settings_unlock();
+	char qstr[32], v[sizeof(status_cache.etag)];
 
-	httpd_resp_set_status(req, HTTPD_200);
+	if (httpd_req_get_hdr_value_str(req, "If-None-Match", v,
+	                                sizeof(v)) == ESP_OK)
+		return !strcmp(v, status_cache.etag);
+
+	if (httpd_req_get_url_query_str(req, qstr, sizeof(qstr)) == ESP_OK &&
+	    httpd_query_key_value(qstr, "v", v, sizeof(v)) == ESP_OK)
+		return !strcmp(v, status_cache.tag);
+
+	return 0;
+}
+
+/**
+ * HEAD /status[?v=tag]
+ *
+ * Manual override status / Selected on/off state / Schedule status /
+ * Start time / Stop time / Lights status
+ *
+ * If the client's tag is current, 304 is sent instead.
+ */
+static esp_err_t status(httpd_req_t *req)
+{
+	status_update();
+	httpd_resp_set_status(req, status_unchanged(req) ? HTTPD_304
+	                                                 : status_cache.line);
 	httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+	httpd_resp_set_hdr(req, "ETag", status_cache.etag);
+	httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
 	httpd_resp_send(req, NULL, 0);
 	return ESP_OK;
 }
 
 /**
+ * Completion of the command a handler is waiting on. Handlers run one
+ * at a time, so one is enough; The sequence number keeps a command that
+ * timed out from completing the next one.
+ */
+static SemaphoreHandle_t cmd_done;
+static atomic_uint cmd_seq;
+
+void http_done(uint32_t seq)
+{
+	if (seq == atomic_load(&cmd_seq))
+		xSemaphoreGive(cmd_done);
+}
+
+/**
+ * Have the control task carry out a command, and wait for it to finish.
+ * The sequence number is filled in.
+ */
+static int command(struct ctl_cmd *c)
+{
+	c->seq = atomic_fetch_add(&cmd_seq, 1) + 1;
+
+	/* Drop the completion of one that timed out */
+	xSemaphoreTake(cmd_done, 0);
+
+	return !ctl_post(c, CMD_TIMEOUT) &&
+	       xSemaphoreTake(cmd_done, CMD_TIMEOUT) == pdTRUE;
+}
+
+/**
+ * Reply with the current status
+ */
+static esp_err_t send_status(httpd_req_t *req)
+{
+	status_update();
+	httpd_resp_set_status(req, status_cache.line);
+	httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+	httpd_resp_set_hdr(req, "ETag", status_cache.etag);
+	httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+	httpd_resp_send(req, NULL, 0);
+	return ESP_OK;
+}
+
+static esp_err_t timed_out(httpd_req_t *req)
+{
+	httpd_resp_set_status(req, HTTPD_504);
+	httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+	httpd_resp_send(req, NULL, 0);
+	return ESP_FAIL;
+}
+
+/**
+ * HEAD /on
  * HEAD /off
+ *
+ * Reply with the status line once the lights have been switched, which
+ * the override switch may have prevented.
  */
+static esp_err_t on_off(httpd_req_t *req, int on)
+{
+	struct ctl_cmd c = { .id = on ? ON : OFF };
+	struct lightctl_settings s;
+
+	settings_snapshot(&s);
+	if (s.lights_status != on && !command(&c))
+		return timed_out(req);
+	return send_status(req);
+}
+
+static esp_err_t on(httpd_req_t *req)
+{
+	return on_off(req, 1);
+}
+
 static esp_err_t off(httpd_req_t *req)
 {
-	settings_lock();
-	if (settings.lights_status) {
-		esp_event_post_to(lightctl_ev, LIGHTCTL_EVENT, OFF,
-		                  NULL, 0, 10);
+	return on_off(req, 0);
+}
+
+/**
+ * Websocket subscribers to the status. These are only touched on the
+ * httpd task.
+ */
+static int subs[MAX_SUBS];
+static unsigned int nsubs;
+static uint32_t pushed;   /**< status_cache.seq last pushed */
+
+/**
+ * When the link last came up, and whether a request has been served
+ * since
+ */
+static int64_t up_at;
+static atomic_int up;
+
+static void served(void)
+{
+	power_touch();
+	if (atomic_exchange(&up, 0))
+		metrics_since(M_HTTP_FIRST, up_at);
+}
+
+/**
+ * Forget about subscribers which have gone away
+ */
+static void prune(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < nsubs; ) {
+		if (httpd_ws_get_fd_info(server, subs[i]) !=
+		    HTTPD_WS_CLIENT_WEBSOCKET)
+			subs[i] = subs[--nsubs];
+		else ++i;
 	}
+}
+
+/**
+ * Push the status to one subscriber, or to all of them if it changed.
+ * Every subscriber gets the same frame, which is the cached status line
+ * minus the status code.
+ */
+static void push(void *arg)
+{
+	int fd = (int)(intptr_t)arg;
+	unsigned int i;
+	httpd_ws_frame_t f = {
+		.final = true,
+		.type  = HTTPD_WS_TYPE_TEXT
+	};
+
+	status_update();
+	f.payload = (uint8_t *)status_cache.line + 4;
+	f.len     = strlen((char *)f.payload);
+
+	if (fd >= 0) {
+		httpd_ws_send_frame_async(server, fd, &f);
+		return;
+	}
+
+	if (status_cache.seq == pushed)
+		return;
+
+	pushed = status_cache.seq;
+	prune();
+	for (i = 0; i < nsubs; ) {
+		if (httpd_ws_send_frame_async(server, subs[i], &f) != ESP_OK)
+			subs[i] = subs[--nsubs];
+		else ++i;
+	}
+}
+
+/**
+ * GET /ws
+ *
+ * Subscribe to the status, which is sent right away, and then whenever
+ * it changes. Anything the client sends is read and ignored, though a
+ * frame of over MAX_WS_FRAME bytes closes the connection.
+ */
+static esp_err_t ws(httpd_req_t *req)
+{
+	static uint8_t buf[MAX_WS_FRAME]; /* httpd has the one task */
+	httpd_ws_frame_t f = { 0 };
+	int fd = httpd_req_to_sockfd(req);
+	unsigned int i;
+
+	served();
+	if (req->method == HTTP_GET) {
+		/* A closed subscriber's fd may have been reused */
+		for (i = 0; i < nsubs && subs[i] != fd; i++);
+		if (i == MAX_SUBS) {
+			prune();
+			if ((i = nsubs) == MAX_SUBS)
+				return ESP_FAIL;
+		}
+
+		if (i == nsubs) subs[nsubs++] = fd;
+		return httpd_queue_work(req->handle, push, (void *)(intptr_t)fd);
+	}
+
+	f.payload = buf;
+	if (httpd_ws_recv_frame(req, &f, 0) != ESP_OK || f.len > sizeof(buf))
+		return ESP_FAIL;
+	return httpd_ws_recv_frame(req, &f, f.len);
+}
+
+void http_notify(void)
+{
+	static uint32_t version;
+	uint32_t v = settings_version();
+
+	if (!server || v == version)
+		return;
+
+	version = v;
+	httpd_queue_work(server, push, (void *)(intptr_t)-1);
+}
+
+/**
+ * Parse the on=xx:xx&off=xx:xx query of /schedule/on
+ */
+static int parse_window(const char *qstr, unsigned int *shr,
+                        unsigned int *smn, unsigned int *ehr,
+                        unsigned int *emn)
+{
+	char on[6], off[6];
+
+	/* XXX: Yes, these work by way of strlcpy(). */
+	if (httpd_query_key_value(qstr, "on", on, sizeof(on))    != ESP_OK ||
+	    httpd_query_key_value(qstr, "off", off, sizeof(off)) != ESP_OK)
+		return 0;
+
+	/* Verify our input parameters */
+	return sscanf(on,  "%u:%u", shr, smn) == 2 &&
+	       sscanf(off, "%u:%u", ehr, emn) == 2 &&
+	       !(*shr == *ehr && *smn == *emn) &&
+	       *shr <= 23 && *smn <= 59 && *ehr <= 23 && *emn <= 59;
+}
+
+/**
+ * HEAD /schedule/on?on=xx:xx&off=xx:xx
+ *
+ * Enable the daily window. The on/off times are expected to be UTC.
+ */
+static esp_err_t schedule_on(httpd_req_t *req)
+{
+	char qstr[20];
+	unsigned int shr, smn, ehr, emn;
+
+	if (httpd_req_get_url_query_str(req, qstr, sizeof(qstr)) != ESP_OK ||
+	    !parse_window(qstr, &shr, &smn, &ehr, &emn))
+		goto bad_request;
+
+	settings_lock();
+	settings.sched_sw = 1;
+	settings.shr      = shr;
+	settings.smn      = smn;
+	settings.ehr      = ehr;
+	settings.emn      = emn;
 	settings_unlock();
 
+	ctl_send(SCHED_ON, 10);
 	httpd_resp_set_status(req, HTTPD_200);
 	httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
 	httpd_resp_send(req, NULL, 0);
 	return ESP_OK;
+
+bad_request:
+	httpd_resp_set_status(req, HTTPD_400);
+	httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+	httpd_resp_send(req, NULL, 0);
+	return ESP_FAIL;
 }
 
 /**
- * HEAD /status
+ * HEAD /schedule/off
  *
- * Lights status / Manual override status / Schedule status /
- * Start time / Stop time
+ * Disable the daily window, leaving the rules as they are.
  */
-static esp_err_t status(httpd_req_t *req)
+static esp_err_t schedule_off(httpd_req_t *req)
 {
-	char buf[64];
-	const char *override = "auto";
+	ctl_send(SCHED_OFF, 10);
+	httpd_resp_set_status(req, HTTPD_200);
+	httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+	httpd_resp_send(req, NULL, 0);
+	return ESP_OK;
+}
 
-	settings_lock();
-	if (settings.override_sw & 2)      override = "off";
-	else if (settings.override_sw & 1) override = "on";
-	sprintf(buf, "299 %s/%s/%s/%02u:%02u/%02u:%02u",
-	        override,
-	        settings.light_sw    ? "on" : "off",
-	        settings.sched_sw    ? "on" : "off",
-	        settings.shr, settings.smn,
-	        settings.ehr, settings.emn);
-	settings_unlock();
+/**
+ * POST /batch
+ *
+ * One command per line, each one being the path (and query) of /on,
+ * /off, /schedule/on or /schedule/off. Either all of them are applied,
+ * together, or none are. The reply is the status line, as with /on.
+ */
+static esp_err_t batch(httpd_req_t *req)
+{
+	char buf[BATCH_MAX * 40 + 1], *p, *e;
+	unsigned int shr, smn, ehr, emn;
+	struct ctl_cmd c = { .id = BATCH };
+	struct batch *b = &c.batch;
+	size_t n = 0;
+	int r;
+
+	if (req->content_len >= sizeof(buf))
+		goto bad_request;
+
+	while (n < req->content_len) {
+		r = httpd_req_recv(req, buf + n, req->content_len - n);
+		if (r <= 0) goto bad_request;
+		n += (size_t)r;
+	}
 
-	httpd_resp_set_status(req, buf);
+	buf[n] = '\0';
+	for (p = buf; *p; p = e) {
+		e = p + strcspn(p, "\r\n");
+		if (*e) *e++ = '\0';
+		if (!*p) continue;
+
+		if (b->n == BATCH_MAX)
+			goto bad_request;
+
+		if (!strcmp(p, "/on")) {
+			b->cmd[b->n++].id = ON;
+		} else if (!strcmp(p, "/off")) {
+			b->cmd[b->n++].id = OFF;
+		} else if (!strcmp(p, "/schedule/off")) {
+			b->cmd[b->n++].id = SCHED_OFF;
+		} else if (!strncmp(p, "/schedule/on?", 13) &&
+		           parse_window(p + 13, &shr, &smn, &ehr, &emn)) {
+			b->cmd[b->n].id  = SCHED_ON;
+			b->cmd[b->n].shr = shr;
+			b->cmd[b->n].smn = smn;
+			b->cmd[b->n].ehr = ehr;
+			b->cmd[b->n].emn = emn;
+			b->n++;
+		} else goto bad_request;
+	}
+
+	if (b->n && !command(&c))
+		return timed_out(req);
+	return send_status(req);
+
+bad_request:
+	httpd_resp_set_status(req, HTTPD_400);
 	httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
 	httpd_resp_send(req, NULL, 0);
+	return ESP_FAIL;
+}
+
+/**
+ * Days since 1970-01-01 of a date, and the other way around
+ */
+static uint32_t days_from_civil(unsigned int y, unsigned int m,
+                                unsigned int d)
+{
+	unsigned int era, yoe, doy;
+
+	y  -= m <= 2;
+	era = y / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+static void civil_from_days(uint32_t z, unsigned int *y, unsigned int *m,
+                            unsigned int *d)
+{
+	unsigned int era, doe, yoe, doy, mp;
+
+	z  += 719468;
+	era = z / 146097;
+	doe = z - era * 146097;
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp  = (5 * doy + 2) / 153;
+	*d  = doy - (153 * mp + 2) / 5 + 1;
+	*m  = mp < 10 ? mp + 3 : mp - 9;
+	*y  = yoe + era * 400 + (*m <= 2);
+}
+
+/**
+ * GET /schedule
+ *
+ * One rule per line: index, days of the week (as a mask, with bit 0
+ * being Sunday) or date, and on/off times (UTC).
+ */
+static esp_err_t schedule_list(httpd_req_t *req)
+{
+	struct sched_rule r[SCHED_MAX_RULES];
+	char buf[SCHED_MAX_RULES * 32], *p = buf;
+	unsigned int i, n, y, m, d;
+
+	n = sched_rules(r, SCHED_MAX_RULES);
+	for (i = 0; i < n; i++) {
+		p += sprintf(p, "%u ", i);
+		if (r[i].date) {
+			civil_from_days(r[i].date, &y, &m, &d);
+			p += sprintf(p, "%04u-%02u-%02u", y, m, d);
+		} else p += sprintf(p, "0x%02x", r[i].days);
+
+		p += sprintf(p, " %02u:%02u %02u:%02u\n",
+		             r[i].start / 60, r[i].start % 60,
+		             r[i].end / 60, r[i].end % 60);
+	}
+
+	httpd_resp_set_status(req, HTTPD_200);
+	httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+	httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+	httpd_resp_send(req, buf, p - buf);
 	return ESP_OK;
 }
 
 /**
- * HEAD /schedule/on?on=xx:xx&off=xx:xx
+ * HEAD /schedule/add?days=x&on=xx:xx&off=xx:xx
+ * HEAD /schedule/add?date=yyyy-mm-dd&on=xx:xx&off=xx:xx
  *
- * The on/off times are expected to be UTC.
+ * Add a weekly or dated rule, with the times being UTC. The index of
+ * the new rule is sent in the status line. Rules apply with or without
+ * the daily window; A dated rule's off time can't be before its on time.
  */
-static esp_err_t schedule_on(httpd_req_t *req)
+static esp_err_t schedule_add(httpd_req_t *req)
 {
-	char qstr[20]; char on[6], off[6];
-	unsigned int shr, smn, ehr, emn;
+	char qstr[64], arg[11], on[6], off[6], line[16];
+	unsigned int shr, smn, ehr, emn, y, m, d;
+	struct sched_rule r = { 0 };
+	unsigned long days;
+	char *end;
+	int i;
 
-	/* XXX: Yes, all three of these work by way of strlcpy(). */
 	if (httpd_req_get_url_query_str(req, qstr, sizeof(qstr)) != ESP_OK ||
 	    httpd_query_key_value(qstr, "on", on, sizeof(on))    != ESP_OK ||
 	    httpd_query_key_value(qstr, "off", off, sizeof(off)) != ESP_OK)
 		goto bad_request;
 
-	/* Verify our input parameters */
 	if (sscanf(on,  "%u:%u", &shr, &smn) != 2 ||
 	    sscanf(off, "%u:%u", &ehr, &emn) != 2 ||
-	    (shr == ehr && smn == emn) ||
 	    shr > 23 || smn > 59 || ehr > 23 || emn > 59)
 		goto bad_request;
 
-	settings_lock();
-	settings.sched_sw = 1;
-	settings.shr      = shr;
-	settings.smn      = smn;
-	settings.ehr      = ehr;
-	settings.emn      = emn;
-	settings_unlock();
+	if (httpd_query_key_value(qstr, "date", arg, sizeof(arg)) == ESP_OK) {
+		if (sscanf(arg, "%u-%u-%u", &y, &m, &d) != 3 ||
+		    y > 2148 || m < 1 || m > 12 || d < 1 || d > 31)
+			goto bad_request;
+		if (y < 1970 || (y == 1970 && m == 1 && d == 1))
+			goto bad_date;
+		r.date = days_from_civil(y, m, d);
+	} else if (httpd_query_key_value(qstr, "days", arg,
+	                                 sizeof(arg)) == ESP_OK) {
+		days = strtoul(arg, &end, 0);
+		if (*end || !days || days > SCHED_ALL)
+			goto bad_request;
+		r.days = days;
+	} else goto bad_request;
 
-	esp_event_post_to(lightctl_ev, LIGHTCTL_EVENT, SCHED_ON,
-	                  NULL, 0, 10);
+	r.start = shr * 60 + smn;
+	r.end   = ehr * 60 + emn;
+	if ((i = sched_add(&r)) < 0)
+		goto bad_request;
+
+	ctl_send(SCHED_RULES, 10);
+	sprintf(line, "299 %d", i);
+	httpd_resp_set_status(req, line);
+	httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+	httpd_resp_send(req, NULL, 0);
+	return ESP_OK;
+
+bad_date:
+	httpd_resp_set_status(req, HTTPD_422_DATE);
+	httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+	httpd_resp_send(req, NULL, 0);
+	return ESP_FAIL;
+
+bad_request:
+	httpd_resp_set_status(req, HTTPD_400);
+	httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+	httpd_resp_send(req, NULL, 0);
+	return ESP_FAIL;
+}
+
+/**
+ * HEAD /schedule/del?i=x
+ */
+static esp_err_t schedule_del(httpd_req_t *req)
+{
+	char qstr[16], arg[4], *end;
+	unsigned long i;
+
+	if (httpd_req_get_url_query_str(req, qstr, sizeof(qstr)) != ESP_OK ||
+	    httpd_query_key_value(qstr, "i", arg, sizeof(arg)) != ESP_OK)
+		goto bad_request;
+
+	i = strtoul(arg, &end, 10);
+	if (!*arg || *end || sched_del(i) < 0)
+		goto bad_request;
+
+	ctl_send(SCHED_RULES, 10);
 	httpd_resp_set_status(req, HTTPD_200);
 	httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
 	httpd_resp_send(req, NULL, 0);
@@ -138,134 +642,537 @@ bad_request:
 }
 
 /**
- * HEAD /schedule/off
+ * GET /channels
+ *
+ * One light channel per line: index, pin, level and preset
  */
-static esp_err_t schedule_off(httpd_req_t *req)
+static esp_err_t channels(httpd_req_t *req)
 {
-	esp_event_post_to(lightctl_ev, LIGHTCTL_EVENT, SCHED_OFF,
-	                  NULL, 0, 10);
+	char buf[DIM_MAX * 20];
+	size_t n = dim_format(buf, sizeof(buf));
+
+	httpd_resp_set_status(req, HTTPD_200);
+	httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+	httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+	httpd_resp_send(req, buf, n);
+	return ESP_OK;
+}
+
+/**
+ * HEAD /dim?level=n[&ch=i,j,...][&fade=ms]
+ * HEAD /dim?preset=n[&ch=i,j,...]
+ *
+ * Bring the channels, or all of them, to a level (0 - 255) together,
+ * fading over the given time; Or set the level "on" brings them to.
+ * Replies once it's done, which the override switch may have prevented.
+ */
+static esp_err_t dim(httpd_req_t *req)
+{
+	char qstr[64], arg[24], *p, *end;
+	struct ctl_cmd c = { .id = DIM };
+	struct dim *d = &c.dim;
+	unsigned long v;
+
+	if (httpd_req_get_url_query_str(req, qstr, sizeof(qstr)) != ESP_OK)
+		goto bad_request;
+
+	if (httpd_query_key_value(qstr, "ch", arg, sizeof(arg)) == ESP_OK) {
+		p = arg;
+		do {
+			v = strtoul(p, &end, 10);
+			if (end == p || (*end && *end != ',') ||
+			    v >= dim_channels())
+				goto bad_request;
+			d->mask |= (uint16_t)(1U << v);
+			p = end + 1;
+		} while (*end);
+	} else d->mask = DIM_ALL;
+
+	if (httpd_query_key_value(qstr, "preset", arg, sizeof(arg)) == ESP_OK)
+		d->preset = 1;
+	else if (httpd_query_key_value(qstr, "level", arg,
+	                               sizeof(arg)) != ESP_OK)
+		goto bad_request;
+
+	v = strtoul(arg, &end, 10);
+	if (!*arg || *end || v > 255)
+		goto bad_request;
+	d->level = (uint8_t)v;
+
+	if (!d->preset &&
+	    httpd_query_key_value(qstr, "fade", arg, sizeof(arg)) == ESP_OK) {
+		v = strtoul(arg, &end, 10);
+		if (!*arg || *end || v > UINT16_MAX)
+			goto bad_request;
+		d->ms = (uint16_t)v;
+	}
+
+	if (!command(&c))
+		return timed_out(req);
+
 	httpd_resp_set_status(req, HTTPD_200);
 	httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
 	httpd_resp_send(req, NULL, 0);
 	return ESP_OK;
+
+bad_request:
+	httpd_resp_set_status(req, HTTPD_400);
+	httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+	httpd_resp_send(req, NULL, 0);
+	return ESP_FAIL;
+}
+
+/**
+ * Find the embedded asset for a request path
+ */
+static const struct asset *asset_find(const char *path, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < n_assets; i++) {
+		if (!strncmp(assets[i].path, path, len) && !assets[i].path[len])
+			return &assets[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * Does the client already have this version of the asset? If-None-Match
+ * takes precedence over If-Modified-Since, as in RFC 7232.
+ */
+static int asset_unchanged(httpd_req_t *req, const struct asset *a)
+{
+	char v[40];
+
+	if (httpd_req_get_hdr_value_str(req, "If-None-Match", v,
+	                                sizeof(v)) == ESP_OK)
+		return strstr(v, a->etag) || !strcmp(v, "*");
+
+	if (httpd_req_get_hdr_value_str(req, "If-Modified-Since", v,
+	                                sizeof(v)) == ESP_OK)
+		return !strcmp(v, a->modified);
+
+	return 0;
 }
 
 /**
  * GET /...
+ *
+ * Anything that isn't a file gets index.html. The assets are sent
+ * as-is, straight from flash, unless the client's copy is current.
  */
 static esp_err_t idx(httpd_req_t *req)
 {
-	size_t n;
-	char *buf = NULL;
-	FILE *fp = NULL;
-	const char *fn = strrchr(req->uri, '/');
-
-	if (!fn || strlen(fn) > 20) goto not_found;
-	else ++fn;
-
-	/* Set the MIME type and cache-control header */
-	switch (req->uri[strlen(req->uri) - 2]) {
-	case 's': /* .css */
-		httpd_resp_set_type(req, "text/css");
-		httpd_resp_set_hdr(req, "Cache-Control",
-		                   "public, max-age=31536000");
-		break;
-	case 'j': /* .js */
-		httpd_resp_set_type(req, "application/javascript");
-		httpd_resp_set_hdr(req, "Cache-Control",
-		                   "public, max-age=31536000");
-		break;
-	default: /* index.html */
-		httpd_resp_set_type(req, "text/html");
-		fn = "index.html";
-	}
+	const struct asset *a;
+	size_t len = strcspn(req->uri, "?#"), fn = len;
 
-	/* Buffer the file out */
-	if (!(buf = malloc(TXBUFSZ)))
-		goto internal_error;
+	while (fn && req->uri[fn - 1] != '/')
+		--fn;
 
-	sprintf(buf, "/www/%s.gz", fn);
-	if (!(fp = fopen(buf, "r")))
+	if (!(a = asset_find(req->uri, len)) &&
+	    (memchr(req->uri + fn, '.', len - fn) ||
+	     !(a = asset_find("/index.html", 11))))
 		goto not_found;
 
-	httpd_resp_set_status(req, HTTPD_200);
-	httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
-	while (!feof(fp) && !ferror(fp) && (n = fread(buf, 1, TXBUFSZ, fp))) {
-		if (httpd_resp_send_chunk(req, buf, (ssize_t)n) != ESP_OK)
-			goto tx_error;
-	}
+	httpd_resp_set_type(req, a->type);
+	httpd_resp_set_hdr(req, "ETag", a->etag);
+	httpd_resp_set_hdr(req, "Last-Modified", a->modified);
+	httpd_resp_set_hdr(req, "Cache-Control", a->cache);
 
-	if (ferror(fp))
-		goto tx_error;
+	if (asset_unchanged(req, a)) {
+		httpd_resp_set_status(req, HTTPD_304);
+		httpd_resp_send(req, NULL, 0);
+		return ESP_OK;
+	}
 
-tx_error:
-	free(buf);
-	fclose(fp);
-	httpd_resp_sendstr_chunk(req, NULL);
+	httpd_resp_set_status(req, HTTPD_200);
+	httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+	httpd_resp_send(req, (const char *)a->data, (ssize_t)a->len);
 	return ESP_OK;
 
 not_found:
-	if (buf) free(buf);
 	httpd_resp_set_status(req, HTTPD_404);
 	httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
 	httpd_resp_send(req, NULL, 0);
 	return ESP_FAIL;
+}
 
-internal_error:
-	httpd_resp_set_status(req, HTTPD_500);
-	httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
-	httpd_resp_send(req, NULL, 0);
-	return ESP_FAIL;
+#if CONFIG_LIGHTCTL_LOWPOWER
+/**
+ * Wakeups, and the time spent awake and asleep, along with the wakeups
+ * per day, and the average time awake after each, or booting.
+ */
+static size_t power_metrics(char *buf, size_t len)
+{
+	struct power_stats ps;
+	uint64_t wakes, day, avg;
+	int r;
+
+	power_stats(&ps);
+	wakes = (uint64_t)ps.wakeups[POWER_TIMER] +
+	        ps.wakeups[POWER_SWITCH] + ps.wakeups[POWER_SYNC];
+	day   = wakes * 86400ULL * 100 * 1000000 /
+	        (ps.slept_us + ps.awake_us + 1);
+	avg   = ps.awake_us / (wakes + ps.boots + !(wakes + ps.boots));
+	r = snprintf(buf, len,
+	             "# TYPE lightctl_power_wakeups_total counter\n"
+	             "lightctl_power_wakeups_total{cause=\"timer\"} %u\n"
+	             "lightctl_power_wakeups_total{cause=\"switch\"} %u\n"
+	             "lightctl_power_wakeups_total{cause=\"sync\"} %u\n"
+	             "# TYPE lightctl_power_asleep_seconds_total counter\n"
+	             "lightctl_power_asleep_seconds_total %llu\n"
+	             "# TYPE lightctl_power_awake_seconds_total counter\n"
+	             "lightctl_power_awake_seconds_total %llu\n"
+	             "# HELP lightctl_power_wakeups_per_day Wakeups per day\n"
+	             "# TYPE lightctl_power_wakeups_per_day gauge\n"
+	             "lightctl_power_wakeups_per_day %u.%02u\n"
+	             "# HELP lightctl_power_awake_avg_seconds Time awake, "
+	             "per wakeup or boot\n"
+	             "# TYPE lightctl_power_awake_avg_seconds gauge\n"
+	             "lightctl_power_awake_avg_seconds %u.%06u\n",
+	             (unsigned int)ps.wakeups[POWER_TIMER],
+	             (unsigned int)ps.wakeups[POWER_SWITCH],
+	             (unsigned int)ps.wakeups[POWER_SYNC],
+	             (unsigned long long)(ps.slept_us / 1000000),
+	             (unsigned long long)(ps.awake_us / 1000000),
+	             (unsigned int)(day / 100), (unsigned int)(day % 100),
+	             (unsigned int)(avg / 1000000),
+	             (unsigned int)(avg % 1000000));
+	return r > 0 && (size_t)r < len ? (size_t)r : 0;
+}
+#endif
+
+/**
+ * The clock's offset from SNTP at the last reply, the drift estimated
+ * for it and the DS1302, and how often SNTP's being polled.
+ */
+static size_t clock_metrics(char *buf, size_t len)
+{
+	struct clock_stats cs;
+	uint64_t off;
+	int r;
+
+	clock_stats(&cs);
+	off = (uint64_t)llabs(cs.offset_us);
+	r = snprintf(buf, len,
+	             "# HELP lightctl_clock_offset_seconds SNTP less the "
+	             "system clock\n"
+	             "# TYPE lightctl_clock_offset_seconds gauge\n"
+	             "lightctl_clock_offset_seconds %s%u.%06u\n"
+	             "# HELP lightctl_clock_drift_ppb Drift, fast if "
+	             "positive\n"
+	             "# TYPE lightctl_clock_drift_ppb gauge\n"
+	             "lightctl_clock_drift_ppb{clock=\"esp32\"} %d\n"
+	             "lightctl_clock_drift_ppb{clock=\"ds1302\"} %d\n"
+	             "# HELP lightctl_clock_rtc_offset_seconds DS1302 less "
+	             "SNTP\n"
+	             "# TYPE lightctl_clock_rtc_offset_seconds gauge\n"
+	             "lightctl_clock_rtc_offset_seconds %d\n"
+	             "# TYPE lightctl_clock_poll_seconds gauge\n"
+	             "lightctl_clock_poll_seconds %u\n"
+	             "# TYPE lightctl_clock_samples_total counter\n"
+	             "lightctl_clock_samples_total %u\n"
+	             "# TYPE lightctl_clock_steps_total counter\n"
+	             "lightctl_clock_steps_total %u\n"
+	             "# TYPE lightctl_clock_slews_total counter\n"
+	             "lightctl_clock_slews_total %u\n"
+	             "# TYPE lightctl_clock_rtc_writes_total counter\n"
+	             "lightctl_clock_rtc_writes_total %u\n",
+	             cs.offset_us < 0 ? "-" : "",
+	             (unsigned int)(off / 1000000),
+	             (unsigned int)(off % 1000000),
+	             (int)cs.esp_ppb, (int)cs.rtc_ppb, (int)cs.rtc_offset,
+	             (unsigned int)cs.poll_s, (unsigned int)cs.samples,
+	             (unsigned int)cs.steps, (unsigned int)cs.slews,
+	             (unsigned int)cs.rtc_writes);
+	return r > 0 && (size_t)r < len ? (size_t)r : 0;
 }
 
+/**
+ * GET /metrics
+ *
+ * The latency histograms, along with the control queue and override
+ * switch counters, in the Prometheus text format
+ */
+static esp_err_t metrics(httpd_req_t *req)
+{
+	static char buf[1536];
+	struct switch_stats ss;
+	struct ctl_stats cs;
+	unsigned int i;
+	size_t n;
+	int r;
+
+	served();
+	httpd_resp_set_type(req, "text/plain; version=0.0.4");
+	httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+	for (i = 0; i < METRICS; i++) {
+		if ((n = metrics_format(i, buf, sizeof(buf))))
+			httpd_resp_send_chunk(req, buf, (ssize_t)n);
+	}
+
+	ctl_stats(&cs);
+	switch_stats(&ss);
+	r = snprintf(buf, sizeof(buf),
+	             "# TYPE lightctl_ctl_posted_total counter\n"
+	             "lightctl_ctl_posted_total %u\n"
+	             "# TYPE lightctl_ctl_merged_total counter\n"
+	             "lightctl_ctl_merged_total %u\n"
+	             "# TYPE lightctl_ctl_full_total counter\n"
+	             "lightctl_ctl_full_total %u\n"
+	             "# HELP lightctl_ctl_queue_hwm Most commands queued\n"
+	             "# TYPE lightctl_ctl_queue_hwm gauge\n"
+	             "lightctl_ctl_queue_hwm %u\n"
+	             "# TYPE lightctl_switch_bursts_total counter\n"
+	             "lightctl_switch_bursts_total %u\n"
+	             "# TYPE lightctl_switch_edges_total counter\n"
+	             "lightctl_switch_edges_total %u\n"
+	             "# TYPE lightctl_switch_glitches_total counter\n"
+	             "lightctl_switch_glitches_total %u\n"
+	             "# TYPE lightctl_switch_settle_max_seconds gauge\n"
+	             "lightctl_switch_settle_max_seconds %u.%06u\n"
+	             "# HELP lightctl_log_dropped_total Log messages dropped\n"
+	             "# TYPE lightctl_log_dropped_total counter\n"
+	             "lightctl_log_dropped_total %u\n",
+	             (unsigned int)cs.posted, (unsigned int)cs.merged,
+	             (unsigned int)cs.full, (unsigned int)cs.hwm,
+	             (unsigned int)ss.bursts, (unsigned int)ss.edges,
+	             (unsigned int)ss.glitches,
+	             (unsigned int)(ss.max_settle_us / 1000000),
+	             (unsigned int)(ss.max_settle_us % 1000000),
+	             (unsigned int)log_dropped());
+	if (r > 0 && (size_t)r < sizeof(buf))
+		httpd_resp_send_chunk(req, buf, r);
+
+#if CONFIG_LIGHTCTL_LOWPOWER
+	if ((n = power_metrics(buf, sizeof(buf))))
+		httpd_resp_send_chunk(req, buf, (ssize_t)n);
+#endif
+	if ((n = clock_metrics(buf, sizeof(buf))))
+		httpd_resp_send_chunk(req, buf, (ssize_t)n);
+	return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/**
+ * GET /boot
+ *
+ * The boot report, as in boot_format()
+ */
+static esp_err_t boot_report(httpd_req_t *req)
+{
+	static char buf[512];
+	size_t n = boot_format(buf, sizeof(buf));
+
+	served();
+	httpd_resp_set_type(req, "text/plain");
+	httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+	return httpd_resp_send(req, buf, (ssize_t)n);
+}
+
+/**
+ * GET /trace
+ *
+ * The trace rings, in the binary format described in trace.h
+ */
+static esp_err_t trace_dump(httpd_req_t *req)
+{
+	static struct trace_rec recs[CONFIG_LIGHTCTL_TRACE_LEN];
+	struct trace_core c;
+	struct trace_hdr h = {
+		.magic   = TRACE_MAGIC,
+		.version = TRACE_VERSION,
+		.cores   = portNUM_PROCESSORS,
+		.len     = CONFIG_LIGHTCTL_TRACE_LEN,
+		.now     = esp_timer_get_time()
+	};
+	unsigned int i;
+
+	served();
+	httpd_resp_set_type(req, "application/octet-stream");
+	httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+	httpd_resp_set_hdr(req, "Content-Disposition",
+	                   "attachment; filename=\"lightctl.trace\"");
+	httpd_resp_send_chunk(req, (const char *)&h, sizeof(h));
+
+	for (i = 0; i < portNUM_PROCESSORS; i++) {
+		c.n = trace_read(i, recs, &c.lost);
+		httpd_resp_send_chunk(req, (const char *)&c, sizeof(c));
+		if (c.n) {
+			httpd_resp_send_chunk(req, (const char *)recs,
+			                      (ssize_t)(c.n * sizeof(*recs)));
+		}
+	}
+
+	return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/**
+ * Handlers are run by way of timed(), which records how long they take
+ * in the histogram given along with them, and traces them.
+ */
+struct route {
+	esp_err_t (*fn)(httpd_req_t *req);
+	unsigned int m;
+};
+
+static esp_err_t timed(httpd_req_t *req)
+{
+	const struct route *r = req->user_ctx;
+	int64_t t;
+	esp_err_t ret;
+
+	served();
+	trace(TR_HTTP, (uint8_t)r->m);
+	t   = esp_timer_get_time();
+	ret = r->fn(req);
+	metrics_since(r->m, t);
+	trace(TR_HTTP_END, (uint8_t)r->m);
+	return ret;
+}
+
+static struct route on_route         = { on,            M_HTTP_ON       };
+static struct route off_route        = { off,           M_HTTP_OFF      };
+static struct route status_route     = { status,        M_HTTP_STATUS   };
+static struct route sched_on_route   = { schedule_on,   M_HTTP_SCHEDULE };
+static struct route sched_off_route  = { schedule_off,  M_HTTP_SCHEDULE };
+static struct route sched_list_route = { schedule_list, M_HTTP_SCHEDULE };
+static struct route sched_add_route  = { schedule_add,  M_HTTP_SCHEDULE };
+static struct route sched_del_route  = { schedule_del,  M_HTTP_SCHEDULE };
+static struct route batch_route      = { batch,         M_HTTP_BATCH    };
+static struct route channels_route   = { channels,      M_HTTP_DIM      };
+static struct route dim_route        = { dim,           M_HTTP_DIM      };
+static struct route index_route      = { idx,           M_HTTP_INDEX    };
+
 static httpd_uri_t on_uri = {
 	.uri      = "/on",
 	.method   = HTTP_HEAD,
-	.handler  = on,
-	.user_ctx = NULL
+	.handler  = timed,
+	.user_ctx = &on_route
 };
 
 static httpd_uri_t off_uri = {
 	.uri      = "/off",
 	.method   = HTTP_HEAD,
-	.handler  = off,
-	.user_ctx = NULL
+	.handler  = timed,
+	.user_ctx = &off_route
 };
 
 static httpd_uri_t status_uri = {
 	.uri      = "/status",
 	.method   = HTTP_HEAD,
-	.handler  = status,
-	.user_ctx = NULL
+	.handler  = timed,
+	.user_ctx = &status_route
 };
 
 static httpd_uri_t schedule_on_uri = {
 	.uri      = "/schedule/on",
 	.method   = HTTP_HEAD,
-	.handler  = schedule_on,
-	.user_ctx = NULL
+	.handler  = timed,
+	.user_ctx = &sched_on_route
 };
 
 static httpd_uri_t schedule_off_uri = {
 	.uri      = "/schedule/off",
 	.method   = HTTP_HEAD,
-	.handler  = schedule_off,
+	.handler  = timed,
+	.user_ctx = &sched_off_route
+};
+
+static httpd_uri_t schedule_list_uri = {
+	.uri      = "/schedule",
+	.method   = HTTP_GET,
+	.handler  = timed,
+	.user_ctx = &sched_list_route
+};
+
+static httpd_uri_t schedule_add_uri = {
+	.uri      = "/schedule/add",
+	.method   = HTTP_HEAD,
+	.handler  = timed,
+	.user_ctx = &sched_add_route
+};
+
+static httpd_uri_t schedule_del_uri = {
+	.uri      = "/schedule/del",
+	.method   = HTTP_HEAD,
+	.handler  = timed,
+	.user_ctx = &sched_del_route
+};
+
+static httpd_uri_t batch_uri = {
+	.uri      = "/batch",
+	.method   = HTTP_POST,
+	.handler  = timed,
+	.user_ctx = &batch_route
+};
+
+static httpd_uri_t channels_uri = {
+	.uri      = "/channels",
+	.method   = HTTP_GET,
+	.handler  = timed,
+	.user_ctx = &channels_route
+};
+
+static httpd_uri_t dim_uri = {
+	.uri      = "/dim",
+	.method   = HTTP_HEAD,
+	.handler  = timed,
+	.user_ctx = &dim_route
+};
+
+static httpd_uri_t ws_uri = {
+	.uri          = "/ws",
+	.method       = HTTP_GET,
+	.handler      = ws,
+	.user_ctx     = NULL,
+	.is_websocket = true
+};
+
+static httpd_uri_t metrics_uri = {
+	.uri      = "/metrics",
+	.method   = HTTP_GET,
+	.handler  = metrics,
+	.user_ctx = NULL
+};
+
+static httpd_uri_t trace_uri = {
+	.uri      = "/trace",
+	.method   = HTTP_GET,
+	.handler  = trace_dump,
+	.user_ctx = NULL
+};
+
+static httpd_uri_t boot_uri = {
+	.uri      = "/boot",
+	.method   = HTTP_GET,
+	.handler  = boot_report,
 	.user_ctx = NULL
 };
 
 static httpd_uri_t index_uri = {
 	.uri      = "/*",
 	.method   = HTTP_GET,
-	.handler  = idx,
-	.user_ctx = NULL
+	.handler  = timed,
+	.user_ctx = &index_route
 };
 
 void http_start(void)
 {
+	int64_t t;
+
+	up_at = esp_timer_get_time();
+	atomic_store(&up, 1);
+
 	if (server) return;
+	if (!boot_id) boot_id = esp_random();
+	if (!cmd_done && !(cmd_done = xSemaphoreCreateBinary())) {
+		err("failed to create semaphore");
+		return;
+	}
 
-	ESP_ERROR_CHECK(esp_vfs_spiffs_register(&fs_conf));
-	config.uri_match_fn = httpd_uri_match_wildcard;
+	config.uri_match_fn     = httpd_uri_match_wildcard;
+	config.max_uri_handlers = 16;
 	if (httpd_start(&server, &config) != ESP_OK) {
 		server = NULL;
 		err("failed to start");
@@ -278,17 +1185,45 @@ void http_start(void)
 	httpd_register_uri_handler(server, &status_uri);
 	httpd_register_uri_handler(server, &schedule_on_uri);
 	httpd_register_uri_handler(server, &schedule_off_uri);
+	httpd_register_uri_handler(server, &schedule_list_uri);
+	httpd_register_uri_handler(server, &schedule_add_uri);
+	httpd_register_uri_handler(server, &schedule_del_uri);
+	httpd_register_uri_handler(server, &batch_uri);
+	httpd_register_uri_handler(server, &channels_uri);
+	httpd_register_uri_handler(server, &dim_uri);
+	httpd_register_uri_handler(server, &ws_uri);
+	httpd_register_uri_handler(server, &metrics_uri);
+	httpd_register_uri_handler(server, &trace_uri);
+	httpd_register_uri_handler(server, &boot_uri);
 	httpd_register_uri_handler(server, &index_uri);
 	info("done");
+
+	if ((t = boot_mark(BOOT_HTTP)))
+		info("ready %u ms after boot", (unsigned int)(t / 1000));
 }
 
-void http_stop(void)
+/**
+ * The listening socket is bound to any address, so it outlives the
+ * link, but the clients' connections won't, so close them now rather
+ * than have them linger until they time out.
+ */
+static void drop(void *arg)
 {
-	if (!server) return;
+	int fds[MAX_CLIENTS];
+	size_t i, n = MAX_CLIENTS;
+
+	(void)arg;
+	nsubs = 0;
+	if (httpd_get_client_list(server, &n, fds) != ESP_OK)
+		return;
 
-	info("stopping");
-	httpd_stop(server);
-	esp_vfs_spiffs_unregister(fs_conf.partition_label);
-	server = NULL;
+	for (i = 0; i < n; i++)
+		httpd_sess_trigger_close(server, fds[i]);
+	info("closed %u connections", (unsigned int)n);
+}
+
+void http_drop(void)
+{
+	if (server) httpd_queue_work(server, drop, NULL);
 }
 
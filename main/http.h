@@ -1,7 +1,25 @@
 #ifndef LIGHTCTL_HTTP_H
 #define LIGHTCTL_HTTP_H
 
+#include <stdint.h>
+
+/**
+ * Start the server, or note that the link is back up if it's running.
+ * http_drop() closes the clients' connections when the link goes down;
+ * The server and its routes stay up.
+ */
 void http_start(void);
-void http_stop(void);
+void http_drop(void);
+
+/**
+ * Push the status to the websocket subscribers, if the settings
+ * changed since the last time
+ */
+void http_notify(void);
+
+/**
+ * The command posted by a handler, with seq as its data, is done
+ */
+void http_done(uint32_t seq);
 
 #endif /* LIGHTCTL_HTTP_H */
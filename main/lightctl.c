@@ -1,5 +1,6 @@
 
 #include <time.h>
+#include <sys/time.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
@@ -7,6 +8,7 @@
 #include <esp_event.h>
 #include <esp_timer.h>
 #include <esp_sntp.h>
+#include <nvs_flash.h>
 #include <driver/gpio.h>
 
 #if CONFIG_PM_ENABLE
@@ -18,25 +20,40 @@
 #include <mdns.h>
 
 #include "log.h"
+#include "boot.h"
 #include "event.h"
+#include "ctl.h"
+#include "metrics.h"
+#include "trace.h"
 #include "dallas.h"
 #include "settings.h"
+#include "sched.h"
+#include "switch.h"
 #include "wifi.h"
 #include "http.h"
+#include "power.h"
+#include "dim.h"
+#include "clock.h"
 
 /**
  * Microsecond conversion macros
  */
 #define SECONDS 1000000
-#define MINUTES (uint64_t)(60 * SECONDS)
-#define HOURS   (uint64_t)(60 * MINUTES)
 
-ESP_EVENT_DEFINE_BASE(LIGHTCTL_EVENT);
+/**
+ * Second conversion macros
+ */
+#define MINUTE 60
+#define HOUR   (60 * MINUTE)
+#define DAY    (24 * HOUR)
 
-esp_event_loop_handle_t lightctl_ev;
 static esp_timer_handle_t timer;
 static const char *TAG = "lightctl";
 
+static time_t next_time;   /**< Time of the next transition  */
+static int next_on;        /**< Is it an "on" transition?    */
+static int scheduled;      /**< Daily window, or any rules   */
+
 static gpio_config_t ls_conf = {
 	.mode         = GPIO_MODE_OUTPUT,
 	.intr_type    = GPIO_PIN_INTR_DISABLE,
@@ -55,14 +72,6 @@ static gpio_config_t sw_conf = {
 	                (1ULL << CONFIG_GPIO_SWOFF)
 };
 
-static esp_event_loop_args_t ev_args = {
-	.queue_size      = CONFIG_ESP_SYSTEM_EVENT_QUEUE_SIZE,
-	.task_name       = "lightctl_ev",
-	.task_priority   = 0,
-	.task_stack_size = CONFIG_LIGHTCTL_EVLOOP_STACK_SIZE,
-	.task_core_id    = tskNO_AFFINITY
-};
-
 #if CONFIG_PM_ENABLE
 static esp_pm_config_esp32_t pm_config = {
 	.min_freq_mhz = CONFIG_ESP32_XTAL_FREQ,
@@ -73,123 +82,232 @@ static esp_pm_config_esp32_t pm_config = {
 };
 #endif /* PM_ENABLE */
 
-static void IRAM_ATTR switch_isr(void *arg)
-{
-	(void)arg;
-	esp_event_isr_post_to(lightctl_ev, LIGHTCTL_EVENT, SWITCH,
-	                      NULL, 0, NULL);
-}
-
 static void lights_on(void)
 {
+	int64_t t = esp_timer_get_time();
+
 	if (gpio_get_level(CONFIG_GPIO_SWOFF))
 		return;
 
-	gpio_set_level(CONFIG_GPIO_LIGHTS, 1);
+	dim_set(DIM_ALL, DIM_PRESET, CONFIG_LIGHTCTL_DIM_FADE_MS);
+	power_lights(1);
+	trace(TR_LIGHTS, 1);
 	settings_lock();
 	settings.lights_status = 1;
 	settings_unlock();
+	metrics_since(M_LIGHTS, t);
 }
 
 static void lights_off(void)
 {
+	int64_t t = esp_timer_get_time();
+
 	if (gpio_get_level(CONFIG_GPIO_SWON))
 		return;
 
-	gpio_set_level(CONFIG_GPIO_LIGHTS, 0);
+	dim_set(DIM_ALL, 0, CONFIG_LIGHTCTL_DIM_FADE_MS);
+	power_lights(0);
+	trace(TR_LIGHTS, 0);
 	settings_lock();
 	settings.lights_status = 0;
 	settings_unlock();
+	metrics_since(M_LIGHTS, t);
 }
 
-static void schedule(void *arg)
+/**
+ * Set some of the channels, or their presets. The lights are on while
+ * any channel is, and the override switch has the last word, as it does
+ * for ON and OFF.
+ */
+static void dim(const struct dim *d)
 {
-	unsigned int shr, smn, ehr, emn;
-	time_t now    = time(NULL);
-	struct tm *tm = gmtime(&now);
-	(void)arg;
+	int64_t t = esp_timer_get_time();
+	int on;
+
+	if (d->preset) {
+		dim_preset(d->mask, d->level);
+		return;
+	}
+
+	if (gpio_get_level(d->level ? CONFIG_GPIO_SWOFF : CONFIG_GPIO_SWON))
+		return;
 
+	dim_set(d->mask, d->level, d->ms);
+	on = !!dim_lit();
+	power_lights(on);
+	trace(TR_LIGHTS, (uint8_t)on);
 	settings_lock();
-	shr = settings.shr;
-	smn = settings.smn;
-	ehr = settings.ehr;
-	emn = settings.emn;
+	settings.lights_status = (uint8_t)on;
 	settings_unlock();
+	metrics_since(M_LIGHTS, t);
+}
 
-	/**
-	 * If the ending time is in the same hour and preceeds the
-	 * starting minute, handle the ending first.
-	 */
-	if (tm->tm_hour == ehr && ehr == shr && emn < smn) {
-		if (tm->tm_min < emn) {
-			esp_timer_start_once(
-				timer,
-				(emn - tm->tm_min) * MINUTES -
-				tm->tm_sec * SECONDS
-			);
-			return;
-		}
+/**
+ * Arm the timer for the first transition after t
+ */
+static void schedule_plan(time_t t)
+{
+	struct timeval tv;
+	int64_t delay;
 
-		if (tm->tm_min < smn)
-			lights_off();
-	}
+	esp_timer_stop(timer);
+	if (!scheduled)
+		return;
+
+	/* Nothing happens within the next week: Check again then */
+	if (!(next_time = sched_next(t, &next_on)))
+		next_time = t + 7 * DAY;
 
-	/**
-	 * We're in the starting hour, but haven't gotten to the
-	 * minute yet.
-	 */
-	if (tm->tm_hour == shr && tm->tm_min < smn) {
-		esp_timer_start_once(
-			timer,
-			(smn - tm->tm_min) * MINUTES -
-			tm->tm_sec * SECONDS
-		);
+	gettimeofday(&tv, NULL);
+	delay = clock_span((int64_t)(next_time - tv.tv_sec) * SECONDS -
+	                   tv.tv_usec);
+	esp_timer_start_once(timer, delay > 0 ? (uint64_t)delay : 0);
+}
+
+/**
+ * The transition we planned for is due: Bring the lights to the state
+ * the schedule has them in now, rather than the one we planned for.
+ */
+static void schedule(void)
+{
+	int64_t t = esp_timer_get_time();
+	time_t now = time(NULL);
 
+	if (!scheduled)
 		return;
-	} else if (tm->tm_hour == shr && tm->tm_min >= smn)
-		lights_on();
 
-	/**
-	 * We're in the ending hour, but haven't gotten to the
-	 * minute yet.
-	 */
-	if (tm->tm_hour == ehr && tm->tm_min < emn) {
-		esp_timer_start_once(
-			timer,
-			(emn - tm->tm_min) * MINUTES -
-			tm->tm_sec * SECONDS
-		);
+	/* Woke up early, e.g. the clock was slewed */
+	if (now < next_time) {
+		schedule_plan(now - 1);
+		return;
+	}
 
+	if (sched_state(now)) lights_on();
+	else lights_off();
+	schedule_plan(now);
+	metrics_since(M_SCHEDULE, t);
+}
+
+/**
+ * The wall clock was set. If that took us past the next transition,
+ * bring the lights to the state of the last one, then re-plan.
+ */
+static void schedule_clock(void)
+{
+	time_t now = time(NULL);
+
+	if (!scheduled)
 		return;
-	} else if (tm->tm_hour == ehr && tm->tm_min >= emn)
-		lights_off();
 
-	/* Check again at the top of the next hour */
-	esp_timer_start_once(timer, HOURS -
-		            tm->tm_min * MINUTES -
-		            tm->tm_sec * SECONDS);
+	if (now >= next_time) {
+		if (sched_state(now)) lights_on();
+		else lights_off();
+	}
+
+	schedule_plan(now);
+}
+
+/**
+ * The schedule changed, or was enabled or disabled (as at boot): Rebuild
+ * the map of it, bring the lights to the state it has them in now, and
+ * re-plan. Returns non-zero if there's anything scheduled.
+ */
+static int schedule_update(void)
+{
+	struct lightctl_settings s;
+	time_t now = time(NULL);
 
+	settings_snapshot(&s);
+	if ((scheduled = sched_compile(&s))) {
+		if (sched_state(now)) lights_on();
+		else lights_off();
+	}
+
+	schedule_plan(now);
+	return scheduled;
 }
 
-static void app_event(void *arg, esp_event_base_t event_base,
-                      int32_t event_id, void *event_data)
+/**
+ * Apply a batch of commands as one change to the settings, which is
+ * written back right away, in a single burst. The lights are followed
+ * through the commands in order, as they'd have been run one by one,
+ * and only brought to where they end up; The schedule's re-planned
+ * once, for the end result.
+ */
+static void batch(const struct batch *b)
+{
+	int lights = -1, on, sched = 0;
+	time_t now = time(NULL);
+	unsigned int i, dirty = 0;
+
+	settings_lock();
+	on = settings.lights_status;
+	for (i = 0; i < b->n && i < BATCH_MAX; i++) {
+		switch (b->cmd[i].id) {
+		case ON:
+		case OFF:
+			lights            = b->cmd[i].id == ON;
+			on                = lights;
+			settings.light_sw = lights;
+			dirty            |= DIRTY_SW;
+			break;
+		case SCHED_ON:
+			sched             = 1;
+			settings.sched_sw = 1;
+			settings.shr      = b->cmd[i].shr;
+			settings.smn      = b->cmd[i].smn;
+			settings.ehr      = b->cmd[i].ehr;
+			settings.emn      = b->cmd[i].emn;
+			dirty            |= DIRTY_SCHED;
+			if ((scheduled = sched_compile(&settings)))
+				lights = on = sched_state(now);
+			break;
+		case SCHED_OFF:
+			sched             = 1;
+			settings.sched_sw = 0;
+			dirty            |= DIRTY_SSW;
+
+			/* Without the daily window, the rules may still have them */
+			if ((scheduled = sched_compile(&settings)))
+				lights = on = sched_state(now);
+			else if (!settings.light_sw && on)
+				lights = on = 0;
+			break;
+		}
+	}
+
+	settings.dirty |= dirty;
+	settings_unlock();
+	settings_flush();
+
+	if (sched)
+		schedule_plan(now);
+
+	if (lights == 1) lights_on();
+	else if (!lights) lights_off();
+}
+
+static void schedule_timer(void *arg)
 {
 	(void)arg;
-	(void)event_base;
-	(void)event_data;
+	trace(TR_SCHEDULE, (uint8_t)next_on);
+	ctl_send(SCHEDULE, 0);
+}
 
-	switch (event_id) {
+static void control(const struct ctl_cmd *c)
+{
+	switch (c->id) {
+	case DEBOUNCE:
+		switch_debounce();
+		break;
 	case SWITCH:
 		settings_lock();
 		settings.override_sw = gpio_get_level(CONFIG_GPIO_SWON);
 		if (gpio_get_level(CONFIG_GPIO_SWOFF))
 			settings.override_sw |= 2;
 
-		if (!settings.override_sw) {
-			esp_event_post_to(lightctl_ev, LIGHTCTL_EVENT,
-			                  settings.light_sw ? ON : OFF,
-			                  NULL, 0, 0);
-		}
+		if (!settings.override_sw)
+			ctl_send(settings.light_sw ? ON : OFF, 0);
 		settings_unlock();
 
 		if (gpio_get_level(CONFIG_GPIO_SWON))       lights_on();
@@ -198,76 +316,119 @@ static void app_event(void *arg, esp_event_base_t event_base,
 	case ON:
 		settings_lock();
 		settings.light_sw = 1;
-		dallas_write(SETTINGS_SW, 1);
+		settings_dirty(DIRTY_SW);
 		settings_unlock();
 		lights_on();
+		metrics_since(M_ACTUATE, c->t);
+		if (c->seq) http_done(c->seq);
 		break;
 	case OFF:
 		settings_lock();
 		settings.light_sw = 0;
-		dallas_write(SETTINGS_SW, 0);
+		settings_dirty(DIRTY_SW);
 		settings_unlock();
 		lights_off();
+		metrics_since(M_ACTUATE, c->t);
+		if (c->seq) http_done(c->seq);
 		break;
 	case SCHED_ON:
-		esp_timer_stop(timer);
 		settings_lock();
 		settings.sched_sw = 1;
-		dallas_write(SETTINGS_SSW, 1);
-		dallas_write(SETTINGS_SHR, settings.shr);
-		dallas_write(SETTINGS_SMN, settings.smn);
-		dallas_write(SETTINGS_EHR, settings.ehr);
-		dallas_write(SETTINGS_EMN, settings.emn);
+		settings_dirty(DIRTY_SCHED);
 		settings_unlock();
-		schedule(NULL);
+		schedule_update();
+		break;
+	case SCHED_RULES:
+		schedule_update();
 		break;
 	case SCHED_OFF:
-		esp_timer_stop(timer);
 		settings_lock();
 		settings.sched_sw = 0;
-		if (!settings.light_sw && settings.lights_status) {
-			esp_event_post_to(lightctl_ev, LIGHTCTL_EVENT, OFF,
-			                  NULL, 0, 0);
-		}
+		settings_dirty(DIRTY_SSW);
 		settings_unlock();
-		dallas_write(SETTINGS_SSW, 0);
+		if (schedule_update())
+			break;
+
+		settings_lock();
+		if (!settings.light_sw && settings.lights_status)
+			ctl_send(OFF, 0);
+		settings_unlock();
+		break;
+	case FLUSH:
+		settings_flush();
+		break;
+	case BATCH:
+		batch(&c->batch);
+		http_done(c->seq);
+		break;
+	case SCHEDULE:
+		schedule();
+		break;
+	case TIMESYNC:
+		clock_sync();
+		schedule_clock();
+		break;
+	case CLOCK:
+		if (clock_slew())
+			schedule_clock();
 		break;
 	case CONNECTED:
-		sntp_set_time_sync_notification_cb(dallas_sync);
 		if (!sntp_restart()) sntp_init();
 		http_start();
 		break;
 	case LOSTCONN:
 		info("connection lost");
-		http_stop();
+		http_drop();
 		sntp_stop();
 		break;
+	case SLEEP:
+		power_sleep();
+		break;
+	case DIM:
+		dim(&c->dim);
+		metrics_since(M_ACTUATE, c->t);
+		http_done(c->seq);
+		break;
 	}
 }
 
 static esp_timer_create_args_t timer_args = {
 	.name     = "schedule_timer",
-	.callback = schedule,
+	.callback = schedule_timer,
 	.dispatch_method = ESP_TIMER_TASK
 };
 
-void app_main(void)
+/**
+ * Once the commands queued at boot have been run, the lights are as
+ * they should be.
+ */
+static void idle(void)
 {
-#if CONFIG_PM_ENABLE
-	ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
-#endif
+	int64_t t;
 
-	/* Create our timer */
-	esp_timer_init();
-	esp_timer_create(&timer_args, &timer);
+	if ((t = boot_mark(BOOT_LIGHTS)))
+		info("lights set %u ms after boot", (unsigned int)(t / 1000));
+	http_notify();
+}
 
-	/* Create our event loop */
-	ev_args.task_priority = uxTaskPriorityGet(NULL);
-	esp_event_loop_create_default();
-	esp_event_loop_create(&ev_args, &lightctl_ev);
-	esp_event_handler_register_with(lightctl_ev, LIGHTCTL_EVENT,
-	                                ESP_EVENT_ANY_ID, app_event, NULL);
+static void boot_nvs(void)
+{
+	esp_err_t ret;
+
+	/* NVS holds the schedule rules, and maybe the wifi config */
+	info("Initializing nvs...");
+	ret = nvs_flash_init();
+	if (ret == ESP_ERR_NVS_NO_FREE_PAGES ||
+	    ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+		ESP_ERROR_CHECK(nvs_flash_erase());
+		ret = nvs_flash_init();
+	}
 
+	ESP_ERROR_CHECK(ret);
+}
+
+static void boot_gpio(void)
+{
 	info("Initializing gpio...");
 	gpio_config(&sw_conf);
 	gpio_config(&ls_conf);
@@ -276,45 +437,104 @@ void app_main(void)
 	gpio_set_drive_capability(CONFIG_GPIO_LIGHTS,     GPIO_DRIVE_CAP_2);
 	gpio_set_drive_capability(CONFIG_GPIO_STATUS_LED, GPIO_DRIVE_CAP_1);
 
-	/* Initialize the pin levels */
-	gpio_set_level(CONFIG_GPIO_LIGHTS, 0);
+	/* Initialize the pin levels, leaving the lights as they were */
+	gpio_set_level(CONFIG_GPIO_LIGHTS, power_boot_lights());
 	gpio_set_level(CONFIG_GPIO_STATUS_LED, 0);
 
 	/* Configure the ISR service */
 	gpio_install_isr_service(0);
-	gpio_isr_handler_add(CONFIG_GPIO_SWON, switch_isr, NULL);
-	gpio_isr_handler_add(CONFIG_GPIO_SWOFF, switch_isr, NULL);
+	switch_init();
 
 #if CONFIG_PM_ENABLE
 	gpio_wakeup_enable(CONFIG_GPIO_SWON,  GPIO_INTR_HIGH_LEVEL);
 	gpio_wakeup_enable(CONFIG_GPIO_SWOFF, GPIO_INTR_HIGH_LEVEL);
 	esp_sleep_enable_gpio_wakeup();
 #endif
+}
 
-	/* Get the time and settings from the dallas */
+/**
+ * Get the time and settings from the dallas
+ */
+static void boot_rtc(void)
+{
 	settings_init();
 	dallas_init();
+}
 
-	/* Sample the switch state and set the schedule configuration */
-	esp_event_post_to(lightctl_ev, LIGHTCTL_EVENT, SWITCH, NULL, 0, 0);
-	settings_lock();
-	esp_event_post_to(lightctl_ev, LIGHTCTL_EVENT,
-	                  settings.sched_sw ? SCHED_ON : SCHED_OFF,
-	                  NULL, 0, 0);
-	settings_unlock();
+/**
+ * Take the lights over from the pin, as they were left
+ */
+static void boot_dim(void)
+{
+	dim_init(power_boot_lights());
+}
 
-	/* Initial SNTP options */
-	sntp_setoperatingmode(SNTP_OPMODE_POLL);
-	sntp_setservername(0, "pool.ntp.org");
+/**
+ * Sample the switch state and set the schedule configuration. Commands
+ * queued before this, e.g. by the switch or the wifi, wait for it.
+ */
+static void boot_ctl(void)
+{
+	struct lightctl_settings s;
 
-#ifdef CONFIG_SNTP_TIME_SYNC_METHOD_SMOOTH
-	sntp_set_sync_mode(SNTP_SYNC_MODE_SMOOTH);
-#endif
+	ctl_send(SWITCH, 0);
+	settings_snapshot(&s);
+	ctl_send(s.sched_sw ? SCHED_ON : SCHED_OFF, 0);
+	ctl_start();
+	power_init();
+}
 
-	/* mdns itself hooks the wifi / ip events */
+/**
+ * mdns itself hooks the wifi / ip events
+ */
+static void boot_mdns(void)
+{
 	mdns_init();
 	mdns_hostname_set(CONFIG_LWIP_LOCAL_HOSTNAME);
 	mdns_service_add("lightctl", "_http", "_tcp", 80, NULL, 0);
-	wifi_init();
 }
 
+/**
+ * The station is started as soon as NVS is up, while the DS1302 is
+ * read; The lights wait on the latter, not the former.
+ */
+static const struct boot_phase phases[BOOT_PHASES] = {
+	[BOOT_NVS]   = { boot_nvs,   0 },
+	[BOOT_GPIO]  = { boot_gpio,  0 },
+	[BOOT_WIFI]  = { wifi_init,  BOOT_DEP(BOOT_NVS) |
+	                             BOOT_DEP(BOOT_GPIO) },
+	[BOOT_RTC]   = { boot_rtc,   BOOT_DEP(BOOT_GPIO) },
+	[BOOT_DIM]   = { boot_dim,   BOOT_DEP(BOOT_NVS) |
+	                             BOOT_DEP(BOOT_GPIO) },
+	[BOOT_SCHED] = { sched_init, BOOT_DEP(BOOT_NVS) },
+	[BOOT_CTL]   = { boot_ctl,   BOOT_DEP(BOOT_RTC) |
+	                             BOOT_DEP(BOOT_DIM) |
+	                             BOOT_DEP(BOOT_SCHED) },
+	[BOOT_MDNS]  = { boot_mdns,  BOOT_DEP(BOOT_WIFI) },
+};
+
+void app_main(void)
+{
+#if CONFIG_PM_ENABLE
+	ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
+#endif
+
+	/* Messages are formatted by a task of their own */
+	log_start();
+
+	/* Create our timer */
+	esp_timer_init();
+	esp_timer_create(&timer_args, &timer);
+
+	/* The default event loop is for wifi; Ours is the control queue */
+	esp_event_loop_create_default();
+	ctl_init(control, idle);
+
+	/* Initial SNTP options */
+	sntp_setoperatingmode(SNTP_OPMODE_POLL);
+	sntp_setservername(0, "pool.ntp.org");
+
+	clock_init();
+
+	boot_run(phases);
+}
@@ -0,0 +1,145 @@
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include <esp_timer.h>
+
+#include "log.h"
+
+#define LEN  CONFIG_LIGHTCTL_LOG_LEN
+#define MASK (LEN - 1)
+
+_Static_assert(!(LEN & MASK), "CONFIG_LIGHTCTL_LOG_LEN isn't a power of 2");
+
+/**
+ * Bounded MPSC ring, as in ctl.c, except that a message which doesn't
+ * fit is dropped rather than waited on. Slot i's sequence number is
+ * kept less i, so that the ring needs no setup, and messages logged
+ * before log_start() are kept.
+ */
+static struct rec {
+	atomic_uint seq;
+	uint8_t level;
+	uint8_t n;
+	const char *tag;
+	const char *fmt;
+	int64_t t;
+	uint32_t args[LOG_ARGS];
+} ring[LEN];
+
+static atomic_uint head;
+static unsigned int tail;
+static atomic_uint dropped;
+
+/**
+ * As in ctl.c, the task sets sleeping before it checks the ring one
+ * last time and blocks; Only the message that clears it gives wake.
+ */
+static SemaphoreHandle_t wake;
+static atomic_int sleeping;
+
+void log_write(uint8_t level, const char *tag, const char *fmt,
+               unsigned int n, const uint32_t *args)
+{
+	unsigned int pos = atomic_load_explicit(&head, memory_order_relaxed);
+	unsigned int i;
+	struct rec *r;
+	int diff;
+
+	for (;;) {
+		r    = &ring[pos & MASK];
+		diff = (int)(atomic_load_explicit(&r->seq, memory_order_acquire)
+		             + (pos & MASK) - pos);
+		if (!diff) {
+			if (atomic_compare_exchange_weak_explicit(&head, &pos,
+			    pos + 1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			atomic_fetch_add_explicit(&dropped, 1,
+			                          memory_order_relaxed);
+			return;
+		} else {
+			pos = atomic_load_explicit(&head, memory_order_relaxed);
+		}
+	}
+
+	r->t     = esp_timer_get_time();
+	r->level = level;
+	r->tag   = tag;
+	r->fmt   = fmt;
+	r->n     = (uint8_t)(n < LOG_ARGS ? n : LOG_ARGS);
+	for (i = 0; i < r->n; i++)
+		r->args[i] = args[i];
+
+	atomic_store_explicit(&r->seq, pos + 1 - (pos & MASK),
+	                      memory_order_release);
+	if (wake && atomic_exchange(&sleeping, 0))
+		xSemaphoreGive(wake);
+}
+
+unsigned int log_flush(void)
+{
+	uint32_t a[LOG_ARGS] = { 0 };
+	unsigned int i, n = 0;
+	const char *tag, *fmt;
+	char buf[160];
+	uint8_t level;
+	struct rec *r;
+	int64_t t;
+
+	for (;; ++n, ++tail) {
+		r = &ring[tail & MASK];
+		if (atomic_load_explicit(&r->seq, memory_order_acquire)
+		    + (tail & MASK) != tail + 1)
+			break;
+
+		t     = r->t;
+		level = r->level;
+		tag   = r->tag;
+		fmt   = r->fmt;
+		for (i = 0; i < LOG_ARGS; i++)
+			a[i] = i < r->n ? r->args[i] : 0;
+		atomic_store_explicit(&r->seq, tail + LEN - (tail & MASK),
+		                      memory_order_release);
+
+		/* Surplus arguments are ignored */
+		snprintf(buf, sizeof(buf), fmt, a[0], a[1], a[2], a[3], a[4],
+		         a[5]);
+		esp_log_write(level, tag, "%c (%u) %s: %s\n", "NEWIDV"[level],
+		              (unsigned int)(t / 1000), tag, buf);
+	}
+
+	return n;
+}
+
+uint32_t log_dropped(void)
+{
+	return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
+
+static void task(void *arg)
+{
+	unsigned int pos;
+
+	(void)arg;
+	for (;;) {
+		pos = tail;
+		atomic_store(&sleeping, 1);
+		if (atomic_load(&ring[pos & MASK].seq) + (pos & MASK) != pos + 1)
+			xSemaphoreTake(wake, portMAX_DELAY);
+		atomic_store(&sleeping, 0);
+		log_flush();
+	}
+}
+
+void log_start(void)
+{
+	if (!(wake = xSemaphoreCreateBinary()))
+		return;
+
+	xTaskCreate(task, "lightctl_log", CONFIG_LIGHTCTL_LOG_STACK_SIZE,
+	            NULL, tskIDLE_PRIORITY + 1, NULL);
+}
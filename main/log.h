@@ -1,11 +1,74 @@
 #ifndef LIGHTCTL_LOG_H
 #define LIGHTCTL_LOG_H
 
+#include <stdint.h>
 #include <esp_log.h>
 
-#define err(fmt, ...)   ESP_LOGE(TAG, fmt, ##__VA_ARGS__)
-#define warn(fmt, ...)  ESP_LOGW(TAG, fmt, ##__VA_ARGS__)
-#define info(fmt, ...)  ESP_LOGI(TAG, fmt, ## __VA_ARGS__)
-#define debug(fmt, ...) ESP_LOGI(TAG, fmt, ##__VA_ARGS__)
+/**
+ * Deferred logging
+ *
+ * The macros below store the format, the tag, and up to LOG_ARGS
+ * integer arguments of 32 bits or less in a ring, and the log task
+ * formats them later, at a low priority. The format and the tag have
+ * to outlive the record, so no %s.
+ *
+ * Messages above CONFIG_LIGHTCTL_LOG_LEVEL compile out, though their
+ * arguments are still checked against the format.
+ */
+#define LOG_ARGS 6
+
+void log_write(uint8_t level, const char *tag, const char *fmt,
+               unsigned int n, const uint32_t *args);
+
+/**
+ * Format and write out the pending messages, returning how many.
+ * This is done by the log task, once log_start() has started it.
+ */
+unsigned int log_flush(void);
+uint32_t log_dropped(void);
+void log_start(void);
+
+static inline void __attribute__((format(printf, 1, 2)))
+log_check(const char *fmt, ...)
+{
+	(void)fmt;
+}
+
+#define log_(level, fmt, ...) do { \
+	const uint32_t log_args_[] = { 0, ##__VA_ARGS__ }; \
+	_Static_assert(sizeof(log_args_) <= (LOG_ARGS + 1) * 4, \
+	               "too many arguments to log"); \
+	if (0) log_check(fmt, ##__VA_ARGS__); \
+	log_write(level, TAG, fmt, \
+	          sizeof(log_args_) / sizeof(*log_args_) - 1, log_args_ + 1); \
+} while (0)
+
+#define log_off(fmt, ...) do { \
+	if (0) log_check(fmt, ##__VA_ARGS__); \
+} while (0)
+
+#if CONFIG_LIGHTCTL_LOG_LEVEL >= 1
+#define err(fmt, ...)   log_(ESP_LOG_ERROR, fmt, ##__VA_ARGS__)
+#else
+#define err(fmt, ...)   log_off(fmt, ##__VA_ARGS__)
+#endif
+
+#if CONFIG_LIGHTCTL_LOG_LEVEL >= 2
+#define warn(fmt, ...)  log_(ESP_LOG_WARN, fmt, ##__VA_ARGS__)
+#else
+#define warn(fmt, ...)  log_off(fmt, ##__VA_ARGS__)
+#endif
+
+#if CONFIG_LIGHTCTL_LOG_LEVEL >= 3
+#define info(fmt, ...)  log_(ESP_LOG_INFO, fmt, ##__VA_ARGS__)
+#else
+#define info(fmt, ...)  log_off(fmt, ##__VA_ARGS__)
+#endif
+
+#if CONFIG_LIGHTCTL_LOG_LEVEL >= 4
+#define debug(fmt, ...) log_(ESP_LOG_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define debug(fmt, ...) log_off(fmt, ##__VA_ARGS__)
+#endif
 
 #endif /* LIGHTCTL_LOG_H */
@@ -0,0 +1,141 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include <esp_attr.h>
+#include <esp_timer.h>
+
+#include "metrics.h"
+
+static struct hist {
+	const char *name;   /**< Metric name               */
+	const char *labels; /**< Labels, or NULL           */
+	const char *help;   /**< Description               */
+	atomic_uint n[METRICS_BUCKETS];
+	atomic_ullong sum;  /**< Microseconds              */
+} hists[METRICS] = {
+	[M_HTTP_ON]       = { "lightctl_http_seconds", "handler=\"on\"",
+	                      "Time spent handling a request" },
+	[M_HTTP_OFF]      = { "lightctl_http_seconds", "handler=\"off\"" },
+	[M_HTTP_STATUS]   = { "lightctl_http_seconds", "handler=\"status\"" },
+	[M_HTTP_SCHEDULE] = { "lightctl_http_seconds",
+	                      "handler=\"schedule\"" },
+	[M_HTTP_BATCH]    = { "lightctl_http_seconds", "handler=\"batch\"" },
+	[M_HTTP_DIM]      = { "lightctl_http_seconds", "handler=\"dim\"" },
+	[M_HTTP_INDEX]    = { "lightctl_http_seconds", "handler=\"index\"" },
+	[M_QUEUE]         = { "lightctl_queue_seconds", NULL,
+	                      "Time a command waits in the control queue" },
+	[M_CONTROL]       = { "lightctl_control_seconds", NULL,
+	                      "Time spent carrying out a command" },
+	[M_ACTUATE]       = { "lightctl_actuation_seconds", NULL,
+	                      "Time from an on/off command being queued "
+	                      "to the lights switching" },
+	[M_LIGHTS]        = { "lightctl_lights_seconds", NULL,
+	                      "Time spent switching the lights" },
+	[M_LOCK]          = { "lightctl_settings_lock_seconds", NULL,
+	                      "Time spent waiting for the settings lock" },
+	[M_DALLAS]        = { "lightctl_dallas_xfer_seconds", NULL,
+	                      "Duration of a DS1302 transfer" },
+	[M_SCHEDULE]      = { "lightctl_schedule_seconds", NULL,
+	                      "Time spent on a scheduled transition" },
+	[M_WIFI_BOOT]     = { "lightctl_wifi_connect_seconds",
+	                      "after=\"boot\"",
+	                      "Time to get an address, after boot or "
+	                      "losing the link" },
+	[M_WIFI_DROP]     = { "lightctl_wifi_connect_seconds",
+	                      "after=\"drop\"" },
+	[M_HTTP_FIRST]    = { "lightctl_http_first_request_seconds", NULL,
+	                      "Time from getting an address to serving "
+	                      "the first request" },
+};
+
+/**
+ * Upper bounds of the buckets; The last one is +Inf
+ */
+static const char *const le[METRICS_BUCKETS] = {
+	"1e-06", "4e-06", "1.6e-05", "6.4e-05", "0.000256", "0.001024",
+	"0.004096", "0.016384", "0.065536", "0.262144", "1.048576", "+Inf"
+};
+
+/**
+ * Bucket i holds values up to 4^i us
+ */
+static unsigned int IRAM_ATTR bucket(uint32_t us)
+{
+	unsigned int i;
+
+	if (us <= 1)
+		return 0;
+
+	i = (33 - (unsigned int)__builtin_clz(us - 1)) >> 1;
+	return i < METRICS_BUCKETS ? i : METRICS_BUCKETS - 1;
+}
+
+void IRAM_ATTR metrics_observe(unsigned int m, uint32_t us)
+{
+	if (m >= METRICS)
+		return;
+
+	atomic_fetch_add_explicit(&hists[m].n[bucket(us)], 1,
+	                          memory_order_relaxed);
+	atomic_fetch_add_explicit(&hists[m].sum, us, memory_order_relaxed);
+}
+
+void IRAM_ATTR metrics_since(unsigned int m, int64_t t0)
+{
+	int64_t us = esp_timer_get_time() - t0;
+
+	metrics_observe(m, us < 0 ? 0 : us > UINT32_MAX ? UINT32_MAX
+	                                                : (uint32_t)us);
+}
+
+size_t metrics_format(unsigned int m, char *buf, size_t len)
+{
+	const struct hist *h;
+	const char *sep;
+	unsigned int i;
+	unsigned long long sum;
+	uint32_t n = 0;
+	size_t off = 0;
+	int r;
+
+	if (m >= METRICS)
+		return 0;
+
+	h   = &hists[m];
+	sep = h->labels ? "," : "";
+
+/* Append to buf, bailing out if it doesn't fit */
+#define out(...) do { \
+	r = snprintf(buf + off, len - off, __VA_ARGS__); \
+	if (r < 0 || (size_t)r >= len - off) return 0; \
+	off += (size_t)r; \
+} while (0)
+
+	if (!m || strcmp(h->name, hists[m - 1].name)) {
+		out("# HELP %s %s\n# TYPE %s histogram\n",
+		    h->name, h->help, h->name);
+	}
+
+	for (i = 0; i < METRICS_BUCKETS; i++) {
+		n += atomic_load_explicit(&h->n[i], memory_order_relaxed);
+		out("%s_bucket{%s%sle=\"%s\"} %u\n", h->name,
+		    h->labels ? h->labels : "", sep, le[i], (unsigned int)n);
+	}
+
+	sum = atomic_load_explicit(&h->sum, memory_order_relaxed);
+	if (h->labels) {
+		out("%s_sum{%s} %llu.%06u\n%s_count{%s} %u\n",
+		    h->name, h->labels, sum / 1000000,
+		    (unsigned int)(sum % 1000000), h->name, h->labels,
+		    (unsigned int)n);
+	} else {
+		out("%s_sum %llu.%06u\n%s_count %u\n", h->name,
+		    sum / 1000000,
+		    (unsigned int)(sum % 1000000), h->name, (unsigned int)n);
+	}
+
+#undef out
+	return off;
+}
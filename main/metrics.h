@@ -0,0 +1,51 @@
+#ifndef LIGHTCTL_METRICS_H
+#define LIGHTCTL_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Latency histograms
+ *
+ * The buckets are fixed, a power of 4 microseconds apart, from 1 us to
+ * about a second, so observing a value takes a couple of atomic adds,
+ * and never allocates.
+ */
+#define METRICS_BUCKETS 12
+
+enum {
+	M_HTTP_ON,       /**< HEAD /on                               */
+	M_HTTP_OFF,      /**< HEAD /off                              */
+	M_HTTP_STATUS,   /**< HEAD /status                           */
+	M_HTTP_SCHEDULE, /**< /schedule, and everything under it     */
+	M_HTTP_BATCH,    /**< POST /batch                            */
+	M_HTTP_DIM,      /**< /dim and /channels                     */
+	M_HTTP_INDEX,    /**< The UI                                 */
+	M_QUEUE,         /**< Command queued, to being run           */
+	M_CONTROL,       /**< Carrying out a command                 */
+	M_ACTUATE,       /**< ON/OFF queued, to the lights switching */
+	M_LIGHTS,        /**< lights_on() / lights_off()             */
+	M_LOCK,          /**< Waiting in settings_lock()             */
+	M_DALLAS,        /**< DS1302 transfer, CE high to CE low     */
+	M_SCHEDULE,      /**< schedule()                             */
+	M_WIFI_BOOT,     /**< Boot, to getting an address            */
+	M_WIFI_DROP,     /**< Losing the link, to getting an address */
+	M_HTTP_FIRST,    /**< Link up, to the first request served   */
+	METRICS
+};
+
+/**
+ * Record a duration, in microseconds, or the time since t0
+ * (as in esp_timer_get_time())
+ */
+void metrics_observe(unsigned int m, uint32_t us);
+void metrics_since(unsigned int m, int64_t t0);
+
+/**
+ * Format a histogram in the Prometheus text format, along with the
+ * HELP and TYPE lines if it's the first of its name. Returns the
+ * length, which is 0 if it didn't fit.
+ */
+size_t metrics_format(unsigned int m, char *buf, size_t len);
+
+#endif /* LIGHTCTL_METRICS_H */
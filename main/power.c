@@ -0,0 +1,219 @@
+
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include <esp_attr.h>
+#include <esp_timer.h>
+#include <driver/gpio.h>
+
+#if CONFIG_LIGHTCTL_LOWPOWER
+#include <esp_sleep.h>
+#endif
+
+#include "log.h"
+#include "event.h"
+#include "ctl.h"
+#include "settings.h"
+#include "wifi.h"
+#include "power.h"
+#include "clock.h"
+
+#define SECONDS 1000000
+
+#define POWER_MAGIC 0x5750434cU /* "LCPW" */
+
+/**
+ * How long to stay up after waking or a request; Syncs are as far
+ * apart as the SNTP polls (see clock.h).
+ */
+#define AWAKE ((int64_t)CONFIG_LIGHTCTL_LOWPOWER_AWAKE_S * SECONDS)
+
+/**
+ * A timer due within this long is waited for, rather than slept until;
+ * Also how long to stay up after being woken for one.
+ */
+#define SETTLE (SECONDS / 2)
+
+/**
+ * Kept across resets, though not power cycles: magic is garbage then
+ */
+static RTC_NOINIT_ATTR struct {
+	uint32_t magic;         /**< POWER_MAGIC if valid      */
+	uint32_t lights;        /**< Lights were on            */
+	struct power_stats s;   /**< Stats                     */
+} rtc;
+
+static int64_t woke;            /**< Woke up, or booted        */
+static atomic_uint touched;     /**< Last request, in ms       */
+
+static void rtc_check(void)
+{
+	if (rtc.magic == POWER_MAGIC)
+		return;
+
+	memset(&rtc, 0, sizeof(rtc));
+	rtc.magic = POWER_MAGIC;
+}
+
+void power_lights(int on)
+{
+	rtc_check();
+	rtc.lights = (uint32_t)on;
+}
+
+int power_boot_lights(void)
+{
+	return rtc.magic == POWER_MAGIC && rtc.lights;
+}
+
+void power_touch(void)
+{
+	atomic_store_explicit(&touched,
+	                      (unsigned int)(esp_timer_get_time() / 1000),
+	                      memory_order_relaxed);
+}
+
+void power_stats(struct power_stats *s)
+{
+	rtc_check();
+	*s = rtc.s;
+	s->awake_us += (uint64_t)(esp_timer_get_time() - woke);
+}
+
+#if CONFIG_LIGHTCTL_LOWPOWER
+static const char *TAG = "power";
+
+static int64_t sync_at;         /**< Next sync is due          */
+static esp_timer_handle_t awake_timer;
+
+static void awake_expired(void *arg)
+{
+	(void)arg;
+	ctl_send(SLEEP, 0);
+}
+
+static esp_timer_create_args_t awake_args = {
+	.name     = "power_awake",
+	.callback = awake_expired,
+	.dispatch_method = ESP_TIMER_TASK
+};
+
+/**
+ * Bring the WiFi up, and stay up for a while
+ */
+static void stay_up(int64_t now)
+{
+	power_touch();
+	sync_at = now + clock_poll();
+	wifi_start();
+	esp_timer_start_once(awake_timer, AWAKE);
+}
+
+/**
+ * Wake when either switch pin leaves the level it's at. The wakeup
+ * level takes the place of the pin's interrupt type, so put back the
+ * edges the switch is watched for once awake.
+ */
+static void arm_switch(gpio_num_t pin)
+{
+	gpio_wakeup_enable(pin, gpio_get_level(pin) ? GPIO_INTR_LOW_LEVEL
+	                                           : GPIO_INTR_HIGH_LEVEL);
+}
+
+static void disarm_switch(gpio_num_t pin)
+{
+	gpio_wakeup_disable(pin);
+	gpio_set_intr_type(pin, GPIO_INTR_ANYEDGE);
+}
+
+void power_sleep(void)
+{
+	int64_t now = esp_timer_get_time(), us;
+	unsigned int idle, cause;
+
+	/* Served a request since the timer was armed */
+	idle = (unsigned int)(now / 1000) -
+	       atomic_load_explicit(&touched, memory_order_relaxed);
+	if ((int64_t)idle * 1000 < AWAKE) {
+		esp_timer_start_once(awake_timer,
+		                     (uint64_t)(AWAKE - (int64_t)idle * 1000));
+		return;
+	}
+
+	/* Let a timer that's about due run first */
+	settings_flush();
+	if ((us = esp_timer_get_next_alarm() - now) < SETTLE) {
+		esp_timer_start_once(awake_timer, SETTLE);
+		return;
+	}
+
+	cause = POWER_TIMER;
+	if (sync_at - now <= us) {
+		us    = sync_at - now;
+		cause = POWER_SYNC;
+	}
+
+	wifi_stop();
+	arm_switch(CONFIG_GPIO_SWON);
+	arm_switch(CONFIG_GPIO_SWOFF);
+	esp_sleep_enable_gpio_wakeup();
+	esp_sleep_enable_timer_wakeup((uint64_t)(us > 0 ? us : 0));
+
+	rtc_check();
+	rtc.s.awake_us += (uint64_t)(now - woke);
+	info("sleeping for %u s", (unsigned int)(us / SECONDS));
+
+	/* The LEDC keeps the lights up, off the 8 MHz clock (see dim.c) */
+	esp_light_sleep_start();
+
+	woke = esp_timer_get_time();
+	disarm_switch(CONFIG_GPIO_SWON);
+	disarm_switch(CONFIG_GPIO_SWOFF);
+	rtc.s.slept_us += (uint64_t)(woke - now);
+	if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO)
+		cause = POWER_SWITCH;
+	++rtc.s.wakeups[cause];
+	info("woke after %u s, cause %u",
+	     (unsigned int)((woke - now) / SECONDS), cause);
+
+	switch (cause) {
+	case POWER_SWITCH:
+		ctl_send(SWITCH, 0);
+		/* fall through */
+	case POWER_SYNC:
+		stay_up(woke);
+		break;
+	default:
+		esp_timer_start_once(awake_timer, SETTLE);
+		break;
+	}
+}
+
+void power_init(void)
+{
+	rtc_check();
+	++rtc.s.boots;
+	woke = esp_timer_get_time();
+
+	if (esp_timer_create(&awake_args, &awake_timer) != ESP_OK) {
+		err("failed to create timer");
+		return;
+	}
+
+	power_touch();
+	sync_at = woke + clock_poll();
+	esp_timer_start_once(awake_timer, AWAKE);
+}
+#else
+void power_sleep(void)
+{
+}
+
+void power_init(void)
+{
+	rtc_check();
+	++rtc.s.boots;
+	woke = esp_timer_get_time();
+}
+#endif /* CONFIG_LIGHTCTL_LOWPOWER */
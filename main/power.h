@@ -0,0 +1,54 @@
+#ifndef LIGHTCTL_POWER_H
+#define LIGHTCTL_POWER_H
+
+#include <stdint.h>
+
+/**
+ * Low-power mode
+ *
+ * With CONFIG_LIGHTCTL_LOWPOWER, the device stays awake, with the WiFi
+ * up, for CONFIG_LIGHTCTL_LOWPOWER_AWAKE_S after booting, or after the
+ * last request. Then it stops the WiFi, and light sleeps until the next
+ * timer is due (e.g. the schedule's), a time sync is, or the override
+ * switch moves. Only the switch, or a sync, brings the WiFi back up;
+ * After a timer, it goes back to sleep once the timer has been run.
+ *
+ * The light state and the stats are kept in RTC memory.
+ */
+enum {
+	POWER_TIMER,  /**< Woken for a timer        */
+	POWER_SWITCH, /**< Woken by the switch      */
+	POWER_SYNC,   /**< Woken to sync the time   */
+	POWER_WAKES
+};
+
+struct power_stats {
+	uint32_t boots;                /**< Boots since power-on       */
+	uint32_t wakeups[POWER_WAKES]; /**< Wakeups, by cause          */
+	uint64_t slept_us;             /**< Time asleep                */
+	uint64_t awake_us;             /**< Time awake                 */
+};
+
+/**
+ * Note that the lights were switched, or get the state they were left
+ * in, if the device was reset rather than powered up (0 otherwise).
+ */
+void power_lights(int on);
+int power_boot_lights(void);
+
+/**
+ * Note that a request was served, which keeps the device awake
+ */
+void power_touch(void);
+
+/**
+ * Sleep, if the device has been idle for long enough, and nothing is
+ * about to happen. Called from the control task on SLEEP, which is
+ * posted once the device has been awake for long enough.
+ */
+void power_sleep(void);
+
+void power_stats(struct power_stats *s);
+void power_init(void);
+
+#endif /* LIGHTCTL_POWER_H */
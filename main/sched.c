@@ -0,0 +1,333 @@
+
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+
+#include <esp_err.h>
+#include <nvs.h>
+
+#include "log.h"
+#include "sched.h"
+
+/**
+ * Minutes in a day, and words in a day's worth of minutes
+ */
+#define DAY_MINUTES 1440
+#define DAY_WORDS   (DAY_MINUTES / 32)
+#define DAY         (DAY_MINUTES * 60)
+
+/**
+ * Bytes per rule in NVS
+ */
+#define PACKED_LEN 6
+
+/**
+ * Days to look ahead for the next transition: A week, plus the rest of
+ * today, so a window that's only on one day of the week is found.
+ */
+#define HORIZON 8
+
+static const char *TAG = "sched";
+static SemaphoreHandle_t sem = NULL;
+
+static struct sched_rule rules[SCHED_MAX_RULES];
+static unsigned int nrules;
+
+/**
+ * Minute-of-week map, one bit per minute, with each day starting on a
+ * word boundary. Dates with exceptions have a day's worth of their own.
+ */
+static uint32_t week[7][DAY_WORDS];
+static struct {
+	uint32_t date;
+	uint32_t bits[DAY_WORDS];
+} dates[SCHED_MAX_DATES];
+static unsigned int ndates;
+
+static void take(void)
+{
+	while (!xSemaphoreTake(sem, pdMS_TO_TICKS(10)))
+		vTaskDelay(1);
+}
+
+/**
+ * Set the bits for minutes [from, to) of a day
+ */
+static void set_range(uint32_t *bits, unsigned int from, unsigned int to)
+{
+	uint32_t m;
+
+	while (from < to) {
+		m = ~0U << (from & 31);
+		if ((from | 31) >= to)
+			m &= ~0U >> (31 - ((to - 1) & 31));
+		bits[from >> 5] |= m;
+		from = (from | 31) + 1;
+	}
+}
+
+static void add_window(uint32_t *bits, uint32_t *next,
+                       unsigned int start, unsigned int end)
+{
+	if (start < end) {
+		set_range(bits, start, end);
+	} else if (start > end) {
+		set_range(bits, start, DAY_MINUTES);
+		set_range(next, 0, end);
+	}
+}
+
+static const uint32_t *day_bits(uint32_t day)
+{
+	unsigned int i;
+
+	for (i = 0; i < ndates; i++) {
+		if (dates[i].date == day)
+			return dates[i].bits;
+	}
+
+	/* 1970-01-01 was a Thursday */
+	return week[(day + 4) % 7];
+}
+
+/**
+ * First minute at or after m where the state of the day differs
+ * from s, or DAY_MINUTES if there isn't one.
+ */
+static unsigned int scan(const uint32_t *bits, unsigned int m, int s)
+{
+	uint32_t flip = s ? ~0U : 0, w;
+	unsigned int i = m >> 5;
+
+	if (m >= DAY_MINUTES)
+		return DAY_MINUTES;
+
+	w = (bits[i] ^ flip) & (~0U << (m & 31));
+	while (!w) {
+		if (++i == DAY_WORDS)
+			return DAY_MINUTES;
+		w = bits[i] ^ flip;
+	}
+
+	return (i << 5) + (unsigned int)__builtin_ctz(w);
+}
+
+int sched_compile(const struct lightctl_settings *s)
+{
+	unsigned int i, j, d;
+	struct sched_rule r;
+	int ret;
+
+	memset(week, 0, sizeof(week));
+	ndates = 0;
+
+	/* The daily window from the settings applies to every day */
+	for (d = 0; s->sched_sw && d < 7; d++) {
+		add_window(week[d], week[(d + 1) % 7],
+		           s->shr * 60 + s->smn, s->ehr * 60 + s->emn);
+	}
+
+	take();
+	for (i = 0; i < nrules; i++) {
+		r = rules[i];
+
+		if (!r.date) {
+			for (d = 0; d < 7; d++) {
+				if (r.days & (1 << d)) {
+					add_window(week[d], week[(d + 1) % 7],
+					           r.start, r.end);
+				}
+			}
+			continue;
+		}
+
+		for (j = 0; j < ndates && dates[j].date != r.date; j++);
+		if (j == ndates) {
+			dates[j].date = r.date;
+			memset(dates[j].bits, 0, sizeof(dates[j].bits));
+			++ndates;
+		}
+
+		/* These never run past midnight; See valid() */
+		add_window(dates[j].bits, NULL, r.start, r.end);
+	}
+
+	ret = s->sched_sw || nrules;
+	xSemaphoreGive(sem);
+	return ret;
+}
+
+int sched_state(time_t t)
+{
+	unsigned int m = (unsigned int)(t % DAY) / 60;
+
+	return (day_bits((uint32_t)(t / DAY))[m >> 5] >> (m & 31)) & 1;
+}
+
+/**
+ * The cost of this only depends on how far away the next transition
+ * is, not on the number of rules.
+ */
+time_t sched_next(time_t t, int *on)
+{
+	uint32_t day = (uint32_t)(t / DAY);
+	unsigned int d, m = (unsigned int)(t % DAY) / 60 + 1;
+	int s = sched_state(t);
+
+	for (d = 0; d < HORIZON; d++, day++, m = 0) {
+		if ((m = scan(day_bits(day), m, s)) < DAY_MINUTES) {
+			*on = !s;
+			return (time_t)day * DAY + m * 60;
+		}
+	}
+
+	*on = s;
+	return 0;
+}
+
+static void pack(uint8_t *p, const struct sched_rule *r)
+{
+	p[0] = r->date & 0xff;
+	p[1] = r->date >> 8;
+	p[2] = r->days;
+	p[3] = r->start & 0xff;
+	p[4] = (r->start >> 8) | (r->end << 4);
+	p[5] = r->end >> 4;
+}
+
+static void unpack(struct sched_rule *r, const uint8_t *p)
+{
+	r->date  = p[0] | p[1] << 8;
+	r->days  = p[2];
+	r->start = p[3] | (p[4] & 0x0f) << 8;
+	r->end   = p[4] >> 4 | p[5] << 4;
+}
+
+/**
+ * Save the rules. Must be called with the lock held.
+ */
+static void save(void)
+{
+	uint8_t buf[SCHED_MAX_RULES * PACKED_LEN];
+	nvs_handle_t h;
+	unsigned int i;
+
+	for (i = 0; i < nrules; i++)
+		pack(buf + i * PACKED_LEN, &rules[i]);
+
+	if (nvs_open("lightctl", NVS_READWRITE, &h) != ESP_OK) {
+		err("failed to open nvs");
+		return;
+	}
+
+	if (nvs_set_blob(h, "sched", buf, nrules * PACKED_LEN) != ESP_OK ||
+	    nvs_commit(h) != ESP_OK)
+		err("failed to save the rules");
+	nvs_close(h);
+}
+
+static int valid(const struct sched_rule *r)
+{
+	if (r->start >= DAY_MINUTES || r->end >= DAY_MINUTES)
+		return 0;
+	if (!r->date && (!(r->days & SCHED_ALL) || r->start == r->end))
+		return 0;
+	if (r->date && r->start > r->end)
+		return 0;
+	return 1;
+}
+
+/**
+ * Does adding a rule for this date exceed the number of dates we
+ * can keep a map for? Must be called with the lock held.
+ */
+static int too_many_dates(uint16_t date)
+{
+	unsigned int i, j, n = 0;
+
+	for (i = 0; i < nrules; i++) {
+		if (!rules[i].date)
+			continue;
+		if (rules[i].date == date)
+			return 0;
+
+		for (j = 0; j < i && rules[j].date != rules[i].date; j++);
+		n += j == i;
+	}
+
+	return n >= SCHED_MAX_DATES;
+}
+
+int sched_add(const struct sched_rule *r)
+{
+	int i = -1;
+
+	if (!valid(r))
+		return -1;
+
+	take();
+	if (nrules < SCHED_MAX_RULES &&
+	    !(r->date && too_many_dates(r->date))) {
+		i = (int)nrules++;
+		rules[i] = *r;
+		rules[i].days = r->date ? 0 : r->days & SCHED_ALL;
+		save();
+	}
+	xSemaphoreGive(sem);
+	return i;
+}
+
+int sched_del(unsigned int i)
+{
+	int ret = -1;
+
+	take();
+	if (i < nrules) {
+		memmove(rules + i, rules + i + 1,
+		        (nrules - i - 1) * sizeof(*rules));
+		--nrules;
+		save();
+		ret = 0;
+	}
+	xSemaphoreGive(sem);
+	return ret;
+}
+
+unsigned int sched_rules(struct sched_rule *r, unsigned int n)
+{
+	unsigned int ret;
+
+	take();
+	if (n > nrules) n = nrules;
+	memcpy(r, rules, n * sizeof(*r));
+	ret = nrules;
+	xSemaphoreGive(sem);
+	return ret;
+}
+
+void sched_init(void)
+{
+	uint8_t buf[SCHED_MAX_RULES * PACKED_LEN];
+	size_t len = sizeof(buf);
+	nvs_handle_t h;
+	unsigned int i;
+
+	if ((sem = xSemaphoreCreateBinary()))
+		xSemaphoreGive(sem);
+	else err("failed to create semaphore");
+
+	if (nvs_open("lightctl", NVS_READONLY, &h) != ESP_OK)
+		return;
+
+	if (nvs_get_blob(h, "sched", buf, &len) == ESP_OK) {
+		for (i = 0; i < len / PACKED_LEN; i++) {
+			unpack(&rules[nrules], buf + i * PACKED_LEN);
+			if (valid(&rules[nrules])) ++nrules;
+		}
+
+		info("loaded %u rules", nrules);
+	}
+
+	nvs_close(h);
+}
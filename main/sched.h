@@ -0,0 +1,84 @@
+#ifndef LIGHTCTL_SCHED_H
+#define LIGHTCTL_SCHED_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "settings.h"
+
+/**
+ * Limits on the schedule rules
+ */
+#define SCHED_MAX_RULES 16 /**< Rules, weekly and dated        */
+#define SCHED_MAX_DATES 4  /**< Distinct dates with exceptions */
+
+/**
+ * Days of the week, as in tm_wday
+ */
+#define SCHED_SUN (1 << 0)
+#define SCHED_MON (1 << 1)
+#define SCHED_TUE (1 << 2)
+#define SCHED_WED (1 << 3)
+#define SCHED_THU (1 << 4)
+#define SCHED_FRI (1 << 5)
+#define SCHED_SAT (1 << 6)
+#define SCHED_ALL 0x7f
+
+/**
+ * An on/off window (UTC)
+ *
+ * Weekly rules apply on the given days, and run into the next day when
+ * start > end. Dated rules replace the weekly ones for the whole of that
+ * date, and can't run past midnight, so start > end is invalid; A dated
+ * rule with start == end keeps the lights off for the day.
+ */
+struct sched_rule {
+	uint16_t date;  /**< Days since 1970-01-01, or 0 if weekly */
+	uint8_t days;   /**< Days of the week (weekly rules)       */
+	uint16_t start; /**< Minute of the day to turn on          */
+	uint16_t end;   /**< Minute of the day to turn off         */
+};
+
+/**
+ * Add a rule, returning its index, or -1 if it's invalid or there's
+ * no room for it. The rules are saved to NVS.
+ */
+int sched_add(const struct sched_rule *r);
+
+/**
+ * Remove the rule at index i, returning -1 if there's no such rule
+ */
+int sched_del(unsigned int i);
+
+/**
+ * Copy up to n rules into r, returning the number of rules
+ */
+unsigned int sched_rules(struct sched_rule *r, unsigned int n);
+
+/**
+ * Build the minute-of-week map from the rules, and the daily window
+ * in the settings, if it's enabled. The lookups below use the last map
+ * built; This, and they, are only to be called from the control task.
+ *
+ * Returns non-zero if there's anything scheduled: The rules apply with
+ * or without the daily window.
+ */
+int sched_compile(const struct lightctl_settings *s);
+
+/**
+ * Should the lights be on at t?
+ */
+int sched_state(time_t t);
+
+/**
+ * Time of the first transition after t, and whether it's an "on"
+ * transition, or 0 if there's none within the next week.
+ */
+time_t sched_next(time_t t, int *on);
+
+/**
+ * Load the rules from NVS
+ */
+void sched_init(void);
+
+#endif /* LIGHTCTL_SCHED_H */
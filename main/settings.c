@@ -1,30 +1,156 @@
 
+#include <string.h>
+#include <stdatomic.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/semphr.h>
 
+#include <esp_timer.h>
+
 #include "log.h"
+#include "event.h"
+#include "ctl.h"
+#include "dallas.h"
 #include "settings.h"
+#include "metrics.h"
+
+/**
+ * Microseconds to wait before writing back changes
+ */
+#define FLUSH_DELAY ((uint64_t)CONFIG_LIGHTCTL_SETTINGS_FLUSH_MS * 1000)
+
+/**
+ * Optimistic snapshot attempts before waiting on the writer
+ */
+#define SNAPSHOT_TRIES 4
 
 struct lightctl_settings settings;
 static SemaphoreHandle_t sem = NULL;
+static esp_timer_handle_t flush_timer;
 static const char *TAG = "settings";
 
-void settings_lock(void)
+/**
+ * Published copy of the settings, and its sequence count. The count is
+ * odd while a new version is being copied in.
+ */
+static struct lightctl_settings published;
+static atomic_uint seq;
+
+static void take(void)
 {
 	while (!xSemaphoreTake(sem, pdMS_TO_TICKS(10)))
 		vTaskDelay(1);
 }
 
+void settings_lock(void)
+{
+	int64_t t = esp_timer_get_time();
+
+	take();
+	metrics_since(M_LOCK, t);
+}
+
+/**
+ * Publish the changes made while holding the lock. Readers only ever
+ * wait for this copy, not for the writer.
+ */
 void settings_unlock(void)
 {
+	atomic_fetch_add_explicit(&seq, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(&published, &settings, sizeof(published));
+	atomic_fetch_add_explicit(&seq, 1, memory_order_release);
+	xSemaphoreGive(sem);
+}
+
+/**
+ * Copy the published settings, retrying if a new version is being
+ * published. If that keeps happening (e.g. we've preempted the writer
+ * on this core), wait for it on the semaphore instead of spinning.
+ */
+void settings_snapshot(struct lightctl_settings *s)
+{
+	unsigned int i, v;
+
+	for (i = 0; i < SNAPSHOT_TRIES; i++) {
+		v = atomic_load_explicit(&seq, memory_order_acquire);
+		if (v & 1) continue;
+
+		memcpy(s, &published, sizeof(*s));
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&seq, memory_order_relaxed) == v)
+			return;
+	}
+
+	take();
+	memcpy(s, &published, sizeof(*s));
 	xSemaphoreGive(sem);
 }
 
+uint32_t settings_version(void)
+{
+	return atomic_load_explicit(&seq, memory_order_acquire) >> 1;
+}
+
+/**
+ * The write-back itself happens on the control task, along with the
+ * rest of the dallas writes.
+ */
+static void flush_later(void *arg)
+{
+	(void)arg;
+	ctl_send(FLUSH, 0);
+}
+
+/**
+ * Changes made before the timer expires are written back together,
+ * so the timer isn't restarted if it's already running.
+ */
+void settings_dirty(unsigned int fields)
+{
+	settings.dirty |= fields;
+	if (!esp_timer_is_active(flush_timer))
+		esp_timer_start_once(flush_timer, FLUSH_DELAY);
+}
+
+/**
+ * Snapshot the dirty fields under the lock, then write them out in a
+ * single burst. A RAM burst always starts at the first byte, so this
+ * writes everything up to the last dirty field.
+ */
+void settings_flush(void)
+{
+	uint8_t ram[SETTINGS_LEN - 1];
+	unsigned int dirty, n;
+
+	esp_timer_stop(flush_timer);
+	settings_lock();
+	dirty          = settings.dirty;
+	settings.dirty = 0;
+	ram[0]         = settings.light_sw;
+	ram[1]         = settings.sched_sw;
+	ram[2]         = settings.shr;
+	ram[3]         = settings.smn;
+	ram[4]         = settings.ehr;
+	ram[5]         = settings.emn;
+	settings_unlock();
+
+	for (n = 0; dirty >> n; n++);
+	if (n) dallas_write_burst(DALLAS_RAM_BURST, ram, n);
+}
+
+static esp_timer_create_args_t flush_timer_args = {
+	.name     = "settings_flush",
+	.callback = flush_later,
+	.dispatch_method = ESP_TIMER_TASK
+};
+
 void settings_init(void)
 {
 	if ((sem = xSemaphoreCreateBinary()))
 		xSemaphoreGive(sem);
 	else err("failed to create semaphore");
-}
 
+	if (esp_timer_create(&flush_timer_args, &flush_timer) != ESP_OK)
+		err("failed to create flush timer");
+}
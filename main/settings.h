@@ -3,6 +3,19 @@
 
 #include <stdint.h>
 
+/**
+ * Dirty bits for the fields persisted in the dallas RAM. These are
+ * in the same order as the SETTINGS_* addresses.
+ */
+#define DIRTY_SW    (1 << 0) /**< light_sw */
+#define DIRTY_SSW   (1 << 1) /**< sched_sw */
+#define DIRTY_SHR   (1 << 2) /**< shr      */
+#define DIRTY_SMN   (1 << 3) /**< smn      */
+#define DIRTY_EHR   (1 << 4) /**< ehr      */
+#define DIRTY_EMN   (1 << 5) /**< emn      */
+#define DIRTY_SCHED (DIRTY_SSW | DIRTY_SHR | DIRTY_SMN | \
+                     DIRTY_EHR | DIRTY_EMN)
+
 extern struct lightctl_settings {
 	uint8_t lights_status; /**< Current lights status      */
 	uint8_t light_sw;      /**< Selected on/off state      */
@@ -12,10 +25,38 @@ extern struct lightctl_settings {
 	uint8_t smn;           /**< Schedule: Starting minute  */
 	uint8_t ehr;           /**< Schedule: Ending hour      */
 	uint8_t emn;           /**< Schedule: Ending minute    */
+	uint8_t dirty;         /**< Fields to write back       */
 } settings;
 
+/**
+ * Take the lock to modify the settings. Releasing it publishes a new
+ * version of them for settings_snapshot().
+ */
 void settings_lock(void);
 void settings_unlock(void);
+
+/**
+ * Get a consistent copy of the last published version of the settings,
+ * without taking the lock
+ */
+void settings_snapshot(struct lightctl_settings *s);
+
+/**
+ * Version of the settings, bumped every time they're unlocked
+ */
+uint32_t settings_version(void);
+
+/**
+ * Mark fields as changed, and schedule them to be written back to
+ * the dallas. Must be called with the lock held.
+ */
+void settings_dirty(unsigned int fields);
+
+/**
+ * Write any changed fields back to the dallas
+ */
+void settings_flush(void);
+
 void settings_init(void);
 
 #endif /* LIGHTCTL_SETTINGS_H */
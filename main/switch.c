@@ -0,0 +1,143 @@
+
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+
+#include <esp_attr.h>
+#include <esp_timer.h>
+#include <driver/gpio.h>
+
+#include "log.h"
+#include "event.h"
+#include "ctl.h"
+#include "switch.h"
+#include "trace.h"
+
+/**
+ * Microseconds without an edge before the switch is considered settled
+ */
+#define WINDOW ((int64_t)CONFIG_LIGHTCTL_SWITCH_DEBOUNCE_MS * 1000)
+
+static const char *TAG = "switch";
+static esp_timer_handle_t timer;
+static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * The burst in progress, shared with the ISR
+ */
+static struct {
+	int64_t first;    /**< Time of the first edge */
+	int64_t last;     /**< Time of the last edge  */
+	uint32_t edges;   /**< Edges so far           */
+	int pending;      /**< DEBOUNCE was posted    */
+} burst;
+
+static struct switch_stats stats;
+static int settled; /**< Level of the pins, as of the last SWITCH */
+
+static int level(void)
+{
+	return gpio_get_level(CONFIG_GPIO_SWON) |
+	       gpio_get_level(CONFIG_GPIO_SWOFF) << 1;
+}
+
+static void IRAM_ATTR switch_isr(void *arg)
+{
+	int64_t now = esp_timer_get_time();
+	int pin     = (int)(intptr_t)arg, first;
+
+	trace(TR_EDGE, (uint8_t)(pin | gpio_get_level(pin) << 7));
+	portENTER_CRITICAL_ISR(&mux);
+	burst.last = now;
+	burst.edges++;
+	if ((first = !burst.pending)) {
+		burst.first   = now;
+		burst.pending = 1;
+	}
+	portEXIT_CRITICAL_ISR(&mux);
+
+	if (!first)
+		return;
+
+	/* Let the next edge try again */
+	if (ctl_send_isr(DEBOUNCE)) {
+		portENTER_CRITICAL_ISR(&mux);
+		burst.pending = 0;
+		burst.edges   = 0;
+		stats.dropped++;
+		portEXIT_CRITICAL_ISR(&mux);
+	}
+}
+
+/**
+ * Re-arm the timer until there's been no edge for a whole window,
+ * then close the burst and post the settled state.
+ */
+static void settle(void *arg)
+{
+	int64_t now = esp_timer_get_time(), quiet;
+	uint32_t edges, us;
+	int s;
+
+	(void)arg;
+	portENTER_CRITICAL(&mux);
+	if ((quiet = now - burst.last) < WINDOW) {
+		portEXIT_CRITICAL(&mux);
+		esp_timer_start_once(timer, (uint64_t)(WINDOW - quiet));
+		return;
+	}
+
+	edges         = burst.edges;
+	us            = (uint32_t)(now - burst.first);
+	burst.edges   = 0;
+	burst.pending = 0;
+
+	stats.bursts++;
+	stats.edges += edges;
+	if (edges > stats.max_edges) stats.max_edges = edges;
+	stats.settle_us = us;
+	if (us > stats.max_settle_us) stats.max_settle_us = us;
+	portEXIT_CRITICAL(&mux);
+
+	if ((s = level()) == settled) {
+		portENTER_CRITICAL(&mux);
+		stats.glitches++;
+		portEXIT_CRITICAL(&mux);
+		debug("glitch: %u edges", (unsigned int)edges);
+		return;
+	}
+
+	settled = s;
+	debug("settled after %u edges, %u us",
+	      (unsigned int)edges, (unsigned int)us);
+	ctl_send(SWITCH, 0);
+}
+
+void switch_stats(struct switch_stats *s)
+{
+	portENTER_CRITICAL(&mux);
+	*s = stats;
+	portEXIT_CRITICAL(&mux);
+}
+
+void switch_debounce(void)
+{
+	esp_timer_start_once(timer, (uint64_t)WINDOW);
+}
+
+static esp_timer_create_args_t timer_args = {
+	.name     = "switch_debounce",
+	.callback = settle,
+	.dispatch_method = ESP_TIMER_TASK
+};
+
+void switch_init(void)
+{
+	if (esp_timer_create(&timer_args, &timer) != ESP_OK)
+		err("failed to create debounce timer");
+
+	settled = level();
+	gpio_isr_handler_add(CONFIG_GPIO_SWON, switch_isr,
+	                     (void *)CONFIG_GPIO_SWON);
+	gpio_isr_handler_add(CONFIG_GPIO_SWOFF, switch_isr,
+	                     (void *)CONFIG_GPIO_SWOFF);
+}
@@ -0,0 +1,39 @@
+#ifndef LIGHTCTL_SWITCH_H
+#define LIGHTCTL_SWITCH_H
+
+#include <stdint.h>
+
+/**
+ * Override switch debouncing
+ *
+ * The ISR only timestamps the edges. Once neither pin has changed for
+ * CONFIG_LIGHTCTL_SWITCH_DEBOUNCE_MS, a single SWITCH is posted,
+ * if the switch settled somewhere other than where it was before.
+ */
+struct switch_stats {
+	uint32_t bursts;        /**< Bursts of edges, settled          */
+	uint32_t edges;         /**< Edges in those bursts             */
+	uint32_t glitches;      /**< Bursts which changed nothing      */
+	uint32_t dropped;       /**< Bursts lost to a full queue       */
+	uint32_t max_edges;     /**< Most edges in a burst             */
+	uint32_t settle_us;     /**< First edge to SWITCH, last burst  */
+	uint32_t max_settle_us; /**< First edge to SWITCH, worst case  */
+};
+
+/**
+ * Copy the stats. Bounces are edges - bursts.
+ */
+void switch_stats(struct switch_stats *s);
+
+/**
+ * Wait for the switch to settle. Called from the control task on
+ * DEBOUNCE, which the ISR posts on the first edge of a burst.
+ */
+void switch_debounce(void);
+
+/**
+ * Install the ISR. The pins and the ISR service must be configured.
+ */
+void switch_init(void);
+
+#endif /* LIGHTCTL_SWITCH_H */
@@ -0,0 +1,85 @@
+
+#include <stdatomic.h>
+#include <freertos/FreeRTOS.h>
+
+#include <esp_attr.h>
+#include <esp_timer.h>
+
+#include "trace.h"
+
+#define LEN  CONFIG_LIGHTCTL_TRACE_LEN
+#define MASK (LEN - 1)
+
+_Static_assert(!(LEN & MASK), "CONFIG_LIGHTCTL_TRACE_LEN isn't a power of 2");
+_Static_assert(sizeof(struct trace_rec) == 8, "trace_rec isn't packed");
+_Static_assert(sizeof(struct trace_hdr) == 16, "trace_hdr isn't packed");
+
+/**
+ * A writer claims a slot by bumping head, and has the slot read as
+ * TR_NONE until it's filled in. Only the ISRs on the same core can
+ * contend for head, so the add is cheap. The reader copies the ring,
+ * then discards whatever writers could have lapped in the meantime.
+ */
+static struct ring {
+	atomic_uint head;
+	struct {
+		uint32_t lo;
+		uint16_t hi;
+		atomic_uchar type;
+		uint8_t arg;
+	} slot[LEN];
+} rings[portNUM_PROCESSORS];
+
+void IRAM_ATTR trace(uint8_t type, uint8_t arg)
+{
+	uint64_t t       = (uint64_t)esp_timer_get_time();
+	struct ring *r   = &rings[xPortGetCoreID()];
+	unsigned int pos = atomic_fetch_add_explicit(&r->head, 1,
+	                                             memory_order_relaxed);
+
+	pos &= MASK;
+	atomic_store_explicit(&r->slot[pos].type, TR_NONE,
+	                      memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	r->slot[pos].lo  = (uint32_t)t;
+	r->slot[pos].hi  = (uint16_t)(t >> 32);
+	r->slot[pos].arg = arg;
+	atomic_store_explicit(&r->slot[pos].type, type, memory_order_release);
+}
+
+unsigned int trace_read(unsigned int core, struct trace_rec *recs,
+                        uint32_t *lost)
+{
+	unsigned int head, start, pos, i, n = 0;
+	struct ring *r;
+
+	*lost = 0;
+	if (core >= portNUM_PROCESSORS)
+		return 0;
+
+	r     = &rings[core];
+	head  = atomic_load_explicit(&r->head, memory_order_acquire);
+	start = head > LEN ? head - LEN : 0;
+
+	for (pos = start, i = 0; pos != head; pos++, i++) {
+		recs[i].type = atomic_load_explicit(&r->slot[pos & MASK].type,
+		                                    memory_order_acquire);
+		recs[i].lo   = r->slot[pos & MASK].lo;
+		recs[i].hi   = r->slot[pos & MASK].hi;
+		recs[i].arg  = r->slot[pos & MASK].arg;
+	}
+
+	/* Anything before the new start may have been overwritten */
+	atomic_thread_fence(memory_order_acquire);
+	pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+	pos = pos > LEN ? pos - LEN : 0;
+
+	for (i = 0; start + i != head; i++) {
+		if ((int)(start + i - pos) >= 0 && recs[i].type != TR_NONE &&
+		    recs[i].type < TR_TYPES)
+			recs[n++] = recs[i];
+	}
+
+	*lost = atomic_load_explicit(&r->head, memory_order_relaxed) - n;
+	return n;
+}
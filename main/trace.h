@@ -0,0 +1,74 @@
+#ifndef LIGHTCTL_TRACE_H
+#define LIGHTCTL_TRACE_H
+
+#include <stdint.h>
+
+/**
+ * Event trace
+ *
+ * Each core keeps the last CONFIG_LIGHTCTL_TRACE_LEN events recorded
+ * on it in a ring. Recording one takes a timestamp, an atomic add and
+ * a few stores, from a task or an ISR, so it's always on.
+ */
+enum {
+	TR_NONE,      /**< Nothing, or a record being written */
+	TR_EDGE,      /**< Switch edge: pin | level << 7      */
+	TR_POST,      /**< Command queued: command ID         */
+	TR_CMD,       /**< Command started: command ID        */
+	TR_CMD_END,   /**< Command done: command ID           */
+	TR_LIGHTS,    /**< Lights switched: 1 if on           */
+	TR_SCHEDULE,  /**< Schedule timer fired: 1 if "on"    */
+	TR_WIFI,      /**< WiFi event: event ID               */
+	TR_IP,        /**< IP event: event ID                 */
+	TR_HTTP,      /**< Request started: M_HTTP_*          */
+	TR_HTTP_END,  /**< Request done: M_HTTP_*             */
+	TR_BOOT,      /**< Boot phase started: BOOT_*         */
+	TR_BOOT_END,  /**< Boot phase done: BOOT_*            */
+	TR_BOOT_MARK, /**< Boot milestone reached: BOOT_*     */
+	TR_TYPES
+};
+
+/**
+ * A record, with the low 48 bits of esp_timer_get_time()
+ */
+struct trace_rec {
+	uint32_t lo;  /**< Time, low 32 bits  */
+	uint16_t hi;  /**< Time, high 16 bits */
+	uint8_t type; /**< TR_*               */
+	uint8_t arg;  /**< As above           */
+};
+
+/**
+ * Dump format (GET /trace), little-endian: A trace_hdr, then for each
+ * core, a trace_core followed by its records, oldest first.
+ */
+#define TRACE_MAGIC   0x5254434cU /* "LCTR" */
+#define TRACE_VERSION 1
+
+struct trace_hdr {
+	uint32_t magic;   /**< TRACE_MAGIC                  */
+	uint8_t version;  /**< TRACE_VERSION                */
+	uint8_t cores;    /**< Number of cores that follow  */
+	uint16_t len;     /**< Records per ring             */
+	int64_t now;      /**< Time of the dump             */
+};
+
+struct trace_core {
+	uint32_t n;       /**< Records that follow          */
+	uint32_t lost;    /**< Records overwritten, or torn */
+};
+
+/**
+ * Record an event on the current core
+ */
+void trace(uint8_t type, uint8_t arg);
+
+/**
+ * Copy the records of a core's ring into recs, which has room for
+ * CONFIG_LIGHTCTL_TRACE_LEN of them, oldest first. Returns how many
+ * were copied, and sets lost to how many were recorded but not copied.
+ */
+unsigned int trace_read(unsigned int core, struct trace_rec *recs,
+                        uint32_t *lost);
+
+#endif /* LIGHTCTL_TRACE_H */
@@ -1,25 +1,39 @@
 
 #include <stdint.h>
+#include <string.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
 #include <esp_err.h>
+#include <esp_attr.h>
 #include <esp_event.h>
+#include <esp_timer.h>
 #include <esp_netif.h>
 #include <esp_wifi.h>
-#include <nvs_flash.h>
+#include <nvs.h>
 #include <driver/gpio.h>
 
 #include "log.h"
 #include "event.h"
+#include "ctl.h"
+#include "metrics.h"
 #include "wifi.h"
+#include "trace.h"
+#include "boot.h"
 
-#define RETRY_DELAY pdMS_TO_TICKS(CONFIG_WIFI_RETRY_MS)
+/**
+ * Retry delays: The first retry is immediate, after which the delay
+ * doubles from RETRY_MIN up to RETRY_MAX.
+ */
+#define RETRY_MIN ((uint64_t)CONFIG_WIFI_RETRY_MS * 1000)
+#define RETRY_MAX ((uint64_t)CONFIG_WIFI_RETRY_MAX_MS * 1000)
+
+#define AP_MAGIC 0x5041434cU /* "LCAP" */
 
 static const char *TAG = "wifi";
 
-static unsigned int retries = CONFIG_WIFI_MAX_RETRIES;
 static TaskHandle_t blinker = NULL;
+static esp_timer_handle_t retry_timer;
 
 static wifi_config_t wifi_config = {
 	.sta = {
@@ -36,6 +50,27 @@ static wifi_country_t wifi_country = {
 	.policy       = WIFI_COUNTRY_POLICY_AUTO
 };
 
+/**
+ * The AP we last got an address from. This is kept in RTC memory across
+ * deep sleep and resets, and in NVS across power cycles, so that the
+ * first attempt to connect can skip the scan. The address itself is
+ * requested again by the DHCP client (CONFIG_LWIP_DHCP_RESTORE_LAST_IP).
+ */
+struct ap {
+	uint32_t magic;   /**< AP_MAGIC if valid */
+	uint8_t bssid[6]; /**< BSSID             */
+	uint8_t channel;  /**< Primary channel   */
+	uint8_t pad;
+};
+
+static RTC_DATA_ATTR struct ap cached;
+static struct ap joined;      /**< The AP we're associated with     */
+
+static unsigned int failures; /**< Consecutive failed attempts      */
+static int connected;         /**< Got an address                   */
+static int lost;              /**< LOSTCONN was sent                */
+static int64_t down;          /**< When the link went down; 0: boot */
+
 /**
  * Blink the LED with the configured period, 50% duty cycle while
  * we're connecting to the WiFi.
@@ -51,107 +86,206 @@ static void led_blinker(void *params)
 	(void)params;
 }
 
+static void blink(int on, int level)
+{
+	if (on && !blinker) {
+		xTaskCreate(led_blinker, "wifi_led", 1024, NULL, 1, &blinker);
+	} else if (!on && blinker) {
+		vTaskDelete(blinker);
+		blinker = NULL;
+	}
+
+	if (!on) gpio_set_level(CONFIG_GPIO_STATUS_LED, level);
+}
+
+static void ap_load(void)
+{
+	size_t len = sizeof(cached);
+	nvs_handle_t h;
+
+	if (cached.magic == AP_MAGIC)
+		return;
+
+	if (nvs_open("lightctl", NVS_READONLY, &h) != ESP_OK)
+		return;
+
+	if (nvs_get_blob(h, "wifi_ap", &cached, &len) != ESP_OK ||
+	    len != sizeof(cached))
+		cached.magic = 0;
+	nvs_close(h);
+}
+
+/**
+ * Remember the AP we're on, writing it to NVS only if it changed
+ */
+static void ap_save(void)
+{
+	nvs_handle_t h;
+
+	joined.magic = AP_MAGIC;
+	if (!memcmp(&joined, &cached, sizeof(cached)))
+		return;
+
+	cached = joined;
+	if (nvs_open("lightctl", NVS_READWRITE, &h) != ESP_OK)
+		return;
+
+	if (nvs_set_blob(h, "wifi_ap", &cached, sizeof(cached)) != ESP_OK ||
+	    nvs_commit(h) != ESP_OK)
+		err("failed to save the AP");
+	nvs_close(h);
+}
+
+/**
+ * Go straight for the cached AP on the first attempt after booting or
+ * losing the link, and scan for the SSID after that.
+ */
+static void join(int fast)
+{
+	wifi_sta_config_t *sta = &wifi_config.sta;
+
+	if (fast && cached.magic == AP_MAGIC) {
+		info("connecting to the last AP, on channel %u...",
+		     cached.channel);
+		memcpy(sta->bssid, cached.bssid, sizeof(sta->bssid));
+		sta->bssid_set   = 1;
+		sta->channel     = cached.channel;
+		sta->scan_method = WIFI_FAST_SCAN;
+	} else {
+		info("connecting...");
+		sta->bssid_set   = 0;
+		sta->channel     = 0;
+		sta->scan_method = WIFI_ALL_CHANNEL_SCAN;
+	}
+
+	esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config);
+	esp_wifi_connect();
+}
+
+static void retry(void *arg)
+{
+	(void)arg;
+	blink(1, 0);
+	join(0);
+}
+
+static esp_timer_create_args_t retry_args = {
+	.name     = "wifi_retry",
+	.callback = retry,
+	.dispatch_method = ESP_TIMER_TASK
+};
+
+static void backoff(int fast)
+{
+	unsigned int shift = failures - 2;
+	uint64_t us;
+
+	if (failures < 2) {
+		join(fast);
+		return;
+	}
+
+	us = shift < 16 ? RETRY_MIN << shift : RETRY_MAX;
+	us = us < RETRY_MAX ? us : RETRY_MAX;
+	info("retrying in %u ms", (unsigned int)(us / 1000));
+	esp_timer_start_once(retry_timer, us);
+}
+
 static void got_ip(void *arg, esp_event_base_t event_base,
                    int32_t event_id, void *event_data)
 {
-	esp_event_handler_instance_unregister(IP_EVENT, ESP_EVENT_ANY_ID,
-	                                      got_ip);
+	int64_t now = esp_timer_get_time();
 
-	if (blinker) {
-		vTaskDelete(blinker);
-		blinker = NULL;
+	trace(TR_IP, (uint8_t)event_id);
+	if (connected)
+		return;
+
+	boot_mark(BOOT_IP);
+	metrics_observe(down ? M_WIFI_DROP : M_WIFI_BOOT,
+	                (uint32_t)(now - down));
+	if (down) {
+		info("got an address %u ms after losing the link, "
+		     "%u failed attempts", (unsigned int)((now - down) / 1000),
+		     failures);
+	} else {
+		info("got an address %u ms after boot, %u failed attempts",
+		     (unsigned int)(now / 1000), failures);
 	}
 
-	gpio_set_level(CONFIG_GPIO_STATUS_LED, 1);
-	esp_event_post_to(lightctl_ev, LIGHTCTL_EVENT, CONNECTED,
-	                  NULL, 0, 10);
+	esp_timer_stop(retry_timer);
+	connected = 1;
+	failures  = 0;
+	lost      = 0;
+	ap_save();
+	blink(0, 1);
+	ctl_send(CONNECTED, 10);
 }
 
 static void wifi_event(void *arg, esp_event_base_t event_base,
                        int32_t event_id, void *event_data)
 {
+	wifi_event_sta_connected_t *c = event_data;
+	wifi_event_sta_disconnected_t *d = event_data;
+	int was = connected;
+
+	trace(TR_WIFI, (uint8_t)event_id);
 	switch (event_id) {
 	case WIFI_EVENT_STA_START:
-		retries = CONFIG_WIFI_MAX_RETRIES;
-		if (!blinker) {
-			xTaskCreate(led_blinker, "wifi_led",
-				    1024, NULL, 1, &blinker);
-		}
-
-		goto connect;
+		failures = 0;
+		blink(1, 0);
+		join(1);
+		break;
 	case WIFI_EVENT_STA_STOP:
-		if (blinker) {
-			vTaskDelete(blinker);
-			blinker = NULL;
-		}
-
-		gpio_set_level(CONFIG_GPIO_STATUS_LED, 0);
-		esp_event_post_to(lightctl_ev, LIGHTCTL_EVENT, LOSTCONN,
-		                  NULL, 0, 10);
+		esp_timer_stop(retry_timer);
+		blink(0, 0);
+		ctl_send(LOSTCONN, 10);
+		connected = 0;
+		down      = esp_timer_get_time();
 		break;
 	case WIFI_EVENT_STA_CONNECTED:
 		info("station connected");
-		retries = CONFIG_WIFI_MAX_RETRIES;
+		memcpy(joined.bssid, c->bssid, sizeof(joined.bssid));
+		joined.channel = c->channel;
 		break;
 	case WIFI_EVENT_STA_DISCONNECTED:
-		info("station disconnected");
-		if (retries) {
-			info("retrying...");
-			--retries;
-			goto connect;
+		info("station disconnected (%u)", d->reason);
+		if (connected) {
+			connected = 0;
+			failures  = 0;
+			down      = esp_timer_get_time();
 		}
 
-		info("max retries exceeded");
-		if (blinker) {
-			vTaskDelete(blinker);
-			blinker = NULL;
+		if (++failures == CONFIG_WIFI_MAX_RETRIES && !lost) {
+			info("max retries exceeded");
+			blink(0, 0);
+			ctl_send(LOSTCONN, 10);
+			lost = 1;
 		}
 
-		gpio_set_level(CONFIG_GPIO_STATUS_LED, 0);
-		esp_event_post_to(lightctl_ev, LIGHTCTL_EVENT, LOSTCONN,
-		                  NULL, 0, 10);
-		vTaskDelay(RETRY_DELAY);
-		esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_START,
-			       NULL, 0, 10);
+		backoff(was);
 		break;
 	}
-
-	return;
-
-connect:
-	info("connecting...");
-	esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP,
-	                                    got_ip, NULL, NULL);
-	esp_event_handler_instance_register(IP_EVENT, IP_EVENT_GOT_IP6,
-	                                    got_ip, NULL, NULL);
-	esp_wifi_connect();
 }
 
 void wifi_init(void)
 {
-#if CONFIG_ESP32_WIFI_NVS_ENABLED
-	esp_err_t ret;
-	info("Initializing wifi-nvs...");
-
-	ret = nvs_flash_init();
-	if (ret == ESP_ERR_NVS_NO_FREE_PAGES ||
-	    ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-		ESP_ERROR_CHECK(nvs_flash_erase());
-		ret = nvs_flash_init();
-	}
-
-	ESP_ERROR_CHECK(ret);
-#endif
-
 	/* Initialize the network stack */
 	info("Initializing netif...");
 	ESP_ERROR_CHECK(esp_netif_init());
 	assert(esp_netif_create_default_wifi_sta());
 
+	if (esp_timer_create(&retry_args, &retry_timer) != ESP_OK)
+		err("failed to create retry timer");
+	ap_load();
+
 	/* Init and start WiFi in STA mode */
 	info("initializing...");
-	esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID,
-	                                    wifi_event, NULL, NULL);
+	esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID,
+	                           wifi_event, NULL);
+	esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP,
+	                           got_ip, NULL);
+	esp_event_handler_register(IP_EVENT, IP_EVENT_GOT_IP6,
+	                           got_ip, NULL);
 
 	wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
 	ESP_ERROR_CHECK(esp_wifi_init(&cfg));
@@ -172,3 +306,12 @@ void wifi_init(void)
 	esp_wifi_start();
 }
 
+void wifi_start(void)
+{
+	esp_wifi_start();
+}
+
+void wifi_stop(void)
+{
+	esp_wifi_stop();
+}
@@ -3,4 +3,10 @@
 
 void wifi_init(void);
 
+/**
+ * Start or stop the station, once initialized
+ */
+void wifi_start(void);
+void wifi_stop(void);
+
 #endif /* LIGHTCTL_WIFI_H */
@@ -42,25 +42,53 @@ function local_time(val) {
 	return s;
 }
 
+/**
+ * Show the state, as sent in the /status line or over /ws:
+ *
+ * override/light_sw/sched_sw/on/off/lights
+ *
+ * The switch is what was last asked for; The lights may not be, with
+ * the schedule or the override switch having had the last word.
+ */
+function show_state(text) {
+	let sw       = document.querySelector('[component=light_switch]');
+	let ssw      = document.querySelector('[component=schedule_switch]');
+	let override = document.querySelector('[component=manual_override]');
+	let lights   = document.querySelector('[component=lights_state]');
+	let on       = document.querySelector('input[name=time_on]');
+	let off      = document.querySelector('input[name=time_off]');
+	let state    = text.split('/');
+
+	sw.checked   = state[1] == 'on';
+	ssw.checked  = state[2] == 'on';
+	on.value     = local_time(state[3]);
+	off.value    = local_time(state[4]);
+	on.disabled  = ssw.checked;
+	off.disabled = ssw.checked;
+	override.textContent = state[0];
+	lights.textContent   = state[5];
+}
+
+/**
+ * Version of the state we last got from /status
+ */
+let etag = null;
+
 function update_state() {
-	fetch('/status', { method: 'HEAD' }).then(function(r) {
+	let hdrs = {};
+
+	if (etag)
+		hdrs['If-None-Match'] = etag;
+
+	fetch('/status', { method: 'HEAD', headers: hdrs }).then(function(r) {
+		if (r.status == 304)
+			return;
+
 		if (r.status != 299)
 			throw Error('Unexpected status code');
 
-		let sw       = document.querySelector('[component=light_switch]');
-		let ssw      = document.querySelector('[component=schedule_switch]');
-		let override = document.querySelector('[component=manual_override]');
-		let on       = document.querySelector('input[name=time_on]');
-		let off      = document.querySelector('input[name=time_off]');
-		let state    = r.statusText.split('/');
-
-		sw.checked   = state[1] == 'on';
-		ssw.checked  = state[2] == 'on';
-		on.value     = local_time(state[3]);
-		off.value    = local_time(state[4]);
-		on.disabled  = ssw.checked;
-		off.disabled = ssw.checked;
-		override.textContent = state[0];
+		etag = r.headers.get('ETag');
+		show_state(r.statusText);
 	}).catch(function(e) {
 		ons.notification.toast(
 			'Failed to fetch the current state',
@@ -69,6 +97,37 @@ function update_state() {
 	});
 }
 
+/**
+ * The device pushes the state over /ws whenever it changes. While
+ * that's down, we poll /status instead, and try to reconnect.
+ */
+let poll = null;
+
+function subscribe() {
+	let ws = new WebSocket('ws://' + location.host + '/ws');
+
+	ws.onopen = function() {
+		clearInterval(poll);
+		poll = null;
+	};
+
+	ws.onmessage = function(e) {
+		show_state(e.data);
+	};
+
+	ws.onclose = function() {
+		if (!poll) {
+			update_state();
+			poll = setInterval(function() {
+				if (!document.hidden)
+					update_state();
+			}, 5000);
+		}
+
+		setTimeout(subscribe, 5000);
+	};
+}
+
 ons.ready(function() {
 	let sw  = document.querySelector('[component=light_switch]');
 	let ssw = document.querySelector('[component=schedule_switch]');
@@ -77,7 +136,14 @@ ons.ready(function() {
 		fetch(
 			this.checked ? '/on' : '/off',
 			{ method: 'HEAD' }
-		).catch(function(e) {
+		).then(function(r) {
+			if (r.status != 299)
+				throw Error('Unexpected status code');
+
+			/* The override switch may have kept them as they were */
+			etag = r.headers.get('ETag');
+			show_state(r.statusText);
+		}).catch(function(e) {
 			ons.notification.toast(
 				'Failed to turn the lights ' +
 				(sw.checked ? 'on' : 'off'),
@@ -116,6 +182,6 @@ ons.ready(function() {
 		});
 	});
 
-	update_state();
+	subscribe();
 });
 